@@ -471,7 +471,12 @@
   signal
   waiting
   malloced-ptr
-  spinlock)
+  spinlock
+  handoff
+  acquisitions
+  contended
+  wait-usecs
+  spin-estimate)
 
 (define-storage-layout rwlock 0
   spin
@@ -630,6 +635,9 @@
   lisp-gettimeofday
   lisp-sigexit
   jvm-init
+  utf8-decode-run
+  utf8-encode-run
+  utf8-length-of-encoding
 )
 
 (defmacro nrs-offset (name)
@@ -2808,6 +2808,16 @@
   (:byte 2)
   :no-interrupt)
 
+;;; A GC safepoint poll: trap if the GC's asked this thread to stop.
+(define-x8632-vinsn safepoint-poll (()
+                                    ())
+  (btl (:$ub (:apply + arch::tcr-flag-bit-safepoint-request x8632::fixnumshift))
+       (:@ (:%seg :rcontext) x8632::tcr.flags))
+  (jae :no-request)
+  (ud2a)
+  (:byte 11)
+  :no-request)
+
 ;;; check-2d-bound
 ;;; check-3d-bound
 
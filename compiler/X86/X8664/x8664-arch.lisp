@@ -728,6 +728,11 @@
   safe-ref-address
   pending-io-info
   io-datum
+  allocation-gc-num                     ; GC_NUM as of last new segment
+  allocation-refills                    ; new segments since then
+  profile-buffer                        ; for the sampling profiler
+  alloc-profile-buffer                  ; for the allocation profiler
+  allocation-segment-base               ; save_allocbase may be above this
 )
 
 (defconstant tcr.single-float-convert.value (+ 4 tcr.single-float-convert))
@@ -742,7 +747,12 @@
   signal
   waiting
   malloced-ptr
-  spinlock)
+  spinlock
+  handoff
+  acquisitions
+  contended
+  wait-usecs
+  spin-estimate)
 
 (define-storage-layout rwlock 0
   spin
@@ -851,6 +861,9 @@
   lisp-gettimeofday
   lisp-sigexit
   jvm-init
+  utf8-decode-run
+  utf8-encode-run
+  utf8-length-of-encoding
 )
 
 (defmacro nrs-offset (name)
@@ -4485,6 +4485,16 @@
   (:byte 2)
   :no-interrupt)
 
+;;; A GC safepoint poll: trap if the GC's asked this thread to stop.
+(define-x8664-vinsn safepoint-poll (()
+                                    ())
+  (btq (:$ub (:apply + arch::tcr-flag-bit-safepoint-request x8664::fixnumshift))
+       (:rcontext x8664::tcr.flags))
+  (jae :no-request)
+  (ud2a)
+  (:byte 11)
+  :no-request)
+
 ;;; Return dim1 (unboxed)
 (define-x8664-vinsn check-2d-bound (((dim :u64))
 				    ((i :imm)
@@ -213,6 +213,9 @@
 (defparameter *x86-lap-fixed-code-words* nil)
 (defvar *x86-lap-lfun-bits* 0)
 
+;;; Defined (as NIL) in level-0/nfasload.lisp.
+(defvar *new-function-hook*)
+
 (defun x86-lap-macro-function (name)
   (gethash (string name) (backend-lap-macros *target-backend*)))
 
@@ -1507,7 +1510,11 @@ execute them very quickly.")
         (setf (uvref function-vector (decf last)) (car c)))
       #+x8632-target
       (%update-self-references function-vector)
-      (function-vector-to-function function-vector))))
+      (let* ((function (function-vector-to-function function-vector))
+             (hook *new-function-hook*))
+        (when hook
+          (funcall hook function))
+        function))))
 
 (defun %define-x86-lap-function (name forms &optional (bits 0))
   (target-arch-case
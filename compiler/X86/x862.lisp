@@ -1114,9 +1114,13 @@
           (x862-bind-var seg rest rvloc (pop lcells))))))
   (when keys
     (apply #'x862-init-keys seg vloc lcells keys))
-  (when tail-label
-    (with-x86-local-vinsn-macros (seg)
-      (@+ tail-label)))
+  (with-x86-local-vinsn-macros (seg)
+    (when tail-label
+      (@+ tail-label))
+    ;; Self-tail-calls jump here, so this polls on each iteration of
+    ;; a self-recursive loop as well as on function entry.
+    (when *compile-safepoint-polls*
+      (! safepoint-poll)))
   (x862-seq-bind seg (%car auxen) (%cadr auxen)))
 
 
@@ -7572,7 +7576,9 @@
       (if (eq (acode-operator form) tagop)
         (let ((tag (cddr form)))
           (when (cddr tag) (! align-loop-head))
-          (@ (car tag)))
+          (@ (car tag))
+          (when (and (cddr tag) *compile-safepoint-polls*)
+            (! safepoint-poll)))
         (x862-form seg nil nil form)))
     (x862-nil seg vreg xfer)))
 
@@ -34,6 +34,7 @@
 (defconstant tcr-flag-bit-pending-exception 5)
 (defconstant tcr-flag-bit-foreign-exception 6)
 (defconstant tcr-flag-bit-pending-suspend 7)        
+(defconstant tcr-flag-bit-safepoint-request 9)
 
 
 
@@ -357,6 +358,12 @@
 (defconstant gc-trap-function-get-gc-notification-threshold 20)
 (defconstant gc-trap-function-set-gc-notification-threshold 21)
 (defconstant gc-trap-function-allocation-control 22)
+(defconstant gc-trap-function-gc-threads 23)
+(defconstant gc-trap-function-concurrent-gc 24)
+(defconstant gc-trap-function-egc-pause-target 25)
+(defconstant gc-trap-function-egc-time-goal 26)
+(defconstant gc-trap-function-background-zeroing 27)
+(defconstant gc-trap-function-snapshot 28)
 (defconstant gc-trap-function-egc-control 32)
 (defconstant gc-trap-function-configure-egc 64)
 (defconstant gc-trap-function-freeze 129)
@@ -36,6 +36,10 @@
 
 (defvar *compile-code-coverage* nil "True to instrument for code coverage")
 
+(defvar *compile-safepoint-polls* nil
+  "True to make compiled functions check for GC safepoint requests on
+entry and at the heads of loops (on targets that support it)")
+
 (defmethod print-object ((v var) stream)
   (print-unreadable-object (v stream :type t :identity t)
     (format stream "~s" (var-name v))))
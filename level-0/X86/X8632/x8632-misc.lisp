@@ -877,6 +877,12 @@
   (restore-simple-frame)
   (single-value-return))
 
+;;; Called on each iteration of a busy-wait loop.
+(defx8632lapfunction %spin-wait ()
+  (pause)
+  (movl ($ (target-nil-value)) (% arg_z))
+  (single-value-return))
+
 ;; tbd
 (defx8632lapfunction %%apply-in-frame-proto ()
   (hlt))
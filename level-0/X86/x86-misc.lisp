@@ -874,6 +874,16 @@
   (uuo-gc-trap)
   (single-value-return))
 
+;;; Fork a child that writes a heap image to FD (see SAVE-HEAP-SNAPSHOT).
+;;; Returns the child's pid, 0 if the GC is inhibited, or a negated
+;;; errno value.
+(defx86lapfunction %%save-heap-snapshot ((fd arg_x) (flags arg_y) (toplevel arg_z))
+  (check-nargs 3)
+  (unbox-fixnum fd imm1)
+  (movq ($ arch::gc-trap-function-snapshot) (% imm0))
+  (uuo-gc-trap)
+  (single-value-return))
+
 
 
 (defx86lapfunction %misc-address-fixnum ((misc-object arg_z))
@@ -1060,6 +1070,12 @@
   (restore-simple-frame)
   (single-value-return))
 
+;;; Called on each iteration of a busy-wait loop.
+(defx86lapfunction %spin-wait ()
+  (pause)
+  (movl ($ (target-nil-value)) (%l arg_z))
+  (single-value-return))
+
 ;;; This is a prototype; it can't easily keep its arguments on the stack,
 ;;; or in registers, because its job involves unwinding the stack and
 ;;; restoring registers.  Its parameters are thus kept in constants,
@@ -383,6 +383,46 @@ of sense to be turning the EGC on and off from multiple threads ..."
   (uuo-gc-trap)
   (single-value-return))
 
+;;; If N is a positive fixnum, try to use that many threads for the
+;;; parallel parts of full GCs.  Returns the number in use.
+(defx86lapfunction %gc-threads ((n arg_z))
+  (check-nargs 1)
+  (movq ($ arch::gc-trap-function-gc-threads) (% imm0))
+  (uuo-gc-trap)
+  (single-value-return))
+
+;;; Enable concurrent marking of the tenured generation if ARG is 1,
+;;; disable it if ARG is 0.  Returns T if it's enabled.
+(defx86lapfunction %concurrent-gc ((arg arg_z))
+  (check-nargs 1)
+  (movq ($ arch::gc-trap-function-concurrent-gc) (% imm0))
+  (uuo-gc-trap)
+  (single-value-return))
+
+;;; Enable background zeroing of free heap space if ARG is 1, disable
+;;; it if ARG is 0.  Returns T if it's enabled.
+(defx86lapfunction %background-zeroing ((arg arg_z))
+  (check-nargs 1)
+  (movq ($ arch::gc-trap-function-background-zeroing) (% imm0))
+  (uuo-gc-trap)
+  (single-value-return))
+
+;;; If USECS is a non-negative fixnum, try to keep EGC pauses under that
+;;; many microseconds (0 means don't.)  Returns the current target.
+(defx86lapfunction %egc-pause-target ((usecs arg_z))
+  (check-nargs 1)
+  (movq ($ arch::gc-trap-function-egc-pause-target) (% imm0))
+  (uuo-gc-trap)
+  (single-value-return))
+
+;;; If PERCENT is a non-negative fixnum, try to keep the fraction of time
+;;; spent in the EGC under PERCENT (0 means don't.)  Returns the current goal.
+(defx86lapfunction %egc-time-goal ((percent arg_z))
+  (check-nargs 1)
+  (movq ($ arch::gc-trap-function-egc-time-goal) (% imm0))
+  (uuo-gc-trap)
+  (single-value-return))
+
 (defx86lapfunction purify ()
   (check-nargs 0)
   (movq ($ arch::gc-trap-function-purify) (% imm0))
@@ -46,7 +46,9 @@
 		     (ff-call
 		      (%kernel-import target::kernel-import-new-semaphore)
 		      :signed-fullword 0
-		      :address))))
+		      :address))
+                    (#.$flags_DisposeWaitQueue
+                     (%new-wait-queue-memory))))
     (set-%gcable-macptrs% s)))
 
 (dolist (p %all-packages%)
@@ -153,6 +155,23 @@ between threads."
     (%svref r target::lock._value-cell)
     (report-bad-arg r 'recursive-lock)))
 
+(defun lock-contention-statistics (lock)
+  "Return three values: the number of times that LOCK has been obtained
+(not counting recursive acquisitions), the number of those times that
+the caller had to spin or wait for it, and the total time (in
+microseconds) spent waiting."
+  (let* ((ptr (recursive-lock-ptr lock)))
+    (values (%get-natural ptr target::lockptr.acquisitions)
+            (%get-natural ptr target::lockptr.contended)
+            (%get-natural ptr target::lockptr.wait-usecs))))
+
+(defun reset-lock-contention-statistics (lock)
+  (let* ((ptr (recursive-lock-ptr lock)))
+    (setf (%get-natural ptr target::lockptr.acquisitions) 0
+          (%get-natural ptr target::lockptr.contended) 0
+          (%get-natural ptr target::lockptr.wait-usecs) 0)
+    lock))
+
 (defun recursive-lock-whostate (r)
   (if (and (eq target::subtag-lock (typecode r))
            (eq (%svref r target::lock.kind-cell) 'recursive-lock))
@@ -170,14 +189,24 @@ between threads."
     (%svref rw target::lock._value-cell)
     (report-bad-arg rw 'read-write-lock)))
 
-(defun make-read-write-lock ()
+(defun scalable-read-write-lock-p (rw)
+  (and (eq target::subtag-lock (typecode rw))
+       (eq (%svref rw target::lock.kind-cell) 'scalable-read-write-lock)))
+
+(defun make-read-write-lock (&key scalable)
   "Create and return a read-write lock, which can be used for
-synchronization between threads."
-  (gvector :lock (%make-rwlock-ptr) 'read-write-lock 0 nil nil nil))
+synchronization between threads.  If SCALABLE is true, readers don't
+contend with each other for the lock, but writers have to wait for
+all readers to notice them; that's a better tradeoff for locks that
+are read by many threads and seldom written."
+  (if scalable
+    (%make-scalable-read-write-lock)
+    (gvector :lock (%make-rwlock-ptr) 'read-write-lock 0 nil nil nil)))
 
 (defun rwlock-read-whostate (rw)
   (if (and (eq target::subtag-lock (typecode rw))
-           (eq (%svref rw target::lock.kind-cell) 'read-write-lock))
+           (memq (%svref rw target::lock.kind-cell)
+                 '(read-write-lock scalable-read-write-lock)))
     (or (%svref rw target::lock.whostate-cell)
         (setf (%svref rw target::lock.whostate-cell)
               (%lock-whostate-string "Read lock wait" rw)))
@@ -185,7 +214,8 @@ synchronization between threads."
 
 (defun rwlock-write-whostate (rw)
   (if (and (eq target::subtag-lock (typecode rw))
-           (eq (%svref rw target::lock.kind-cell) 'read-write-lock))
+           (memq (%svref rw target::lock.kind-cell)
+                 '(read-write-lock scalable-read-write-lock)))
     (or (%svref rw target::lock.whostate-2-cell)
         (setf (%svref rw target::lock.whostate-2-cell)
               (%lock-whostate-string "Write lock wait" rw)))
@@ -203,6 +233,22 @@ synchronization between threads."
 	(make-gcable-macptr $flags_DisposeSemaphore)
 	p)))))
 
+(defun %new-wait-queue-memory ()
+  (let* ((p (malloc $wait-queue-size)))
+    (unless (%null-ptr-p p)
+      (setf (%get-natural p $wait-queue-sequence) 0
+            (%get-natural p $wait-queue-waiters) 0))
+    p))
+
+(defun %make-wait-queue-ptr ()
+  (let* ((p (%new-wait-queue-memory)))
+    (if (%null-ptr-p p)
+      (error "Can't create wait queue.")
+      (record-system-lock
+       (%setf-macptr
+        (make-gcable-macptr $flags_DisposeWaitQueue)
+        p)))))
+
 (defun make-semaphore ()
   "Create and return a semaphore, which can be used for synchronization
 between threads."
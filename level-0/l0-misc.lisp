@@ -575,6 +575,85 @@
 (eval-when (:compile-toplevel)
   (declaim (inline %lock-recursive-lock-ptr %unlock-recursive-lock-ptr)))
 
+;;; Recursive locks without futexes follow the protocol described in
+;;; the kernel's thread_manager.c: spin for a while if spinning's been
+;;; worthwhile for this lock lately, then park on the semaphore.  An owner that releases a lock
+;;; that has parked waiters hands it to one of them (in roughly FIFO
+;;; order) rather than making it available to newcomers.
+
+(defparameter *recursive-lock-spin-tries* 0)
+
+#-futex
+(defun %recursive-lock-spin-limit (ptr n)
+  (declare (fixnum n))
+  (min n (+ 16 (* 2 (the fixnum (%get-signed-natural ptr target::lockptr.spin-estimate))))))
+
+;;; Caller holds the spinlock.
+#-futex
+(defun %note-recursive-lock-spins (ptr spins)
+  (declare (fixnum spins))
+  (let* ((estimate (%get-signed-natural ptr target::lockptr.spin-estimate)))
+    (declare (fixnum estimate))
+    (setf (%get-signed-natural ptr target::lockptr.spin-estimate)
+          (+ estimate (truncate (- spins estimate) 8)))))
+
+;;; Caller holds the spinlock.
+#-futex
+(defun %take-recursive-lock-ptr (ptr p contended)
+  (setf (%get-natural ptr target::lockptr.avail) 1
+        (%get-ptr ptr target::lockptr.owner) p
+        (%get-natural ptr target::lockptr.count) 1)
+  (incf (%get-natural ptr target::lockptr.acquisitions))
+  (when contended
+    (incf (%get-natural ptr target::lockptr.contended))))
+
+#-futex
+(defun %park-for-recursive-lock-ptr (ptr lock p spin signal level spun start)
+  (let* ((registered nil)
+         (won nil))
+    (unwind-protect
+         (progn
+           (%get-spin-lock spin)
+           (if (eql 0 (%get-natural ptr target::lockptr.avail))
+             (progn
+               (%take-recursive-lock-ptr ptr p t)
+               (setq won t))
+             (progn
+               (when spun
+                 (%note-recursive-lock-spins ptr 0))
+               (incf (%get-natural ptr target::lockptr.waiting))
+               (setq registered t)))
+           (setf (%get-natural spin 0) 0)
+           (loop
+             (when won (return))
+             (let* ((*interrupt-level* level))
+               (%process-wait-on-semaphore-ptr signal 1 0 (recursive-lock-whostate lock)))
+             (%get-spin-lock spin)
+             (unless (eql 0 (%get-natural ptr target::lockptr.handoff))
+               (setf (%get-natural ptr target::lockptr.handoff) 0)
+               (decf (%get-natural ptr target::lockptr.waiting))
+               (setq registered nil)
+               (%take-recursive-lock-ptr ptr p t)
+               (incf (%get-natural ptr target::lockptr.wait-usecs)
+                     (* (- (get-internal-real-time) start)
+                        (floor 1000000 internal-time-units-per-second)))
+               (setq won t))
+             (setf (%get-natural spin 0) 0)))
+      ;; If we're giving up (because of a throw out of the wait), we may
+      ;; have consumed a wakeup that was meant to hand the lock off.
+      ;; Pass it on, or make the lock available if nobody else is waiting.
+      (when registered
+        (%get-spin-lock spin)
+        (when (eql 0 (decf (%get-natural ptr target::lockptr.waiting)))
+          (unless (eql 0 (%get-natural ptr target::lockptr.handoff))
+            (setf (%get-natural ptr target::lockptr.handoff) 0
+                  (%get-natural ptr target::lockptr.avail) 0)))
+        (let* ((handoff (%get-natural ptr target::lockptr.handoff)))
+          (setf (%get-natural spin 0) 0)
+          (unless (eql 0 handoff)
+            (%signal-semaphore-ptr signal)))))
+    t))
+
 #-futex
 (defun %lock-recursive-lock-ptr (ptr lock flag)
   (with-macptrs ((p)
@@ -585,23 +664,36 @@
     (if (istruct-typep flag 'lock-acquisition)
       (setf (lock-acquisition.status flag) nil)
       (if flag (report-bad-arg flag 'lock-acquisition)))
-    (loop
+    (let* ((level *interrupt-level*)
+           (n (%recursive-lock-spin-limit ptr *recursive-lock-spin-tries*))
+           (start 0))
+      (declare (fixnum n))
       (without-interrupts
-       (when (eql p owner)
+       (if (eql p owner)
          (incf (%get-natural ptr target::lockptr.count))
-         (when flag
-           (setf (lock-acquisition.status flag) t))
-         (return t))
-       (%get-spin-lock spin)
-       (when (eql 1 (incf (%get-natural ptr target::lockptr.avail)))
-         (setf (%get-ptr ptr target::lockptr.owner) p
-               (%get-natural ptr target::lockptr.count) 1)
-         (setf (%get-natural spin 0) 0)
-         (if flag
-           (setf (lock-acquisition.status flag) t))
-         (return t))
-       (setf (%get-natural spin 0) 0))
-      (%process-wait-on-semaphore-ptr signal 1 0 (recursive-lock-whostate lock)))))
+         (do* ((i 0 (1+ i)))
+              (())
+           (declare (fixnum i))
+           (when (eql 0 (%get-natural ptr target::lockptr.avail))
+             (%get-spin-lock spin)
+             (when (eql 0 (%get-natural ptr target::lockptr.avail))
+               (%take-recursive-lock-ptr ptr p (not (eql i 0)))
+               (unless (eql i 0)
+                 (%note-recursive-lock-spins ptr i))
+               (setf (%get-natural spin 0) 0)
+               (return))
+             (setf (%get-natural spin 0) 0))
+           (when (eql i 0)
+             ;; Contended: the wait starts now, spinning included.
+             (setq start (get-internal-real-time)))
+           (when (>= i n)
+             (%park-for-recursive-lock-ptr ptr lock p spin signal level (not (eql n 0)) start)
+             (return))
+           #+x86-target
+           (%spin-wait)))
+       (when flag
+         (setf (lock-acquisition.status flag) t))
+       t))))
 
 #+futex
 (defun %lock-recursive-lock-ptr (ptr lock flag)
@@ -707,9 +799,8 @@
              (t
               (let* ((win nil))
                 (%get-spin-lock spin)
-                (when (setq win (eql 1 (incf (%get-natural ptr target::lockptr.avail))))
-                  (setf (%get-ptr ptr target::lockptr.owner) p
-                        (%get-natural ptr target::lockptr.count) 1)
+                (when (setq win (eql 0 (%get-natural ptr target::lockptr.avail)))
+                  (%take-recursive-lock-ptr ptr p nil)
                   (if flag (setf (lock-acquisition.status flag) t)))
                 (setf (%get-ptr spin) (%null-ptr))
                 win)))))))
@@ -752,14 +843,12 @@
                           (%get-natural ptr target::lockptr.count))))
        (%get-spin-lock spin)
        (setf (%get-ptr ptr target::lockptr.owner) (%null-ptr))
-       (let* ((pending (+ (the fixnum
-                            (1- (the fixnum (%get-fixnum ptr target::lockptr.avail))))
-                          (the fixnum (%get-fixnum ptr target::lockptr.waiting)))))
-         (declare (fixnum pending))
-         (setf (%get-natural ptr target::lockptr.avail) 0
-               (%get-natural ptr target::lockptr.waiting) 0)
+       (let* ((wake (not (eql 0 (%get-natural ptr target::lockptr.waiting)))))
+         (if wake
+           (setf (%get-natural ptr target::lockptr.handoff) 1)
+           (setf (%get-natural ptr target::lockptr.avail) 0))
          (setf (%get-ptr spin) (%null-ptr))
-         (dotimes (i pending)
+         (when wake
            (%signal-semaphore-ptr signal)))))
     nil))
 
@@ -928,7 +1017,9 @@
 
 
 (defun write-lock-rwlock (lock &optional flag)
-  (%write-lock-rwlock-ptr (read-write-lock-ptr lock) lock flag))
+  (if (scalable-read-write-lock-p lock)
+    (%scalable-write-lock-rwlock lock flag)
+    (%write-lock-rwlock-ptr (read-write-lock-ptr lock) lock flag)))
 
 #-futex
 (defun %read-lock-rwlock-ptr (ptr lock &optional flag)
@@ -1002,7 +1093,9 @@
 
 
 (defun read-lock-rwlock (lock &optional flag)
-  (%read-lock-rwlock-ptr (read-write-lock-ptr lock) lock flag))
+  (if (scalable-read-write-lock-p lock)
+    (%scalable-read-lock-rwlock lock flag)
+    (%read-lock-rwlock-ptr (read-write-lock-ptr lock) lock flag)))
 
 
 
@@ -1096,7 +1189,9 @@
 
 
 (defun unlock-rwlock (lock)
-  (%unlock-rwlock-ptr (read-write-lock-ptr lock) lock))
+  (if (scalable-read-write-lock-p lock)
+    (%scalable-unlock-rwlock lock)
+    (%unlock-rwlock-ptr (read-write-lock-ptr lock) lock)))
 
 ;;; There are all kinds of ways to lose here.
 ;;; The caller must have read access to the lock exactly once,
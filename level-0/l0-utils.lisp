@@ -36,6 +36,7 @@
         ((eq code area-managed-static) :managed-static)
         ((eq code area-static) :static)
         ((eq code area-dynamic) :dynamic)
+        ((eq code area-large-objects) :large-objects)
         (t code)))
 
 (defun heap-area-code (name)
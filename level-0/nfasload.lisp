@@ -47,6 +47,11 @@
 
 (defvar *fasl-dispatch-table* #80(%bad-fasl))
 
+;;; If non-NIL, a function that's called on each compiled function
+;;; that the fasloader or the compiler creates.  (Tools that tell
+;;; external profilers about lisp functions use this.)
+(defvar *new-function-hook* nil)
+
 
 
 
@@ -431,6 +436,9 @@
           (i 0 (1+ i))
           (constidx size-of-code (1+ constidx)))
          ((= i numconst)
+          (let* ((hook *new-function-hook*))
+            (when hook
+              (funcall hook function)))
           (setf (faslstate.faslval s) function))
       (declare (fixnum i numconst constidx))
       (setf (%svref vector constidx) (%fasl-expr s)))))
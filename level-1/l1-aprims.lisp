@@ -1176,6 +1176,86 @@ are rounded up to a multiple of 64Kbytes."
            (%configure-egc e0size e1size e2size))
       (egc was-enabled))))
 
+(defun egc-pause-target ()
+  "Return the time in microseconds that ephemeral GCs are trying to stay
+under, or NIL if there's no such target."
+  (let* ((usecs #+x8664-target (%egc-pause-target -1)
+                #-x8664-target 0))
+    (unless (eql usecs 0) usecs)))
+
+(defun set-egc-pause-target (usecs)
+  "If USECS is a positive integer, adjust the thresholds of the ephemeral
+generations after each ephemeral GC so that those GCs are likely to take
+less than USECS microseconds; if it's NIL, stop doing so (the thresholds
+stay wherever they've been moved to.)  This isn't supported on all
+platforms.  Returns the new target."
+  (setq usecs (require-type usecs '(or null (integer 1 #.(ash 1 40)))))
+  #+x8664-target (%egc-pause-target (or usecs 0))
+  (egc-pause-target))
+
+(defun egc-time-goal ()
+  "Return the largest percentage of elapsed time that ephemeral GCs are
+trying to take, or NIL if there's no such goal."
+  (let* ((percent #+x8664-target (%egc-time-goal -1)
+                  #-x8664-target 0))
+    (unless (eql percent 0) percent)))
+
+(defun set-egc-time-goal (percent)
+  "If PERCENT is an integer between 1 and 99, grow the youngest ephemeral
+generation when ephemeral GCs take more than that percentage of elapsed
+time, as far as any pause target (see SET-EGC-PAUSE-TARGET) allows; if
+it's NIL, stop doing so.  This isn't supported on all platforms.  Returns
+the new goal."
+  (setq percent (require-type percent '(or null (integer 1 99))))
+  #+x8664-target (%egc-time-goal (or percent 0))
+  (egc-time-goal))
+
+
+
+(defun gc-threads ()
+  "Return the number of threads that take part in marking the heap
+during a full GC."
+  #+x8664-target (%gc-threads 0)
+  #-x8664-target 1)
+
+(defun set-gc-threads (n)
+  "Try to use N threads to mark the heap during full GCs.  Returns the
+number of threads that will actually be used, which may be less than N
+if the platform doesn't support parallel marking or if threads can't be
+created."
+  (setq n (require-type n '(integer 1 64)))
+  #+x8664-target (%gc-threads n)
+  #-x8664-target 1)
+
+(defun concurrent-gc-enabled-p ()
+  "Return T if the tenured generation is marked by a background thread
+before full GCs, NIL otherwise."
+  #+x8664-target (%concurrent-gc -1)
+  #-x8664-target nil)
+
+(defun concurrent-gc (arg)
+  "If ARG is non-NIL, try to have a background thread mark the tenured
+generation while other threads run, shortly before a full GC is likely
+to be needed; otherwise, stop doing so.  This only has an effect when
+the EGC is enabled, and it isn't supported on all platforms.  Returns
+the previous enabled status."
+  (prog1 (concurrent-gc-enabled-p)
+    #+x8664-target (%concurrent-gc (if arg 1 0))))
+
+(defun background-zeroing-enabled-p ()
+  "Return T if free heap space is cleared by a background thread after
+GCs, NIL otherwise."
+  #+x8664-target (%background-zeroing -1)
+  #-x8664-target nil)
+
+(defun background-zeroing (arg)
+  "If ARG is non-NIL, try to have a background thread clear the free
+part of the heap after each GC (so that threads which allocate
+right after a GC don't have to), otherwise stop doing so.  This
+isn't supported on all platforms.  Returns the previous enabled
+status."
+  (prog1 (background-zeroing-enabled-p)
+    #+x8664-target (%background-zeroing (if arg 1 0))))
 
 
 (defun macptr-flags (macptr)
@@ -1798,9 +1798,11 @@ to replace that class with ~s" name old-class new-class)
   (defstatic *lock-class* (make-built-in-class 'lock))
   (defstatic *recursive-lock-class* (make-built-in-class 'recursive-lock *lock-class*))
   (defstatic *read-write-lock-class* (make-built-in-class 'read-write-lock *lock-class*))
+  (defstatic *scalable-read-write-lock-class* (make-built-in-class 'scalable-read-write-lock *read-write-lock-class*))
   
   (make-istruct-class 'lock-acquisition *istruct-class*)
   (make-istruct-class 'semaphore-notification *istruct-class*)
+  (make-istruct-class 'wait-queue *istruct-class*)
   (make-istruct-class 'class-wrapper *istruct-class*)
   ;; Compiler stuff, mostly
   (make-istruct-class 'faslapi *istruct-class*)
@@ -2463,6 +2465,7 @@ to replace that class with ~s" name old-class new-class)
                   (case (%svref thing target::lock.kind-cell)
                     (recursive-lock *recursive-lock-class*)
                     (read-write-lock *read-write-lock-class*)
+                    (scalable-read-write-lock *scalable-read-write-lock-class*)
                     (t *lock-class*))))
         v))
 
@@ -448,10 +448,184 @@ a given process."
 
 (defun read-write-lock-p (l)
   (and (eq target::subtag-lock (typecode l))
-       (eq 'read-write-lock (%svref l target::lock.kind-cell))))
+       (memq (%svref l target::lock.kind-cell)
+             '(read-write-lock scalable-read-write-lock))))
 
 (setf (type-predicate 'recursive-lock) 'recursive-lock-p
-      (type-predicate 'read-write-lock) 'read-write-lock-p)
+      (type-predicate 'read-write-lock) 'read-write-lock-p
+      (type-predicate 'scalable-read-write-lock) 'scalable-read-write-lock-p)
+
+
+;;; Scalable read-write locks.  An ordinary read-write lock makes
+;;; every reader update the same shared state, so that cache line
+;;; bounces between cores even when no one ever writes.
+;;; A scalable read-write lock instead has a reader count per "slot".
+;;; Each slot has its own cache line, and each thread uses one slot.
+;;; A reader increments its slot's count and, unless a writer's active
+;;; or pending, that's all it has to do.  A writer takes an ordinary
+;;; read-write lock (for exclusion from other writers), sets the
+;;; "writer" flag, and waits until all of the slots' counts drain to
+;;; zero.  A reader that sees the flag after incrementing its count
+;;; backs off and waits (on a wait queue) for the writer to finish.
+;;;
+;;; The lock's _value cell holds the ordinary lock's pointer; its
+;;; (otherwise unused) writer cell holds a simple-vector of state:
+;;; the writer flag and the wait queue on the first cache line, then
+;;; each slot's count at the start of a later one.  Each thread keeps
+;;; track of the scalable locks it holds for reading (and how many
+;;; times), so recursive read locks don't wait for a pending writer
+;;; and so unlocking knows whether the thread was a reader.  That's
+;;; kept in a per-thread simple-vector of (lock, count) pairs, so
+;;; taking and releasing a read lock doesn't cons; the vector only
+;;; has to grow if a thread holds more scalable locks at once than
+;;; it's ever held before.
+
+(eval-when (:compile-toplevel :execute)
+  (defconstant $rwlock-line-words 8)      ;words per (64-byte) cache line
+  (defconstant $rwlock-writer 0)
+  (defconstant $rwlock-queue 1))
+
+(defvar *next-rwlock-reader-slot* -1)
+
+(defun %new-rwlock-reader-slot ()
+  (atomic-incf *next-rwlock-reader-slot*))
+
+(def-standard-initial-binding *rwlock-reader-slot* (%new-rwlock-reader-slot))
+(def-standard-initial-binding *scalable-read-locks-held*
+  (make-array 16 :initial-element nil))
+
+;;; Return the index of LOCK's pair in HELD, or NIL.  (Unused pairs
+;;; have a lock of NIL.)
+(defun %scalable-read-hold-index (lock held)
+  (declare (simple-vector held))
+  (do* ((i 0 (+ i 2))
+        (n (length held)))
+       ((>= i n))
+    (declare (fixnum i n))
+    (when (eq lock (svref held i))
+      (return i))))
+
+;;; Note that the current thread holds LOCK (once) for reading.
+(defun %note-scalable-read-hold (lock)
+  (let* ((held *scalable-read-locks-held*)
+         (i (%scalable-read-hold-index nil held)))
+    (declare (simple-vector held))
+    (unless i
+      (let* ((n (length held))
+             (new (make-array (* 2 n) :initial-element nil)))
+        (declare (fixnum n))
+        (%copy-gvector-to-gvector held 0 new 0 n)
+        (setq *scalable-read-locks-held* new
+              held new
+              i n)))
+    (setf (svref held i) lock
+          (svref held (1+ i)) 1)))
+
+(defun %make-scalable-read-write-lock ()
+  (let* ((nslots (ash 1 (integer-length (1- (min (cpu-count) 64)))))
+         (state (make-array (* $rwlock-line-words (1+ nslots))
+                            :initial-element 0)))
+    (setf (svref state $rwlock-writer) 0
+          (svref state $rwlock-queue) (make-wait-queue))
+    (gvector :lock (%make-rwlock-ptr) 'scalable-read-write-lock state
+             nil nil nil)))
+
+(defmacro scalable-rwlock-state (lock)
+  `(%svref ,lock target::lock.writer-cell))
+
+(defun %scalable-rwlock-reader-index (state)
+  (let* ((nslots (1- (floor (length state) $rwlock-line-words))))
+    (* $rwlock-line-words
+       (1+ (logand *rwlock-reader-slot* (1- nslots))))))
+
+(defun %scalable-rwlock-readers-drained (state)
+  (do* ((i $rwlock-line-words (+ i $rwlock-line-words))
+        (n (length state)))
+       ((>= i n) t)
+    (declare (fixnum i n))
+    (unless (eql 0 (svref state i))
+      (return nil))))
+
+(defun %scalable-rwlock-no-writer (state)
+  (eql 0 (svref state $rwlock-writer)))
+
+(defun %scalable-read-lock-rwlock (lock flag)
+  (if (istruct-typep flag 'lock-acquisition)
+    (setf (lock-acquisition.status flag) nil)
+    (if flag (report-bad-arg flag 'lock-acquisition)))
+  (let* ((state (scalable-rwlock-state lock))
+         (level *interrupt-level*))
+    (without-interrupts
+     (let* ((held *scalable-read-locks-held*)
+            (j (%scalable-read-hold-index lock held)))
+       (declare (simple-vector held))
+       (cond (j (incf (the fixnum (svref held (1+ j)))))
+             ((eql (%get-object (%svref lock target::lock._value-cell)
+                                target::rwlock.writer)
+                   (%current-tcr))
+              (error 'deadlock :lock lock))
+             (t
+              (let* ((i (%scalable-rwlock-reader-index state))
+                     (queue (svref state $rwlock-queue)))
+                (declare (fixnum i))
+                (loop
+                  (atomic-incf (svref state i))
+                  (when (%scalable-rwlock-no-writer state)
+                    (return))
+                  ;; A writer's waiting for readers to drain, or has
+                  ;; the lock.  Get out of its way.
+                  (atomic-decf (svref state i))
+                  (notify-wait-queue queue t)
+                  (let* ((*interrupt-level* level))
+                    (process-wait-on-queue queue (rwlock-read-whostate lock)
+                                           #'%scalable-rwlock-no-writer state))))
+              (%note-scalable-read-hold lock))))
+     (when flag
+       (setf (lock-acquisition.status flag) t))
+     t)))
+
+(defun %scalable-write-lock-rwlock (lock flag)
+  (when (%scalable-read-hold-index lock *scalable-read-locks-held*)
+    (error 'deadlock :lock lock))
+  (let* ((state (scalable-rwlock-state lock))
+         (ptr (%svref lock target::lock._value-cell)))
+    ;; Once we own the ordinary lock, FLAG says so; if we're unwound
+    ;; while waiting for readers below, unlocking will clean up.
+    (%write-lock-rwlock-ptr ptr lock flag)
+    (when (eql 1 (%get-signed-natural ptr target::rwlock.state))
+      ;; Not a recursive write lock, so we have to announce ourselves
+      ;; and wait for any readers to leave.  The atomic update is a
+      ;; full memory barrier, so any reader that increments its count
+      ;; after this will see the flag.
+      (atomic-incf (svref state $rwlock-writer))
+      (unless (%scalable-rwlock-readers-drained state)
+        (process-wait-on-queue (svref state $rwlock-queue)
+                               (rwlock-write-whostate lock)
+                               #'%scalable-rwlock-readers-drained state)))
+    t))
+
+(defun %scalable-unlock-rwlock (lock)
+  (let* ((state (scalable-rwlock-state lock))
+         (ptr (%svref lock target::lock._value-cell)))
+    (without-interrupts
+     (if (eql (%get-object ptr target::rwlock.writer) (%current-tcr))
+       (progn
+         (when (eql 1 (%get-signed-natural ptr target::rwlock.state))
+           (setf (svref state $rwlock-writer) 0)
+           (notify-wait-queue (svref state $rwlock-queue) t))
+         (%unlock-rwlock-ptr ptr lock))
+       (let* ((held *scalable-read-locks-held*)
+              (j (%scalable-read-hold-index lock held)))
+         (declare (simple-vector held))
+         (unless j
+           (error 'not-locked :lock lock))
+         (when (eql 0 (decf (the fixnum (svref held (1+ j)))))
+           (setf (svref held j) nil
+                 (svref held (1+ j)) nil)
+           (atomic-decf (svref state (%scalable-rwlock-reader-index state)))
+           (unless (%scalable-rwlock-no-writer state)
+             (notify-wait-queue (svref state $rwlock-queue) t)))))
+     t)))
 
 
 (defun grab-lock (lock &optional flag)
@@ -527,6 +701,144 @@ or for a timeout to expire."
              win))))
 
 
+;;; Wait queues.  PROCESS-WAIT polls its predicate every tick; a
+;;; thread that waits on a wait queue instead blocks until some other
+;;; thread calls NOTIFY-WAIT-QUEUE after doing something that might
+;;; make the predicate true.  Every notification increments the
+;;; queue's sequence number; a waiter reads that before calling its
+;;; predicate and doesn't block if it's changed since, so a
+;;; notification can't get lost between the test and the wait.
+;;; On Linux, waiters block on a futex on (the low 32 bits of) the
+;;; sequence number; elsewhere, they block on a semaphore and may
+;;; occasionally wake up for no reason, which is harmless.
+
+#+linux-target
+(eval-when (:compile-toplevel :execute)
+  ;; From <linux/futex.h>; see also l0-misc.lisp.
+  (defconstant FUTEX-WAIT 0)
+  (defconstant FUTEX-WAKE 1))
+
+(eval-when (:compile-toplevel :execute)
+  (defconstant $wait-queue-futex
+    (+ $wait-queue-sequence
+       #+(and big-endian-target 64-bit-target) 4
+       #-(and big-endian-target 64-bit-target) 0)))
+
+(defun make-wait-queue (&optional name)
+  "Create and return a wait queue, on which threads can wait (via
+PROCESS-WAIT-ON-QUEUE) until other threads notify them (via
+NOTIFY-WAIT-QUEUE.)"
+  (%istruct 'wait-queue
+            (%make-wait-queue-ptr)
+            #+linux-target nil
+            #-linux-target (make-semaphore)
+            name))
+
+(defun wait-queue-p (x)
+  (istruct-typep x 'wait-queue))
+
+(setf (type-predicate 'wait-queue) 'wait-queue-p)
+
+(defun wait-queue-ptr (q)
+  (if (istruct-typep q 'wait-queue)
+    (wait-queue.ptr q)
+    (report-bad-arg q 'wait-queue)))
+
+(defmethod print-object ((q wait-queue) stream)
+  (print-unreadable-object (q stream :type t :identity t)
+    (format stream "~s [~d waiting]"
+            (wait-queue.name q)
+            (%get-natural (wait-queue.ptr q) $wait-queue-waiters))))
+
+(defun notify-wait-queue (queue &optional (count 1))
+  "Wake up at most COUNT (or, if COUNT is T, all) of the threads that
+are waiting on QUEUE, so that they'll check their predicates again."
+  (let* ((p (wait-queue-ptr queue)))
+    (%atomic-incf-ptr p)                ;the sequence number
+    (let* ((waiters (%get-natural p $wait-queue-waiters)))
+      (unless (eql waiters 0)
+        #+linux-target
+        (with-macptrs ((futex (%inc-ptr p $wait-queue-futex)))
+          (int-errno-ffcall (%kernel-import target::kernel-import-lisp-futex)
+                            :address futex
+                            :int FUTEX-WAKE
+                            :int (if (eq count t) #x7fffffff (min count #x7fffffff))
+                            :address (%null-ptr)
+                            :address (%null-ptr)
+                            :int 0
+                            :int))
+        #-linux-target
+        (let* ((sem (semaphore-value (wait-queue.semaphore queue))))
+          (dotimes (i (if (eq count t) waiters (min count waiters)))
+            (%signal-semaphore-ptr sem)))))
+    nil))
+
+;;; Block until QUEUE's sequence number differs from SEQ, the queue's
+;;; notified, a signal arrives, or the (relative) timeout - if SECONDS
+;;; is non-null - expires.
+(defun %wait-on-queue (queue seq seconds nanoseconds)
+  (with-macptrs ((p (wait-queue-ptr queue)))
+    #+linux-target
+    (with-macptrs ((futex (%inc-ptr p $wait-queue-futex)))
+      (if seconds
+        (rlet ((ts :timespec))
+          (setf (pref ts :timespec.tv_sec) seconds
+                (pref ts :timespec.tv_nsec) nanoseconds)
+          (int-errno-ffcall (%kernel-import target::kernel-import-lisp-futex)
+                            :address futex :int FUTEX-WAIT :int seq
+                            :address ts :address (%null-ptr) :int 0 :int))
+        (int-errno-ffcall (%kernel-import target::kernel-import-lisp-futex)
+                          :address futex :int FUTEX-WAIT :int seq
+                          :address (%null-ptr) :address (%null-ptr) :int 0 :int)))
+    #-linux-target
+    (unless (eql seq (%get-signed-long p $wait-queue-futex))
+      (return-from %wait-on-queue nil))
+    #-linux-target
+    (%wait-on-semaphore-ptr (semaphore-value (wait-queue.semaphore queue))
+                            (or seconds #xffffff)
+                            (if seconds (floor nanoseconds 1000000) 0))))
+
+(defun %process-wait-on-queue (queue whostate deadline function args)
+  (declare (list args))
+  (with-macptrs ((p (wait-queue-ptr queue)))
+    (with-process-whostate (whostate)
+      (with-macptrs ((waiters (%inc-ptr p $wait-queue-waiters)))
+        (%atomic-incf-ptr waiters)
+        (unwind-protect
+             (loop
+               (let* ((seq (%get-signed-long p $wait-queue-futex))
+                      (val (apply function args)))
+                 (when val
+                   (return val))
+                 (if deadline
+                   (let* ((ticks (- deadline (get-tick-count))))
+                     (when (<= ticks 0)
+                       (return nil))
+                     (multiple-value-bind (seconds nanoseconds)
+                         (floor (* ticks *ns-per-tick*) 1000000000)
+                       (%wait-on-queue queue seq seconds nanoseconds)))
+                   (%wait-on-queue queue seq nil 0))))
+          (%atomic-decf-ptr waiters))))))
+
+(defun process-wait-on-queue (queue whostate function &rest args)
+  "Like PROCESS-WAIT, but rather than polling the predicate, block until
+another thread calls NOTIFY-WAIT-QUEUE on QUEUE before calling it again.
+Returns the predicate's (true) value."
+  (declare (dynamic-extent args))
+  (or (apply function args)
+      (%process-wait-on-queue queue whostate nil function args)))
+
+(defun process-wait-on-queue-with-timeout (queue whostate time function &rest args)
+  "Like PROCESS-WAIT-WITH-TIMEOUT (TIME is in ticks, or NIL to wait
+indefinitely), but wait on QUEUE as PROCESS-WAIT-ON-QUEUE does.  Returns
+the predicate's value, or NIL if the timeout expired first."
+  (declare (dynamic-extent args))
+  (or (apply function args)
+      (%process-wait-on-queue queue whostate
+                              (if time (+ (get-tick-count) time))
+                              function args)))
+
+
 (defmethod process-interrupt ((process process) function &rest args)
   "Arrange for the target process to invoke a specified function at
 some point in the near future, and then return to what it was doing."
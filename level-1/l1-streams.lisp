@@ -1428,6 +1428,72 @@
            (ioblock-outpos ioblock)
            finish-p))
 
+;;; Reads and writes of at least a buffer's worth of octets on streams
+;;; whose ioblocks are backed by file descriptors can move data between
+;;; the fd and the caller's ivector directly, rather than copying it
+;;; through the ioblock's buffer.  The functions that do that are
+;;; chosen by the ioblock's advance and force-output functions (file
+;;; streams have their own, to keep track of the file position); they're
+;;; called with the buffer empty, transfer at most
+;;; *IOBLOCK-DIRECT-IO-OCTETS* octets, and return the number of octets
+;;; transferred (0 at EOF.)  The GC is disabled while the system call
+;;; runs, so input has to be available first, and output is only done
+;;; this way to regular files.
+
+(defparameter *ioblock-direct-io-octets* (ash 1 20))
+
+(defun %ioblock-read-direct-function (ioblock)
+  #+windows-target (declare (ignore ioblock))
+  #-windows-target
+  (when (= 0 (the fixnum (ioblock-element-shift ioblock)))
+    (case (ioblock-advance-function ioblock)
+      (fd-stream-advance 'fd-stream-read-direct)
+      (input-file-ioblock-advance 'input-file-read-direct))))
+
+(defun %ioblock-write-direct-function (ioblock)
+  #+windows-target (declare (ignore ioblock))
+  #-windows-target
+  (when (= 0 (the fixnum (ioblock-element-shift ioblock)))
+    (let* ((f (case (ioblock-force-output-function ioblock)
+                (fd-stream-force-output 'fd-stream-write-direct)
+                (output-file-force-output 'output-file-write-direct))))
+      (when (and f (eq (%unix-fd-kind (ioblock-device ioblock)) :file))
+        f))))
+
+;;; Copy whatever's buffered, then read the rest directly.  Returns the
+;;; number of octets read, which is less than NUM-OCTETS only at EOF.
+(defun %ioblock-read-ivect-direct (ioblock ivector start-octet num-octets read-direct)
+  (declare (fixnum start-octet num-octets))
+  (let* ((in (ioblock-inbuf ioblock))
+         (stream (ioblock-stream ioblock))
+         (idx (io-buffer-idx in))
+         (avail (min num-octets (- (io-buffer-count in) idx)))
+         (pos (+ start-octet avail))
+         (end (+ start-octet num-octets)))
+    (declare (fixnum idx avail pos end))
+    (%copy-ivector-to-ivector (io-buffer-buffer in) idx ivector start-octet avail)
+    (setf (io-buffer-idx in) (+ idx avail))
+    (loop
+      (when (= pos end)
+        (return num-octets))
+      (let* ((n (funcall read-direct stream ioblock ivector pos (- end pos))))
+        (declare (fixnum n))
+        (when (= n 0)
+          (return (- pos start-octet)))
+        (incf pos n)))))
+
+;;; Write whatever's buffered, then write IVECTOR's octets directly.
+(defun %ioblock-write-ivect-direct (ioblock ivector start-octet num-octets write-direct)
+  (declare (fixnum start-octet num-octets))
+  (when (ioblock-dirty ioblock)
+    (%ioblock-force-output ioblock nil))
+  (do* ((stream (ioblock-stream ioblock))
+        (pos start-octet)
+        (end (+ start-octet num-octets)))
+       ((= pos end) num-octets)
+    (declare (fixnum pos end))
+    (incf pos (the fixnum (funcall write-direct stream ioblock ivector pos (- end pos))))))
+
 ;;; ivector should be an ivector.  The ioblock should have an
 ;;; element-shift of 0; start-octet and num-octets should of course
 ;;; be sane.  This is mostly to give the fasdumper a quick way to
@@ -1436,8 +1502,13 @@
   (unless (= 0 (the fixnum (ioblock-element-shift ioblock)))
     (error "Can't write vector to stream ~s" (ioblock-stream ioblock)))
   (let* ((written 0)
-	 (out (ioblock-outbuf ioblock)))
+	 (out (ioblock-outbuf ioblock))
+         (write-direct (and (>= num-octets (the fixnum (io-buffer-size out)))
+                            (%ioblock-write-direct-function ioblock))))
     (declare (fixnum written))
+    (when write-direct
+      (return-from %ioblock-out-ivect
+        (%ioblock-write-ivect-direct ioblock ivector start-octet num-octets write-direct)))
     (do* ((pos start-octet (+ pos written))
 	  (left num-octets (- left written)))
 	 ((= left 0) num-octets)
@@ -2445,12 +2516,96 @@
       (setf (schar vector i) ch))))
 
 
+;;; For UTF-8: let the kernel decode well-formed input straight out of
+;;; the buffer, and read a character at a time only when it stops at
+;;; something else (a newline, a malformed or incomplete sequence, or the
+;;; end of the buffer.)
+(defun %ioblock-utf-8-read-line (ioblock)
+  (declare (optimize (speed 3) (safety 0)))
+  (collect ((chunks))
+    (let* ((pos 0)
+           (len 0)
+           (chunksize 8192)
+           (str (make-string chunksize))
+           (inbuf (ioblock-inbuf ioblock))
+           (rcf (ioblock-read-char-when-locked-function ioblock))
+           (eof nil))
+      (declare (fixnum pos len chunksize)
+               (simple-string str)
+               (dynamic-extent str))
+      (do* ((ch nil))
+           ((or (eq ch #\newline) (setq eof (eq ch :eof)))
+            (if (zerop len)
+              (values (subseq str 0 pos) eof)
+              (let* ((outpos 0))
+                (declare (fixnum outpos))
+                (setq len (+ len pos))
+                (let* ((out (make-string len)))
+                  (dolist (s (chunks))
+                    (%copy-ivector-to-ivector s 0 out outpos (the fixnum (ash chunksize 2)))
+                    (incf outpos (ash chunksize 2)))
+                  (%copy-ivector-to-ivector str 0 out outpos (the fixnum (ash pos 2)))
+                  (values out eof)))))
+        (unless (ioblock-untyi-char ioblock)
+          (multiple-value-bind (idx newpos)
+              (%utf-8-decode-run (io-buffer-buffer inbuf)
+                                 (io-buffer-idx inbuf)
+                                 (io-buffer-count inbuf)
+                                 str
+                                 pos
+                                 chunksize
+                                 (char-code #\newline))
+            (setf (io-buffer-idx inbuf) idx
+                  pos newpos)))
+        (when (= pos chunksize)
+          (chunks str)
+          (setq str (make-string chunksize)
+                len (+ len pos)
+                pos 0))
+        (setq ch (funcall rcf ioblock))
+        (when (characterp ch)
+          (unless (eq ch #\newline)
+            (setf (schar str pos) ch
+                  pos (1+ pos))))))))
+
+(defun %ioblock-utf-8-character-read-vector (ioblock vector start end)
+  (declare (fixnum start end))
+  (do* ((i start)
+        (in (ioblock-inbuf ioblock))
+        (rcf (ioblock-read-char-when-locked-function ioblock)))
+       ((= i end) end)
+    (declare (fixnum i))
+    (unless (ioblock-untyi-char ioblock)
+      (multiple-value-bind (idx newi)
+          (%utf-8-decode-run (io-buffer-buffer in)
+                             (io-buffer-idx in)
+                             (io-buffer-count in)
+                             vector
+                             i
+                             end
+                             nil)
+        (setf (io-buffer-idx in) idx
+              i newi)))
+    (unless (= i end)
+      (let* ((ch (funcall rcf ioblock)))
+        (if (eq ch :eof)
+          (return i))
+        (setf (schar vector i) ch)
+        (incf i)))))
+
 (defun %ioblock-binary-read-vector (ioblock vector start end)
   (declare (fixnum start end))
   (let* ((in (ioblock-inbuf ioblock))
 	 (inbuf (io-buffer-buffer in))
-         (rbf (ioblock-read-byte-when-locked-function ioblock)))
+         (rbf (ioblock-read-byte-when-locked-function ioblock))
+         (read-direct (and (= (the fixnum (typecode inbuf))
+                              (the fixnum (typecode vector)))
+                           (>= (- end start) (the fixnum (io-buffer-size in)))
+                           (%ioblock-read-direct-function ioblock))))
     (setf (ioblock-untyi-char ioblock) nil)
+    (when read-direct
+      (return-from %ioblock-binary-read-vector
+        (+ start (the fixnum (%ioblock-read-ivect-direct ioblock vector start (- end start) read-direct)))))
     (if (not (= (the fixnum (typecode inbuf))
 		(the fixnum (typecode vector))))
       (do* ((i start (1+ i)))
@@ -2528,6 +2683,11 @@
   (unless (= 0 (the fixnum (ioblock-element-shift ioblock)))
     (error "Can't read vector from stream ~s" (ioblock-stream ioblock)))
   (setf (ioblock-untyi-char ioblock) nil)
+  (let* ((read-direct (and (>= nb (the fixnum (io-buffer-size (ioblock-inbuf ioblock))))
+                           (%ioblock-read-direct-function ioblock))))
+    (when read-direct
+      (return-from %ioblock-binary-in-ivect
+        (%ioblock-read-ivect-direct ioblock vector start nb read-direct))))
   (do* ((i start)
         (rbf (ioblock-read-byte-when-locked-function ioblock))
 	(in (ioblock-inbuf ioblock))
@@ -2753,10 +2913,15 @@
     (if (and encoding (not (eq encoding :inferred)))
       (let* ((unit-size (character-encoding-code-unit-size encoding)))
         (setf (ioblock-peek-char-function ioblock) '%encoded-ioblock-peek-char)
-        (setf (ioblock-read-line-function ioblock)
-              '%ioblock-encoded-read-line)
-        (setf (ioblock-character-read-vector-function ioblock)
-              '%ioblock-encoded-character-read-vector)        
+        (if (eq (character-encoding-name encoding) :utf-8)
+          (setf (ioblock-read-line-function ioblock)
+                '%ioblock-utf-8-read-line
+                (ioblock-character-read-vector-function ioblock)
+                '%ioblock-utf-8-character-read-vector)
+          (setf (ioblock-read-line-function ioblock)
+                '%ioblock-encoded-read-line
+                (ioblock-character-read-vector-function ioblock)
+                '%ioblock-encoded-character-read-vector))
         (setf (ioblock-decode-input-function ioblock)
               (character-encoding-stream-decode-function encoding))
         (setf (ioblock-read-char-function ioblock)
@@ -5290,8 +5455,14 @@
   (let* ((out (ioblock-outbuf ioblock))
          (written 0)
          (total (- end start))
-         (buftype (typecode (io-buffer-buffer out))))
+         (buftype (typecode (io-buffer-buffer out)))
+         (write-direct (and (= (the fixnum (typecode vector)) buftype)
+                            (>= total (the fixnum (io-buffer-size out)))
+                            (%ioblock-write-direct-function ioblock))))
     (declare (fixnum buftype written total))
+    (when write-direct
+      (%ioblock-write-ivect-direct ioblock vector start total write-direct)
+      (return-from %ioblock-binary-stream-write-vector nil))
     (if (not (= (the fixnum (typecode vector)) buftype))
       (if (typep vector 'string)
         (funcall (ioblock-write-simple-string-function ioblock)
@@ -5649,6 +5820,25 @@
 (defclass fd-binary-io-stream (fd-io-stream buffered-binary-io-stream-mixin)
     ())
 
+;;; Wait for input on the stream's fd, subject to the stream's deadline
+;;; or input timeout.  If there's neither and ALWAYS is false, don't wait.
+(defun fd-stream-input-wait (s ioblock fd always)
+  (let* ((deadline (ioblock-deadline ioblock))
+         (timeout
+          (if deadline
+            (milliseconds-until-deadline deadline ioblock)
+            (ioblock-input-timeout ioblock))))
+    (when (or timeout always)
+      (multiple-value-bind (win timedout error)
+          (process-input-wait fd timeout)
+        (unless win
+          (if timedout
+            (error (if deadline
+                     'communication-deadline-expired
+                     'input-timeout)
+                   :stream s)
+            (stream-io-error s (- error) "read")))))))
+
 (defun fd-stream-advance (s ioblock read-p)
   (let* ((fd (ioblock-device ioblock))
          (buf (ioblock-inbuf ioblock))
@@ -5660,21 +5850,7 @@
           (ioblock-eof ioblock) nil)
       (when (or read-p (setq avail (fd-input-available-p fd 0)))
         (unless avail
-          (let* ((deadline (ioblock-deadline ioblock))
-                 (timeout
-                  (if deadline
-                    (milliseconds-until-deadline deadline ioblock)
-                    (ioblock-input-timeout ioblock))))
-            (when timeout
-              (multiple-value-bind (win timedout error)
-                  (process-input-wait fd timeout)
-                (unless win
-                  (if timedout
-                    (error (if deadline
-                             'communication-deadline-expired
-                             'input-timeout)
-                           :stream s)
-                    (stream-io-error s (- error) "read")))))))
+          (fd-stream-input-wait s ioblock fd nil))
         (let* ((n (with-eagain fd :input
 		    (fd-read fd bufptr size))))
           (declare (fixnum n))
@@ -5686,6 +5862,38 @@
               (progn (setf (ioblock-eof ioblock) t)
                      nil)))))))
 
+;;; Read directly from the fd into IVECTOR; see %IOBLOCK-READ-DIRECT-FUNCTION.
+;;; Waiting for input first means that the read won't block while the
+;;; GC is disabled.
+(defun fd-stream-read-direct (s ioblock ivector start-octet num-octets)
+  (let* ((fd (ioblock-device ioblock))
+         (buf (ioblock-inbuf ioblock)))
+    (setf (io-buffer-idx buf) 0
+          (io-buffer-count buf) 0
+          (ioblock-eof ioblock) nil)
+    (fd-stream-input-wait s ioblock fd t)
+    (let* ((n (with-eagain fd :input
+                (with-pointer-to-ivector (p ivector)
+                  (%incf-ptr p start-octet)
+                  (fd-read fd p (min num-octets *ioblock-direct-io-octets*))))))
+      (declare (fixnum n))
+      (if (< n 0)
+        (stream-io-error s (- n) "read"))
+      (if (= n 0)
+        (setf (ioblock-eof ioblock) t))
+      n)))
+
+;;; Write directly from IVECTOR to the fd, which is a regular file.
+(defun fd-stream-write-direct (s ioblock ivector start-octet num-octets)
+  (let* ((fd (ioblock-device ioblock))
+         (n (with-pointer-to-ivector (p ivector)
+              (%incf-ptr p start-octet)
+              (fd-write fd p (min num-octets *ioblock-direct-io-octets*)))))
+    (declare (fixnum n))
+    (if (< n 0)
+      (stream-io-error s (- n) "write"))
+    n))
+
 (defun fd-stream-eofp (s ioblock)
   (declare (ignore s))
   (ioblock-eof ioblock))
@@ -521,6 +521,15 @@ is :UNIX.")
     (setf (file-ioblock-octet-pos file-ioblock) newpos)
     (fd-stream-advance stream file-ioblock read-p)))
 
+;;; The input buffer's been consumed; the next octet comes from the
+;;; fd's current position.
+(defun input-file-read-direct (stream file-ioblock ivector start-octet num-octets)
+  (let* ((inbuf (file-ioblock-inbuf file-ioblock)))
+    (incf (file-ioblock-octet-pos file-ioblock) (io-buffer-count inbuf))
+    (let* ((n (fd-stream-read-direct stream file-ioblock ivector start-octet num-octets)))
+      (incf (file-ioblock-octet-pos file-ioblock) n)
+      n)))
+
 ;;; If the buffer's dirty, we have to back up and rewrite it before
 ;;; reading in a new buffer.
 (defun io-file-ioblock-advance (stream file-ioblock read-p)
@@ -545,6 +554,11 @@ is :UNIX.")
     (%ioblock-output-file-position file-ioblock pos)
     n))
 
+(defun output-file-write-direct (stream file-ioblock ivector start-octet num-octets)
+  (let* ((n (fd-stream-write-direct stream file-ioblock ivector start-octet num-octets)))
+    (incf (file-ioblock-octet-pos file-ioblock) n)
+    n))
+
 ;;; Can't be sure where the underlying fd is positioned, so seek first.
 (defun io-file-force-output (stream file-ioblock count finish-p)
   (let* ((pos (%ioblock-io-file-position file-ioblock nil)))
@@ -1120,6 +1120,104 @@ used in western languages."
 
 
 
+;;; The bulk of UTF-8 conversion between octet vectors and strings is
+;;; done by the lisp kernel's utf8_*() functions, which handle runs of
+;;; ASCII characters 16 at a time (using SSE2 where it's available) and
+;;; convert other well-formed sequences without leaving C.  They stop at
+;;; anything that the lisp code has to deal with (malformed or truncated
+;;; input, or a full destination), and return the indices at which they
+;;; stopped.  The GC's disabled while they run, since they're passed
+;;; pointers into lisp vectors.
+
+;;; Decode octets between START and END into STRING, starting at index I
+;;; and stopping at index LIMIT or before an octet equal to STOP (which
+;;; should be NIL or an ASCII code.)  Returns the octet index and string
+;;; index at which decoding stopped.
+(defun %utf-8-decode-run (octets start end string i limit stop)
+  (declare (fixnum start end i limit)
+           (type (simple-array (unsigned-byte 8) (*)) octets)
+           (simple-base-string string))
+  (if (or (>= start end) (>= i limit))
+    (values start i)
+    (%stack-block ((nused target::node-size))
+      (let* ((nchars
+              (without-gcing
+                (with-macptrs ((src) (dest))
+                  (%vect-data-to-macptr octets src)
+                  (%vect-data-to-macptr string dest)
+                  (%incf-ptr src start)
+                  (%incf-ptr dest (ash i 2))
+                  (ff-call (%kernel-import target::kernel-import-utf8-decode-run)
+                           :address src
+                           #+64-bit-target :unsigned-doubleword
+                           #+32-bit-target :unsigned-fullword (- end start)
+                           :address dest
+                           #+64-bit-target :unsigned-doubleword
+                           #+32-bit-target :unsigned-fullword (- limit i)
+                           :int (or stop -1)
+                           :address nused
+                           #+64-bit-target :unsigned-doubleword
+                           #+32-bit-target :unsigned-fullword)))))
+        (declare (fixnum nchars))
+        (values (+ start (the fixnum (%get-natural nused 0)))
+                (+ i nchars))))))
+
+;;; Encode the characters in STRING between START and END into OCTETS,
+;;; starting at IDX and stopping before a character that wouldn't fit.
+;;; Returns the string index and octet index at which encoding stopped.
+(defun %utf-8-encode-run (string start end octets idx)
+  (declare (fixnum start end idx)
+           (type (simple-array (unsigned-byte 8) (*)) octets)
+           (simple-base-string string))
+  (let* ((room (- (length octets) idx)))
+    (declare (fixnum room))
+    (if (or (>= start end) (<= room 0))
+      (values start idx)
+      (%stack-block ((nused target::node-size))
+        (let* ((noctets
+                (without-gcing
+                  (with-macptrs ((src) (dest))
+                    (%vect-data-to-macptr string src)
+                    (%vect-data-to-macptr octets dest)
+                    (%incf-ptr src (ash start 2))
+                    (%incf-ptr dest idx)
+                    (ff-call (%kernel-import target::kernel-import-utf8-encode-run)
+                             :address src
+                             #+64-bit-target :unsigned-doubleword
+                             #+32-bit-target :unsigned-fullword (- end start)
+                             :address dest
+                             #+64-bit-target :unsigned-doubleword
+                             #+32-bit-target :unsigned-fullword room
+                             :address nused
+                             #+64-bit-target :unsigned-doubleword
+                             #+32-bit-target :unsigned-fullword)))))
+          (declare (fixnum noctets))
+          (values (+ start (the fixnum (%get-natural nused 0)))
+                  (+ idx noctets)))))))
+
+;;; Returns the number of characters encoded between START and END and
+;;; the index of the first octet of any incomplete sequence at the end,
+;;; judging the length of each sequence by its first octet.
+(defun %utf-8-length-of-encoding (octets start end)
+  (declare (fixnum start end)
+           (type (simple-array (unsigned-byte 8) (*)) octets))
+  (if (>= start end)
+    (values 0 start)
+    (%stack-block ((nused target::node-size))
+      (let* ((nchars
+              (without-gcing
+                (with-macptrs ((src))
+                  (%vect-data-to-macptr octets src)
+                  (%incf-ptr src start)
+                  (ff-call (%kernel-import target::kernel-import-utf8-length-of-encoding)
+                           :address src
+                           #+64-bit-target :unsigned-doubleword
+                           #+32-bit-target :unsigned-fullword (- end start)
+                           :address nused
+                           #+64-bit-target :unsigned-doubleword
+                           #+32-bit-target :unsigned-fullword)))))
+        (values nchars (+ start (the fixnum (%get-natural nused 0))))))))
+
 ;;; UTF-8.  Decoding checks for malformed sequences; it might be faster (and
 ;;; would certainly be simpler) if it didn't.
 (define-character-encoding :utf-8
@@ -1241,6 +1339,9 @@ bytes."
      (lambda (string vector idx start end)
        (declare (type (simple-array (unsigned-byte 8) (*)) vector)
                 (fixnum idx))
+       (multiple-value-setq (start idx)
+         (%utf-8-encode-run string start end vector idx))
+       ;; Anything left over didn't fit in VECTOR.
        (do* ((i start (1+ i)))
             ((>= i end) idx)
          (let* ((char (schar string i))
@@ -1282,8 +1383,16 @@ bytes."
                 (type index idx))
        (do* ((i 0 (1+ i))
              (end (+ idx noctets))
+             (limit (length string))
              (index idx (1+ index)))
-            ((= index end) index)
+            ((progn
+               (multiple-value-setq (index i)
+                 (%utf-8-decode-run vector index end string i limit nil))
+               (>= index end))
+             index)
+           (declare (fixnum i end limit index))
+           ;; The kernel stopped at something malformed; decode it (or
+           ;; note the problem) here.
            (let* ((1st-unit (aref vector index)))
              (declare (type (unsigned-byte 8) 1st-unit))
              (let* ((char 
@@ -1346,22 +1455,7 @@ bytes."
     (nfunction
      utf-8-length-of-vector-encoding
      (lambda (vector start end)
-       (declare (type (simple-array (unsigned-byte 8) (*)) vector))
-       (do* ((i start)
-             (nchars 0))
-            ((>= i end)
-             (values nchars i))
-         (declare (fixnum i))
-         (let* ((code (aref vector i))
-                (nexti (+ i (cond ((< code #xc2) 1)
-                                  ((< code #xe0) 2)
-                                  ((< code #xf0) 3)
-                                  ((< code #xf8) 4)
-                                  (t 1)))))
-           (declare (type (unsigned-byte 8) code))
-           (if (> nexti end)
-             (return (values nchars i))
-             (setq nchars (1+ nchars) i nexti))))))
+       (%utf-8-length-of-encoding vector start end)))
     :length-of-memory-encoding-function
     #'utf-8-length-of-memory-encoding
     :decode-literal-code-unit-limit #x80
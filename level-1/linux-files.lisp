@@ -2223,8 +2223,12 @@ not, why not; and what its result code was if it completed."
 
 (def-load-pointers spin-count ()
   (if (eql 1 (cpu-count))
-    (%defglobal '*spin-lock-tries* 1)
-    (%defglobal '*spin-lock-tries* 1024))
+    (progn
+      (%defglobal '*spin-lock-tries* 1)
+      (%defglobal '*recursive-lock-spin-tries* 0))
+    (progn
+      (%defglobal '*spin-lock-tries* 1024)
+      (%defglobal '*recursive-lock-spin-tries* 1024)))
   (%defglobal '*spin-lock-timeouts* 0))
 
 (defun yield ()
@@ -26,6 +26,7 @@
      @
      *elements-per-buffer*
      save-application
+     save-heap-snapshot
      def-load-pointers
      *save-exit-functions*
      *restore-lisp-functions*
@@ -454,11 +455,24 @@
      egc-active-p
      configure-egc
      egc-configuration
+     egc-pause-target
+     set-egc-pause-target
+     egc-time-goal
+     set-egc-time-goal
      gccounts
      gctime
      lisp-heap-gc-threshold
      use-lisp-heap-gc-threshold
      set-lisp-heap-gc-threshold
+     gc-threads
+     set-gc-threads
+     gc-events
+     gc-phase-histograms
+     gc-safepoint-timeout
+     concurrent-gc
+     concurrent-gc-enabled-p
+     background-zeroing
+     background-zeroing-enabled-p
      gc-retain-pages
      gc-retaining-pages
      gc-verbose
@@ -538,6 +552,8 @@
      grab-lock
      release-lock
      try-lock
+     lock-contention-statistics
+     reset-lock-contention-statistics
      lock
      read-write-lock
      lock-not-owner
@@ -562,6 +578,11 @@
      timed-wait-on-semaphore
      signal-semaphore
      semaphore
+     make-wait-queue
+     wait-queue
+     notify-wait-queue
+     process-wait-on-queue
+     process-wait-on-queue-with-timeout
 
      process-input-wait
      process-output-wait
@@ -75,9 +75,10 @@
 			 (mode #o644)
 			 prepend-kernel
 			 #+windows-target (application-type :console)
-                         native)
+                         native
+                         compress)
   (declare (ignore toplevel-function error-handler application-class
-                   clear-clos-caches init-file impurify))
+                   clear-clos-caches init-file impurify compress))
   #+windows-target (check-type application-type (member :console :gui))
   (unless (probe-file (make-pathname :defaults nil
                                      :directory (pathname-directory (translate-logical-pathname filename))))
@@ -128,45 +129,51 @@
                                       (clear-clos-caches t)
                                       prepend-kernel
                                       #+windows-target application-type
-                                      native)
+                                      native
+                                      compress)
   (declare (ignore mode prepend-kernel #+windows-target application-type native))
   (when (and application-class (neq  (class-of *application*)
                                      (if (symbolp application-class)
                                        (find-class application-class)
                                        application-class)))
     (setq *application* (make-instance application-class)))
-  (if (not toplevel-function)
-    (setq toplevel-function 
-          #'(lambda ()
-              (toplevel-function *application*
-				 (if init-file-p
-				   init-file
-				   (application-init-file *application*)))))
-    (let* ((user-toplevel-function (coerce-to-function toplevel-function)))
-      (setq toplevel-function
-            (lambda ()
-              (make-mcl-listener-process
-               "toplevel"
-                *stdin*
-                *stdout*
-                 #'false
-               :initial-function (lambda ()
-                                   (catch :toplevel
-                                     (funcall user-toplevel-function)
-                                     (quit)))
-               :close-streams nil
-               )
-              (%set-toplevel #'housekeeping-loop)
-              (toplevel)))))
+  (setq toplevel-function
+        (%image-toplevel-function toplevel-function init-file init-file-p))
   (when error-handler
     (make-application-error-handler *application* error-handler))
   
   (if clear-clos-caches (clear-clos-caches))
   (save-image #'(lambda () (%save-application fd
-                                              (logior (if impurify 2 0)
+                                              (logior (if compress 4 0)
+                                                      (if impurify 2 0)
                                                       (if purify 1 0))))
               toplevel-function))
 
+;;; Return the function that a saved image's initial process calls
+;;; once the image has been restored.
+(defun %image-toplevel-function (toplevel-function init-file init-file-p)
+  (if (not toplevel-function)
+    #'(lambda ()
+        (toplevel-function *application*
+                           (if init-file-p
+                             init-file
+                             (application-init-file *application*))))
+    (let* ((user-toplevel-function (coerce-to-function toplevel-function)))
+      (lambda ()
+        (make-mcl-listener-process
+         "toplevel"
+         *stdin*
+         *stdout*
+         #'false
+         :initial-function (lambda ()
+                             (catch :toplevel
+                               (funcall user-toplevel-function)
+                               (quit)))
+         :close-streams nil
+         )
+        (%set-toplevel #'housekeeping-loop)
+        (toplevel)))))
+
 (defun save-image (save-function toplevel-function)
   (let ((toplevel #'(lambda () (#_exit -1))))
       (%set-toplevel #'(lambda ()
@@ -190,6 +197,68 @@
                          (funcall save-function)))
       (toplevel)))
 
+;;; A heap snapshot is written by a child process that the kernel forks
+;;; while all other threads are suspended, so (unlike SAVE-IMAGE) there's
+;;; no chance to clean things up before the heap is saved: the image
+;;; contains the other threads' processes, open streams, and so on.
+;;; Forget about those when the image starts up, once locks work again
+;;; but before new streams are created.
+(defun %forget-snapshot-state ()
+  (let* ((ip *initial-process*))
+    (dolist (p (all-processes))
+      (unless (eq p ip)
+        (remove-from-all-processes p))))
+  (kill-lisp-pointers)
+  (clear-ioblock-streams)
+  (let* ((pop *termination-population*))
+    (with-lock-grabbed (*termination-population-lock*)
+      (setf (population.data pop) nil
+            (population.termination-list pop) nil))))
+
+(defun save-heap-snapshot (filename &key toplevel-function
+                                    (init-file nil init-file-p)
+                                    (purify t)
+                                    compress
+                                    (mode #o644)
+                                    prepend-kernel
+                                    (wait t))
+  "Write an image of the current heap to FILENAME, the way
+SAVE-APPLICATION would, without stopping this lisp.  Other threads are
+only suspended while the process forks; a child process GCs its copy
+of the heap and writes the image.  If WAIT is true, wait for the child
+to finish and return T; otherwise, return the child's process ID."
+  (declare (ignorable toplevel-function init-file init-file-p purify compress
+                      mode prepend-kernel wait))
+  #-(and x8664-target linux-target)
+  (error "Can't save a heap snapshot of ~s on this platform." filename)
+  #+(and x8664-target linux-target)
+  (let* ((toplevel (%image-toplevel-function toplevel-function init-file init-file-p))
+         (restart #'(lambda ()
+                      (%set-toplevel #'(lambda ()
+                                         (setf (interrupt-level) 0)
+                                         (funcall toplevel)))
+                      (restore-lisp-pointers #'%forget-snapshot-state)))
+         (fd (open-dumplisp-file filename
+                                 :mode mode
+                                 :prepend-kernel prepend-kernel))
+         (pid (unwind-protect
+                   (%%save-heap-snapshot fd
+                                         (logior (if compress 4 0)
+                                                 (if purify 1 0))
+                                         restart)
+                (fd-close fd))))
+    (declare (fixnum pid))
+    (cond ((< pid 0) (%errno-disp pid))
+          ((= pid 0) (error "Can't save a heap snapshot while the GC is inhibited."))
+          ((not wait) pid)
+          (t
+           (let* ((status (check-pid pid 0)))
+             (unless (and (integerp status)
+                          (zerop (logand status #x7f))
+                          (zerop (ldb (byte 8 8) status)))
+               (error "Writing a heap snapshot to ~s failed." filename))
+             t)))))
+
 ;;; If file in-fd contains an embedded lisp image, return the file position
 ;;; of the start of that image; otherwise, return the file's length.
 (defun skip-embedded-image (in-fd)
@@ -319,11 +388,13 @@
       (%err-disp err))))
   
 
-(defun restore-lisp-pointers ()
+(defun restore-lisp-pointers (&optional after-locks-revived)
   (setq *interactive-streams-initialized* nil)
   (setq *heap-ivectors* nil)
   (setq *batch-flag* (not (eql (%get-kernel-global 'batch-flag) 0)))
   (%revive-system-locks)
+  (when after-locks-revived
+    (funcall after-locks-revived))
   (refresh-external-entrypoints)
   (restore-pascal-functions)
   (initialize-interactive-streams)
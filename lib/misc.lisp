@@ -1446,6 +1446,98 @@ are running on, or NIL if we can't find any useful information."
             0))
   name)
 
+;;; The kernel keeps timings and sizes for the last few hundred GCs in
+;;; a ring buffer (gc_events, described in lisp-kernel/gc.h.)  The GC
+;;; is the only thing that writes it; an event whose sequence number
+;;; changes while we're copying it is being overwritten, so skip it.
+
+(defparameter *gc-phase-names*
+  #(:setup :mark-roots :mark-stacks :mark-memoized :mark-parallel
+    :weak :relocate :forward :compact :tenure))
+
+(defun %gc-event-log ()
+  (or (foreign-symbol-address "gc_events")
+      (error "This lisp kernel doesn't log GC events.")))
+
+(defun gc-events (&optional (since 0))
+  "Return a list of property lists describing the logged GCs whose GC
+number is at least SINCE, oldest first.  Only the most recent few
+hundred GCs are logged.  Times are in nanoseconds; sizes are in bytes."
+  (let* ((log (%gc-event-log))
+         (nevents (%%get-unsigned-longlong log 0))
+         (nphases (%%get-unsigned-longlong log 8))
+         (event-size (%%get-unsigned-longlong log 16))
+         (next (%%get-unsigned-longlong log 24))
+         (events-offset (+ 32 (* nphases 64 8)))
+         (result ()))
+    (do* ((i (max 0 (- next nevents)) (1+ i)))
+         ((>= i next) (nreverse result))
+      (let* ((offset (+ events-offset (* event-size (mod i nevents)))))
+        (flet ((field (n)
+                 (%%get-unsigned-longlong log (+ offset (* n 8)))))
+          (let* ((seq (field 0)))
+            (when (= seq (* 2 (1+ i)))
+              (let* ((generation (field 2))
+                     (event
+                      (list :gc-number (field 1)
+                            :kind (if (= generation 3) :full :ephemeral)
+                            :generation (if (= generation 3) nil generation)
+                            :start-ns (field 3)
+                            :suspend-ns (field 4)
+                            :resume-ns (field 5)
+                            :bytes-allocated (field 6)
+                            :bytes-freed (field 7)
+                            :generation-bytes (list (field 8) (field 9)
+                                                    (field 10) (field 11))
+                            :phases (loop for j from 0 below nphases
+                                          nconc (list (if (< j (length *gc-phase-names*))
+                                                        (svref *gc-phase-names* j)
+                                                        j)
+                                                      (field (+ 12 j))))
+                            :safepoint-threads (field (+ 12 nphases))
+                            :signalled-threads (field (+ 13 nphases))
+                            :safepoint-timeouts (field (+ 14 nphases)))))
+                (when (and (= seq (field 0))
+                           (>= (getf event :gc-number) since))
+                  (push event result))))))))))
+
+;;; If the kernel was started with --safepoints (or this is set to a
+;;; non-zero number of microseconds), the GC asks threads running lisp
+;;; code to stop at their next safepoint poll, and waits that long for
+;;; them to do so before signalling them.  Only code compiled while
+;;; *COMPILE-SAFEPOINT-POLLS* is true polls.
+
+(defun gc-safepoint-timeout ()
+  "Return the number of microseconds that the GC waits for a thread to
+reach a safepoint, or NIL if the GC doesn't use safepoints."
+  (let* ((p (foreign-symbol-address "safepoint_timeout_usecs")))
+    (when p
+      (let* ((usecs (%get-natural p 0)))
+        (unless (eql usecs 0) usecs)))))
+
+(defun (setf gc-safepoint-timeout) (usecs)
+  (let* ((p (or (foreign-symbol-address "safepoint_timeout_usecs")
+                (error "This lisp kernel doesn't support GC safepoints."))))
+    (setf (%get-natural p 0) (if usecs (require-type usecs '(unsigned-byte 32)) 0))
+    usecs))
+
+(defun gc-phase-histograms ()
+  "Return an alist that maps the names of GC phases to vectors of
+counts: element I of a vector is the number of GCs in which the phase
+took at least 2^I but less than 2^(I+1) nanoseconds."
+  (let* ((log (%gc-event-log))
+         (nphases (%%get-unsigned-longlong log 8)))
+    (loop for i from 0 below nphases
+          collect (cons (if (< i (length *gc-phase-names*))
+                          (svref *gc-phase-names* i)
+                          i)
+                        (let* ((v (make-array 64)))
+                          (dotimes (j 64 v)
+                            (setf (svref v j)
+                                  (%%get-unsigned-longlong
+                                   log
+                                   (+ 32 (* 8 (+ j (* i 64))))))))))))
+
 (defun %lock-whostate-string (string lock)
   (with-standard-io-syntax
       (format nil "~a for ~a ~@[~a ~]@ #x~x"
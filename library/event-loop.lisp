@@ -0,0 +1,479 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;;   This file is part of Clozure CL.
+;;;
+;;;   Clozure CL is licensed under the terms of the Lisp Lesser GNU Public
+;;;   License , known as the LLGPL and distributed with Clozure CL as the
+;;;   file "LICENSE".  The LLGPL consists of a preamble and the LGPL,
+;;;   which is distributed with Clozure CL as the file "LGPL".  Where these
+;;;   conflict, the preamble takes precedence.
+;;;
+;;;   Clozure CL is referenced in the preamble as the "LIBRARY."
+;;;
+;;;   The LLGPL is also available online at
+;;;   http://opensource.franz.com/preamble.html
+
+;;; event-loop.lisp
+;;; An epoll-based event loop, so that a few threads can wait for I/O
+;;; on many file descriptors (instead of each connection needing a
+;;; thread of its own that sits in PROCESS-INPUT-WAIT.)
+;;;
+;;;  ? (require :event-loop)
+;;;  ? (defvar *loop* (make-event-loop :threads 2))
+;;;  ? (event-loop-wait-for-input *loop* socket-stream
+;;;                               (lambda (why) (handle-request socket-stream why))
+;;;                               :timeout 30)
+;;;
+;;; The thing waited on can be a file descriptor, an fd-based stream
+;;; (including socket streams) or a socket.  A registration is for a
+;;; single event: its callback is called exactly once, in one of the
+;;; event loop's threads, with :INPUT or :OUTPUT when the fd's ready
+;;; (which includes EOF and error conditions), :TIMEOUT if TIMEOUT
+;;; seconds pass first, or :CLOSED if the event loop's closed first.
+;;; Callbacks that want to hear about the next event re-register;
+;;; they shouldn't block for long, since other callbacks can't run in
+;;; that thread in the meantime.  An fd can have one input and one
+;;; output registration at a time.
+;;;
+;;; EVENT-LOOP-FUTURE registers a callback that records the result,
+;;; and EVENT-FUTURE-VALUE waits for it.
+;;;
+;;; Input that a stream has already buffered counts as ready, as does
+;;; anything on a regular file (which epoll doesn't support.)
+;;;
+;;; Only Linux is supported.
+
+(in-package :ccl)
+
+(export '(make-event-loop
+          close-event-loop
+          event-loop-wait-for-input
+          event-loop-wait-for-output
+          cancel-event-registration
+          event-loop-future
+          event-future-value))
+
+#-linux-target
+(error "The event loop needs epoll, which only Linux has.")
+
+(defconstant $epollin 1)
+(defconstant $epollout 4)
+(defconstant $epollrdhup #x2000)
+(defconstant $epolloneshot (ash 1 30))
+(defconstant $epoll-ctl-add 1)
+(defconstant $epoll-ctl-del 2)
+(defconstant $epoll-ctl-mod 3)
+(defconstant $epoll-cloexec #o2000000)
+(defconstant $efd-nonblock #o4000)
+(defconstant $efd-cloexec #o2000000)
+
+;;; struct epoll_event is packed on x86.
+(defconstant $epoll-event-size #+x86-target 12 #-x86-target 16)
+(defconstant $epoll-event-data-offset #+x86-target 4 #-x86-target 8)
+
+(defconstant $event-loop-max-events 64)
+
+(defstruct (event-loop (:constructor %make-event-loop))
+  (name "event loop")
+  (epfd -1)
+  (wakefd -1)                           ; an eventfd, to wake waiting threads
+  (lock (make-lock))
+  (fds (make-hash-table :test #'eql))   ; fd -> event-fd-entry
+  (timeouts (make-array 16 :adjustable t :fill-pointer 0)) ; heap of registrations
+  (ready ())                            ; (registration . result) to deliver
+  (processes ())
+  (closed nil))
+
+(defmethod print-object ((loop event-loop) stream)
+  (print-unreadable-object (loop stream :type t :identity t)
+    (format stream "~s" (event-loop-name loop))))
+
+(defstruct (event-fd-entry (:conc-name efd.))
+  fd
+  (input nil)                           ; pending registrations
+  (output nil)
+  (added nil))                          ; epoll knows about fd
+
+(defstruct (event-registration (:conc-name ereg.))
+  loop
+  fd
+  direction
+  callback
+  deadline                              ; in internal-time units, or NIL
+  (state :pending))
+
+(defstruct (event-future (:constructor %make-event-future))
+  (semaphore (make-semaphore))
+  (result nil)
+  (done nil))
+
+
+(defun %epoll-ctl (epfd op fd events)
+  (%stack-block ((ev $epoll-event-size))
+    (setf (%get-unsigned-long ev 0) events
+          (%get-unsigned-long ev $epoll-event-data-offset) fd
+          (%get-unsigned-long ev (+ $epoll-event-data-offset 4)) 0)
+    (int-errno-call (external-call "epoll_ctl"
+                                   :signed-fullword epfd
+                                   :signed-fullword op
+                                   :signed-fullword fd
+                                   :address ev
+                                   :signed-fullword))))
+
+(defun %event-loop-wake (loop)
+  (%stack-block ((buf 8))
+    (setf (%get-unsigned-long buf 0) 1
+          (%get-unsigned-long buf 4) 0)
+    (fd-write (event-loop-wakefd loop) buf 8)))
+
+(defun %event-loop-drain-wakefd (loop)
+  (%stack-block ((buf 8))
+    (fd-read (event-loop-wakefd loop) buf 8)))
+
+(defun %event-loop-fd (thing direction)
+  (cond ((typep thing 'fixnum) thing)
+        ((streamp thing)
+         (or (stream-device thing direction)
+             (error "~s doesn't have a file descriptor for ~(~a~)." thing direction)))
+        (t (socket-os-fd thing))))
+
+(defun %stream-has-buffered-input-p (thing)
+  (when (streamp thing)
+    (let* ((ioblock (stream-ioblock thing nil))
+           (inbuf (and ioblock (ioblock-inbuf ioblock))))
+      (and inbuf
+           (or (ioblock-untyi-char ioblock)
+               (< (io-buffer-idx inbuf) (io-buffer-count inbuf)))))))
+
+
+;;; The timeout heap.  Registrations that've been delivered or cancelled
+;;; stay in it until they reach the top.
+
+(defun %timeout-heap-push (heap reg)
+  (let* ((i (vector-push-extend reg heap)))
+    (loop
+      (when (zerop i) (return))
+      (let* ((parent (ash (1- i) -1))
+             (p (aref heap parent)))
+        (when (<= (ereg.deadline p) (ereg.deadline reg))
+          (return))
+        (setf (aref heap i) p
+              i parent)))
+    (setf (aref heap i) reg)))
+
+(defun %timeout-heap-pop (heap)
+  (let* ((top (aref heap 0))
+         (last (vector-pop heap))
+         (n (fill-pointer heap)))
+    (when (> n 0)
+      (let* ((i 0)
+             (deadline (ereg.deadline last)))
+        (loop
+          (let* ((child (1+ (* 2 i))))
+            (when (>= child n) (return))
+            (when (and (< (1+ child) n)
+                       (< (ereg.deadline (aref heap (1+ child)))
+                          (ereg.deadline (aref heap child))))
+              (incf child))
+            (when (<= deadline (ereg.deadline (aref heap child)))
+              (return))
+            (setf (aref heap i) (aref heap child)
+                  i child)))
+        (setf (aref heap i) last)))
+    top))
+
+;;; Discard dead registrations from the top of the heap, and return the
+;;; earliest pending deadline (or NIL).
+(defun %event-loop-next-deadline (loop)
+  (let* ((heap (event-loop-timeouts loop)))
+    (loop
+      (when (zerop (fill-pointer heap))
+        (return nil))
+      (let* ((reg (aref heap 0)))
+        (if (eq (ereg.state reg) :pending)
+          (return (ereg.deadline reg))
+          (%timeout-heap-pop heap))))))
+
+
+;;; Everything below that changes the loop's state is called with its
+;;; lock held.
+
+;;; Tell epoll about the events that ENTRY's pending registrations are
+;;; waiting for, or forget about the fd if there aren't any.  Return 0
+;;; or a negated errno value.
+(defun %event-loop-update-fd (loop entry)
+  (let* ((fd (efd.fd entry))
+         (epfd (event-loop-epfd loop))
+         (events (logior (if (efd.input entry) (logior $epollin $epollrdhup) 0)
+                         (if (efd.output entry) $epollout 0))))
+    (if (zerop events)
+      (progn
+        (remhash fd (event-loop-fds loop))
+        (when (efd.added entry)
+          (setf (efd.added entry) nil)
+          (%epoll-ctl epfd $epoll-ctl-del fd 0))
+        0)
+      (let* ((events (logior events $epolloneshot))
+             (result (%epoll-ctl epfd
+                                 (if (efd.added entry) $epoll-ctl-mod $epoll-ctl-add)
+                                 fd
+                                 events)))
+        ;; If the fd was closed (and maybe reused) since it was added,
+        ;; epoll's forgotten about it.
+        (when (eql result (- #$ENOENT))
+          (setq result (%epoll-ctl epfd $epoll-ctl-add fd events)))
+        (when (eql result 0)
+          (setf (efd.added entry) t))
+        result))))
+
+(defun %event-loop-finish (loop reg result)
+  (setf (ereg.state reg) result)
+  (push (cons reg result) (event-loop-ready loop)))
+
+(defun %event-loop-register (loop thing direction callback timeout)
+  (let* ((fd (%event-loop-fd thing direction))
+         (deadline (when timeout
+                     (+ (get-internal-real-time)
+                        (round (* timeout internal-time-units-per-second)))))
+         (reg (make-event-registration :loop loop
+                                       :fd fd
+                                       :direction direction
+                                       :callback callback
+                                       :deadline deadline))
+         (buffered (and (eq direction :input)
+                        (%stream-has-buffered-input-p thing))))
+    (with-lock-grabbed ((event-loop-lock loop))
+      (when (event-loop-closed loop)
+        (error "~s is closed." loop))
+      (let* ((wake buffered))
+        (if buffered
+          (%event-loop-finish loop reg :input)
+          (let* ((entry (or (gethash fd (event-loop-fds loop))
+                            (setf (gethash fd (event-loop-fds loop))
+                                  (make-event-fd-entry :fd fd)))))
+            (if (eq direction :input)
+              (when (efd.input entry)
+                (error "~s already has an input registration for fd ~d." loop fd))
+              (when (efd.output entry)
+                (error "~s already has an output registration for fd ~d." loop fd)))
+            (if (eq direction :input)
+              (setf (efd.input entry) reg)
+              (setf (efd.output entry) reg))
+            (let* ((result (%event-loop-update-fd loop entry)))
+              (unless (eql result 0)
+                (if (eq direction :input)
+                  (setf (efd.input entry) nil)
+                  (setf (efd.output entry) nil))
+                (%event-loop-update-fd loop entry)
+                ;; EPERM means that it's a regular file, which is
+                ;; always ready.
+                (unless (eql result (- #$EPERM))
+                  (%errno-disp result))
+                (%event-loop-finish loop reg direction)
+                (setq wake t)))
+            (when (and deadline (eq (ereg.state reg) :pending))
+              (let* ((next (%event-loop-next-deadline loop)))
+                (%timeout-heap-push (event-loop-timeouts loop) reg)
+                (when (or (null next) (< deadline next))
+                  (setq wake t))))))
+        (when wake
+          (%event-loop-wake loop))))
+    reg))
+
+(defun %event-loop-detach (loop reg)
+  (let* ((entry (gethash (ereg.fd reg) (event-loop-fds loop))))
+    (when entry
+      (if (eq (ereg.direction reg) :input)
+        (when (eq (efd.input entry) reg)
+          (setf (efd.input entry) nil))
+        (when (eq (efd.output entry) reg)
+          (setf (efd.output entry) nil)))
+      (%event-loop-update-fd loop entry))))
+
+;;; Handle N events from epoll_wait, and any timeouts that've expired.
+;;; Return a list of (registration . result) to deliver.
+(defun %event-loop-collect (loop events n)
+  (declare (fixnum n))
+  (let* ((wakefd (event-loop-wakefd loop)))
+    (dotimes (i n)
+      (let* ((ev (%inc-ptr events (* i $epoll-event-size)))
+             (flags (%get-unsigned-long ev 0))
+             (fd (%get-unsigned-long ev $epoll-event-data-offset)))
+        (if (eql fd wakefd)
+          ;; Once the loop's closed, the eventfd has to stay readable
+          ;; so that every thread sees that.
+          (unless (event-loop-closed loop)
+            (%event-loop-drain-wakefd loop))
+          (let* ((entry (gethash fd (event-loop-fds loop))))
+            (when entry
+              ;; Errors and hangups make both directions ready.
+              (let* ((in (efd.input entry))
+                     (out (efd.output entry))
+                     (other (not (logtest flags (logior $epollin $epollout $epollrdhup)))))
+                (when (and in (or other (logtest flags (logior $epollin $epollrdhup))))
+                  (setf (efd.input entry) nil)
+                  (%event-loop-finish loop in :input))
+                (when (and out (or other (logtest flags $epollout)))
+                  (setf (efd.output entry) nil)
+                  (%event-loop-finish loop out :output)))
+              ;; The fd was disabled when the event was reported; re-arm
+              ;; it for whatever's still pending.
+              (%event-loop-update-fd loop entry)))))))
+    (let* ((now (get-internal-real-time))
+           (heap (event-loop-timeouts loop)))
+      (loop
+        (let* ((next (%event-loop-next-deadline loop)))
+          (when (or (null next) (> next now))
+            (return))
+          (let* ((reg (%timeout-heap-pop heap)))
+            (%event-loop-detach loop reg)
+            (%event-loop-finish loop reg :timeout)))))
+    (let* ((ready (nreverse (event-loop-ready loop))))
+      (setf (event-loop-ready loop) nil)
+      ready))
+
+(defun %event-loop-deliver (ready)
+  (dolist (pair ready)
+    (let* ((reg (car pair)))
+      (handler-case (funcall (ereg.callback reg) (cdr pair))
+        (error (c)
+          (warn "Error in callback for fd ~d on ~s: ~a"
+                (ereg.fd reg) (ereg.loop reg) c))))))
+
+(defun %event-loop-run (loop)
+  (let* ((epfd (event-loop-epfd loop))
+         (lock (event-loop-lock loop)))
+    (%stack-block ((events (* $event-loop-max-events $epoll-event-size)))
+      (loop
+        (let* ((timeout (with-lock-grabbed (lock)
+                          (if (event-loop-closed loop)
+                            (return)
+                            (let* ((next (%event-loop-next-deadline loop)))
+                              (if next
+                                (max 0 (ceiling (* (- next (get-internal-real-time)) 1000)
+                                                internal-time-units-per-second))
+                                -1)))))
+               (n (int-errno-call (external-call "epoll_wait"
+                                                 :signed-fullword epfd
+                                                 :address events
+                                                 :signed-fullword $event-loop-max-events
+                                                 :signed-fullword timeout
+                                                 :signed-fullword))))
+          (declare (fixnum n))
+          (if (< n 0)
+            (unless (eql n (- #$EINTR))
+              (%errno-disp n))
+            (%event-loop-deliver
+             (with-lock-grabbed (lock)
+               (if (event-loop-closed loop)
+                 (return)
+                 (%event-loop-collect loop events n))))))))))
+
+
+(defun make-event-loop (&key (name "event loop") (threads 1))
+  "Return an event loop whose THREADS threads wait for events and call
+callbacks."
+  (let* ((epfd (int-errno-call (external-call "epoll_create1"
+                                              :signed-fullword $epoll-cloexec
+                                              :signed-fullword))))
+    (when (< epfd 0)
+      (%errno-disp epfd))
+    (let* ((wakefd (int-errno-call (external-call "eventfd"
+                                                  :unsigned-fullword 0
+                                                  :signed-fullword (logior $efd-nonblock $efd-cloexec)
+                                                  :signed-fullword))))
+      (when (< wakefd 0)
+        (fd-close epfd)
+        (%errno-disp wakefd))
+      (let* ((loop (%make-event-loop :name name :epfd epfd :wakefd wakefd))
+             (result (%epoll-ctl epfd $epoll-ctl-add wakefd $epollin)))
+        (unless (eql result 0)
+          (fd-close wakefd)
+          (fd-close epfd)
+          (%errno-disp result))
+        (dotimes (i (max threads 1))
+          (push (process-run-function (format nil "~a ~d" name i)
+                                      #'%event-loop-run loop)
+                (event-loop-processes loop)))
+        loop))))
+
+(defun close-event-loop (loop)
+  "Stop LOOP's threads, and call the callbacks of registrations that're
+still pending with :CLOSED."
+  (let* ((pending ()))
+    (with-lock-grabbed ((event-loop-lock loop))
+      (when (event-loop-closed loop)
+        (return-from close-event-loop nil))
+      (setf (event-loop-closed loop) t)
+      ;; The eventfd stays readable (nothing drains it once the loop is
+      ;; closed), so every thread wakes up and exits.
+      (%event-loop-wake loop)
+      (maphash #'(lambda (fd entry)
+                   (declare (ignore fd))
+                   (dolist (reg (list (efd.input entry) (efd.output entry)))
+                     (when reg
+                       (%event-loop-finish loop reg :closed))))
+               (event-loop-fds loop))
+      (clrhash (event-loop-fds loop))
+      (setq pending (nreverse (event-loop-ready loop)))
+      (setf (event-loop-ready loop) nil))
+    (dolist (p (event-loop-processes loop))
+      (unless (eq p *current-process*)
+        (join-process p)))
+    (fd-close (event-loop-epfd loop))
+    (fd-close (event-loop-wakefd loop))
+    (%event-loop-deliver pending)
+    t))
+
+(defun event-loop-wait-for-input (loop thing callback &key timeout)
+  "Call CALLBACK (with :INPUT, :TIMEOUT or :CLOSED) from one of LOOP's
+threads once THING (an fd, stream or socket) has input available, or
+TIMEOUT seconds have passed.  Returns a registration, which can be
+passed to CANCEL-EVENT-REGISTRATION."
+  (%event-loop-register loop thing :input callback timeout))
+
+(defun event-loop-wait-for-output (loop thing callback &key timeout)
+  "Call CALLBACK (with :OUTPUT, :TIMEOUT or :CLOSED) from one of LOOP's
+threads once output to THING (an fd, stream or socket) is possible, or
+TIMEOUT seconds have passed.  Returns a registration, which can be
+passed to CANCEL-EVENT-REGISTRATION."
+  (%event-loop-register loop thing :output callback timeout))
+
+(defun cancel-event-registration (reg)
+  "Make sure that REG's callback won't be called, if it hasn't been
+already.  Return true if it's been cancelled."
+  (let* ((loop (ereg.loop reg)))
+    (with-lock-grabbed ((event-loop-lock loop))
+      (when (eq (ereg.state reg) :pending)
+        (setf (ereg.state reg) :cancelled)
+        (unless (event-loop-closed loop)
+          (%event-loop-detach loop reg))
+        t))))
+
+(defun event-loop-future (loop thing direction &key timeout)
+  "Return a future whose value (see EVENT-FUTURE-VALUE) is the result
+of waiting for DIRECTION (:INPUT or :OUTPUT) on THING."
+  (let* ((future (%make-event-future)))
+    (%event-loop-register loop thing (ecase direction ((:input :output) direction))
+                          #'(lambda (result)
+                              (setf (event-future-result future) result
+                                    (event-future-done future) t)
+                              (signal-semaphore (event-future-semaphore future)))
+                          timeout)
+    future))
+
+(defun event-future-value (future &optional timeout)
+  "Wait (for at most TIMEOUT seconds, if that's non-NIL) until FUTURE's
+event has happened.  Return the result and T, or NIL and NIL if the
+wait timed out."
+  (unless (event-future-done future)
+    (let* ((sem (event-future-semaphore future)))
+      (unless (if timeout
+                (timed-wait-on-semaphore sem timeout)
+                (wait-on-semaphore sem))
+        (return-from event-future-value (values nil nil)))
+      ;; Let anyone else who's waiting through, too.
+      (signal-semaphore sem)))
+  (values (event-future-result future) t))
+
+(provide "EVENT-LOOP")
@@ -0,0 +1,80 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;;   This file is part of Clozure CL.
+;;;
+;;;   Clozure CL is licensed under the terms of the Lisp Lesser GNU Public
+;;;   License , known as the LLGPL and distributed with Clozure CL as the
+;;;   file "LICENSE".  The LLGPL consists of a preamble and the LGPL,
+;;;   which is distributed with Clozure CL as the file "LGPL".  Where these
+;;;   conflict, the preamble takes precedence.
+;;;
+;;;   Clozure CL is referenced in the preamble as the "LIBRARY."
+;;;
+;;;   The LLGPL is also available online at
+;;;   http://opensource.franz.com/preamble.html
+
+;;; jitdump.lisp
+;;; Tell the Linux "perf" tools the names and addresses of lisp
+;;; functions, so that "perf report" can attribute samples to them.
+;;; See the comments in lisp-kernel/jitdump.c.  Typical use:
+;;;
+;;;  ? (require :jitdump)
+;;;  ? (start-perf-jitdump)
+;;;  $ perf record -k mono -p <pid>
+;;;  $ perf inject --jit -i perf.data -o perf.jit.data
+;;;  $ perf report -i perf.jit.data
+;;;
+;;; or, with :PERF-MAP T, just "perf record" and "perf report".
+;;;
+;;; Only x86-64 Linux kernels support this.
+
+(in-package :ccl)
+
+(export '(start-perf-jitdump
+          stop-perf-jitdump))
+
+(defun %perf-function-name (f)
+  (let* ((name (function-name f)))
+    (with-standard-io-syntax
+      (let* ((*print-readably* nil))
+        (if (and name (or (symbolp name) (consp name)))
+          (format nil "~s" name)
+          (format nil "~s" f))))))
+
+(defun %perf-note-function (f)
+  (when (functionp f)
+    (with-utf-8-cstrs ((name (%perf-function-name f)))
+      (without-gcing
+        (external-call "jitdump_note_function"
+                       :unsigned-doubleword (%address-of f)
+                       :address name
+                       :signed-fullword)))))
+
+(defun start-perf-jitdump (&key (directory "/tmp/") (jitdump t) perf-map
+                                (existing t))
+  "Start describing compiled functions to perf: in a jitdump file in
+DIRECTORY if JITDUMP is true, and/or in /tmp/perf-<pid>.map if
+PERF-MAP is true.  If EXISTING is true, describe all functions that
+already exist, as well as those that're compiled or loaded later."
+  (unless (foreign-symbol-address "jitdump_open")
+    (error "This lisp kernel doesn't support perf jitdump files."))
+  (let* ((err (with-utf-8-cstrs ((dir (native-translated-namestring directory)))
+                (external-call "jitdump_open"
+                               :address dir
+                               :signed-fullword (logior (if jitdump 1 0)
+                                                        (if perf-map 2 0))
+                               :signed-fullword))))
+    (unless (eql err 0)
+      (%errno-disp err directory)))
+  (when existing
+    (%map-lfuns #'%perf-note-function))
+  (setq *new-function-hook* #'%perf-note-function)
+  t)
+
+(defun stop-perf-jitdump ()
+  "Stop describing functions to perf, and close any files."
+  (setq *new-function-hook* nil)
+  (external-call "jitdump_close" :void)
+  t)
+
+(provide "JITDUMP")
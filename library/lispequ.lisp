@@ -24,6 +24,7 @@
 (defconstant $flags_DisposPtr 2)
 (defconstant $flags_DisposeRwlock 3)
 (defconstant $flags_DisposeSemaphore 4)
+(defconstant $flags_DisposeWaitQueue 5)
 
 (defconstant $system-lock-type-recursive 0)
 (defconstant $system-lock-type-rwlock 1)
@@ -1261,6 +1262,19 @@
 (defmacro make-semaphore-notification ()
   `(%istruct 'semaphore-notification nil))
 
+(def-accessors (wait-queue) %svref
+  nil                                   ; 'wait-queue
+  wait-queue.ptr                        ; foreign: sequence, waiters
+  wait-queue.semaphore                  ; when futexes aren't available
+  wait-queue.name
+  )
+
+;;; Layout of a wait queue's foreign memory.  The sequence number is
+;;; a natural; on Linux, waiters wait on a futex on its low 32 bits.
+(defconstant $wait-queue-sequence 0)
+(defconstant $wait-queue-waiters 8)
+(defconstant $wait-queue-size 16)
+
 ;;; Why were these ever in architecture-dependent packages ?
 (defenum (:prefix "AREA-")
   void                                  ; list header
@@ -1273,6 +1287,7 @@
   managed-static                        ; growable static area
   static                                ; static data in application
   dynamic                               ; dynmaic (heap) data in application
+  large-objects                         ; big ivectors, never moved by the GC
 )
 
 ;;; areas are sorted such that (in the "succ" direction) codes are >=.
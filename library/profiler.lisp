@@ -0,0 +1,399 @@
+;;;-*-Mode: LISP; Package: ccl -*-
+;;;
+;;;   This file is part of Clozure CL.
+;;;
+;;;   Clozure CL is licensed under the terms of the Lisp Lesser GNU Public
+;;;   License , known as the LLGPL and distributed with Clozure CL as the
+;;;   file "LICENSE".  The LLGPL consists of a preamble and the LGPL,
+;;;   which is distributed with Clozure CL as the file "LGPL".  Where these
+;;;   conflict, the preamble takes precedence.
+;;;
+;;;   Clozure CL is referenced in the preamble as the "LIBRARY."
+;;;
+;;;   The LLGPL is also available online at
+;;;   http://opensource.franz.com/preamble.html
+
+;;; profiler.lisp
+;;; A statistical CPU profiler.  While it's running, the kernel samples
+;;; each lisp thread every so often (of that thread's CPU time), noting
+;;; which functions are on its stack; see the comments around
+;;; profile_buffer in lisp-kernel/threads.h.  A lisp thread copies the
+;;; samples out of the kernel's buffers and counts them up here.
+;;;
+;;; The allocation profiler works the same way, but the kernel samples
+;;; about one allocation per so many bytes that a thread conses.
+;;;
+;;; Only x86-64 Linux kernels support this.
+
+(in-package :ccl)
+
+(export '(start-profiler
+          stop-profiler
+          reset-profiler
+          profiler-report
+          with-profiling
+          start-allocation-profiler
+          stop-allocation-profiler
+          reset-allocation-profiler
+          allocation-profiler-report
+          with-allocation-profiling))
+
+(defconstant profile-sample-lisp 0)
+(defconstant profile-sample-foreign 1)
+(defconstant profile-sample-gc 2)
+(defconstant profile-sample-alloc 3)
+
+(defstruct (profile-data (:constructor make-profile-data ()))
+  (nsamples 0)
+  (ngc 0)                               ; samples taken in the GC
+  (nforeign 0)                          ; ... in foreign code
+  (ndropped 0)                          ; lost because a buffer filled up
+  (self (make-hash-table :test #'eq))   ; function -> count
+  (total (make-hash-table :test #'eq))  ; function -> count
+  (callers (make-hash-table :test #'eq))) ; callee -> (hash caller -> count)
+
+(defvar *profile-data* (make-profile-data))
+(defvar *profile-lock* (make-lock "profiler"))
+(defvar *profile-drain-process* nil)
+(defvar *profile-dropped* (make-hash-table :test #'eql)
+  "Maps kernel buffers' addresses to how many of their dropped samples
+we've already counted.")
+
+(defun %profile-buffers (&optional (name "profile_buffers"))
+  (let* ((p (foreign-symbol-address name)))
+    (unless p
+      (error "This lisp kernel doesn't support the sampling profiler."))
+    (%get-ptr p)))
+
+(defun %count-profile-sample (data functions kind)
+  (declare (list functions))
+  (incf (profile-data-nsamples data))
+  (case kind
+    (#.profile-sample-gc (incf (profile-data-ngc data)))
+    (#.profile-sample-foreign (incf (profile-data-nforeign data))))
+  (let* ((self (profile-data-self data))
+         (total (profile-data-total data))
+         (callers (profile-data-callers data))
+         (leaf (cond ((eql kind profile-sample-gc) :gc)
+                     ((eql kind profile-sample-foreign) :foreign)
+                     (t (car functions)))))
+    (when leaf
+      (incf (gethash leaf self 0)))
+    ;; Count each function once per sample, however deeply it recurses.
+    (let* ((seen ()))
+      (when (and leaf (atom leaf) (not (functionp leaf)))
+        (push leaf seen)
+        (incf (gethash leaf total 0)))
+      (dolist (f functions)
+        (unless (member f seen :test #'eq)
+          (push f seen)
+          (incf (gethash f total 0)))))
+    (let* ((callee leaf))
+      (dolist (caller (if (functionp leaf) (cdr functions) functions))
+        (when callee
+          (let* ((h (or (gethash callee callers)
+                        (setf (gethash callee callers)
+                              (make-hash-table :test #'eq)))))
+            (incf (gethash caller h 0))))
+        (setq callee caller)))))
+
+(defun %read-profile-records (name dropped-table)
+  "Return a list of the unread records in the kernel buffers on the
+list named NAME, each as a list of the objects in it (after the
+kind), and the number of samples dropped since the last call."
+  (let* ((records ())
+         (ndropped 0))
+    ;; The records' objects are only safe to look at while the GC
+    ;; can't move them, so copy them out first.
+    (without-gcing
+      (do* ((pb (%profile-buffers name) (%get-ptr pb 0)))
+           ((%null-ptr-p pb))
+        (let* ((header-words (%get-natural pb (* 1 target::node-size)))
+               (record-words (%get-natural pb (* 2 target::node-size)))
+               (capacity (%get-natural pb (* 3 target::node-size)))
+               (head (%get-natural pb (* 4 target::node-size)))
+               (tail (%get-natural pb (* 5 target::node-size)))
+               (dropped (%get-natural pb (* 6 target::node-size)))
+               (address (%ptr-to-int pb))
+               (counted (gethash address dropped-table 0)))
+          (when (> dropped counted)
+            (incf ndropped (- dropped counted))
+            (setf (gethash address dropped-table) dropped))
+          (do* ((i tail (1+ i)))
+               ((= i head))
+            (let* ((offset (* target::node-size
+                              (+ header-words
+                                 (* record-words (mod i capacity)))))
+                   (n (%get-object pb offset))
+                   (record ()))
+              (dotimes (j (1+ n))
+                (push (%get-object pb (+ offset (* (1+ j) target::node-size)))
+                      record))
+              (push (nreverse record) records)))
+          (setf (%get-natural pb (* 5 target::node-size)) head))))
+    (values (nreverse records) ndropped)))
+
+(defun %drain-profile-samples (&optional (data *profile-data*))
+  "Move the samples that the kernel has collected into DATA."
+  (with-lock-grabbed (*profile-lock*)
+    (multiple-value-bind (records ndropped)
+        (%read-profile-records "profile_buffers" *profile-dropped*)
+      (incf (profile-data-ndropped data) ndropped)
+      (dolist (r records)
+        (%count-profile-sample data
+                               (remove-if-not #'functionp (cdr r))
+                               (car r))))))
+
+(defun start-profiler (&key (interval 1000) (buffer-size 4096))
+  "Start sampling each lisp thread every INTERVAL microseconds of its
+CPU time.  Up to BUFFER-SIZE samples per thread are kept until a lisp
+thread gets around to counting them; samples taken while a buffer is
+full are lost (and PROFILER-REPORT says how many.)  Samples accumulate
+until RESET-PROFILER is called."
+  (setq interval (require-type interval '(integer 1 #.(ash 1 32)))
+        buffer-size (require-type buffer-size '(integer 1 #.(ash 1 24))))
+  (%profile-buffers)
+  (with-lock-grabbed (*profile-lock*)
+    (when *profile-drain-process*
+      (error "The profiler's already running."))
+    (let* ((err (external-call "profiler_start"
+                               :unsigned-doubleword interval
+                               :unsigned-doubleword buffer-size
+                               :signed-fullword)))
+      (unless (eql err 0)
+        (%errno-disp err)))
+    (setq *profile-drain-process*
+          (process-run-function "profiler"
+                                #'(lambda ()
+                                    (loop
+                                      (sleep 0.1)
+                                      (%drain-profile-samples))))))
+  t)
+
+(defun stop-profiler ()
+  "Stop sampling, keeping the samples collected so far.  Returns T if
+the profiler was running."
+  (let* ((process (with-lock-grabbed (*profile-lock*)
+                    (prog1 *profile-drain-process*
+                      (setq *profile-drain-process* nil)))))
+    (when process
+      (external-call "profiler_stop" :void)
+      (process-kill process)
+      (%drain-profile-samples)
+      t)))
+
+(defun reset-profiler ()
+  "Stop sampling and forget all samples."
+  (stop-profiler)
+  (with-lock-grabbed (*profile-lock*)
+    (external-call "profiler_discard" :void)
+    (clrhash *profile-dropped*)
+    (setq *profile-data* (make-profile-data)))
+  t)
+
+(defmacro with-profiling ((&rest args &key &allow-other-keys) &body body)
+  "Run BODY with the profiler running, then stop it."
+  `(progn
+     (start-profiler ,@args)
+     (unwind-protect
+          (progn ,@body)
+       (stop-profiler))))
+
+(defun %profile-entry-name (x)
+  (case x
+    (:gc "<GC>")
+    (:foreign "<foreign code>")
+    (t (let* ((name (function-name x)))
+         (if name
+           (format nil "~s" name)
+           (format nil "~s" x))))))
+
+(defun %sorted-counts (hash)
+  (let* ((entries ()))
+    (maphash #'(lambda (k v) (push (cons k v) entries)) hash)
+    (sort entries #'> :key #'cdr)))
+
+(defun profiler-report (&key (stream *standard-output*) (type :flat) (max 30))
+  "Describe where the sampled threads spent their time.  TYPE :FLAT
+lists the functions that were most often running (\"self\") or on the
+stack (\"total\"); TYPE :GRAPH also lists the callers of each of those
+functions."
+  (%drain-profile-samples)
+  (let* ((data *profile-data*)
+         (nsamples (profile-data-nsamples data))
+         (self (profile-data-self data))
+         (total (profile-data-total data)))
+    (flet ((percent (n)
+             (if (zerop nsamples) 0 (/ (* 100.0 n) nsamples))))
+      (format stream "~&~d samples (~,1f% in the GC, ~,1f% in foreign code)~@[, ~d dropped~]~%"
+              nsamples
+              (percent (profile-data-ngc data))
+              (percent (profile-data-nforeign data))
+              (let* ((n (profile-data-ndropped data)))
+                (unless (zerop n) n)))
+      (format stream "~&~%   Self  Total  Function~%")
+      (let* ((entries (%sorted-counts self))
+             (shown ()))
+        (loop for (f . n) in entries
+              for i below max
+              do (push f shown)
+                 (format stream "~&~6,1f% ~5,1f%  ~a~%"
+                         (percent n)
+                         (percent (gethash f total 0))
+                         (%profile-entry-name f)))
+        (when (eq type :graph)
+          (format stream "~&~%Callers~%")
+          (dolist (f (nreverse shown))
+            (format stream "~&~%~a~%" (%profile-entry-name f))
+            (let* ((callers (gethash f (profile-data-callers data))))
+              (if callers
+                (loop for (caller . n) in (%sorted-counts callers)
+                      for i below max
+                      do (format stream "~&  ~6,1f%  ~a~%"
+                                 (percent n)
+                                 (%profile-entry-name caller)))
+                (format stream "~&  (none)~%")))))))
+    (values)))
+
+;;; Allocation profiling.  A sample stands for INTERVAL bytes of consing
+;;; (or for the object itself, if that's bigger), so the byte counts in
+;;; the report are estimates.
+
+(defstruct (alloc-profile-data (:constructor make-alloc-profile-data ()))
+  (interval 0)
+  (nsamples 0)
+  (ndropped 0)
+  (bytes 0)
+  (sites (make-hash-table :test #'equal)) ; (function . type) -> #(count bytes)
+  (live (make-hash-table :test #'eq :weak :key))) ; object -> (site . bytes)
+
+(defvar *alloc-profile-data* (make-alloc-profile-data))
+(defvar *alloc-profile-drain-process* nil)
+(defvar *alloc-profile-dropped* (make-hash-table :test #'eql))
+
+(defun %alloc-sample-type (subtag)
+  (if (eql subtag target::fulltag-cons)
+    'cons
+    (aref *heap-utilization-vector-type-names* subtag)))
+
+(defun %drain-allocation-samples (&optional (data *alloc-profile-data*))
+  (with-lock-grabbed (*profile-lock*)
+    (multiple-value-bind (records ndropped)
+        (%read-profile-records "alloc_profile_buffers" *alloc-profile-dropped*)
+      (incf (alloc-profile-data-ndropped data) ndropped)
+      (dolist (r records)
+        (destructuring-bind (kind object size subtag &optional function &rest callers) r
+          (declare (ignore callers))
+          (when (eql kind profile-sample-alloc)
+            (let* ((site (cons (if (functionp function) function)
+                               (%alloc-sample-type subtag)))
+                   (bytes (max size (alloc-profile-data-interval data)))
+                   (counts (or (gethash site (alloc-profile-data-sites data))
+                               (setf (gethash site (alloc-profile-data-sites data))
+                                     (vector 0 0)))))
+              (incf (alloc-profile-data-nsamples data))
+              (incf (alloc-profile-data-bytes data) bytes)
+              (incf (svref counts 0))
+              (incf (svref counts 1) bytes)
+              (unless (eql object 0)
+                (setf (gethash object (alloc-profile-data-live data))
+                      (cons site bytes))))))))))
+
+(defun start-allocation-profiler (&key (interval (* 512 1024)) (buffer-size 4096))
+  "Start sampling about one allocation per INTERVAL bytes that each
+lisp thread conses.  ALLOCATION-PROFILER-REPORT then shows where the
+consing's being done, and which of the sampled objects are still
+alive."
+  (setq interval (require-type interval `(integer ,target::dnode-size #.(ash 1 40)))
+        buffer-size (require-type buffer-size '(integer 1 #.(ash 1 24))))
+  (%profile-buffers "alloc_profile_buffers")
+  (with-lock-grabbed (*profile-lock*)
+    (when *alloc-profile-drain-process*
+      (error "The allocation profiler's already running."))
+    (let* ((err (external-call "allocation_profiler_start"
+                               :unsigned-doubleword interval
+                               :unsigned-doubleword buffer-size
+                               :signed-fullword)))
+      (unless (eql err 0)
+        (%errno-disp err)))
+    (setf (alloc-profile-data-interval *alloc-profile-data*) interval)
+    (setq *alloc-profile-drain-process*
+          (process-run-function "allocation profiler"
+                                #'(lambda ()
+                                    (loop
+                                      (sleep 0.1)
+                                      (%drain-allocation-samples))))))
+  t)
+
+(defun stop-allocation-profiler ()
+  "Stop sampling allocations, keeping the samples collected so far.
+Returns T if the allocation profiler was running."
+  (let* ((process (with-lock-grabbed (*profile-lock*)
+                    (prog1 *alloc-profile-drain-process*
+                      (setq *alloc-profile-drain-process* nil)))))
+    (when process
+      (external-call "allocation_profiler_stop" :void)
+      (process-kill process)
+      (%drain-allocation-samples)
+      t)))
+
+(defun reset-allocation-profiler ()
+  "Stop sampling allocations and forget all samples."
+  (stop-allocation-profiler)
+  (with-lock-grabbed (*profile-lock*)
+    (external-call "allocation_profiler_discard" :void)
+    (clrhash *alloc-profile-dropped*)
+    (setq *alloc-profile-data* (make-alloc-profile-data)))
+  t)
+
+(defmacro with-allocation-profiling ((&rest args &key &allow-other-keys) &body body)
+  "Run BODY with the allocation profiler running, then stop it."
+  `(progn
+     (start-allocation-profiler ,@args)
+     (unwind-protect
+          (progn ,@body)
+       (stop-allocation-profiler))))
+
+(defun allocation-profiler-report (&key (stream *standard-output*) (type :sites)
+                                        (max 30) (gc t))
+  "Describe where the sampled threads consed.  TYPE :SITES lists the
+functions and types that account for the most allocation; TYPE :LIVE
+lists those whose sampled objects are still alive (after a full GC,
+unless GC is NIL), which is where to look for unexpected retention."
+  (%drain-allocation-samples)
+  (let* ((data *alloc-profile-data*)
+         (sites (make-hash-table :test #'equal))
+         (total 0))
+    (ecase type
+      (:sites
+       (maphash #'(lambda (site counts)
+                    (setf (gethash site sites) (svref counts 1)))
+                (alloc-profile-data-sites data))
+       (setq total (alloc-profile-data-bytes data)))
+      (:live
+       (when gc (gc))
+       (with-lock-grabbed (*profile-lock*)
+         (maphash #'(lambda (object entry)
+                      (declare (ignore object))
+                      (incf (gethash (car entry) sites 0) (cdr entry))
+                      (incf total (cdr entry)))
+                  (alloc-profile-data-live data)))))
+    (format stream "~&~d samples, about ~:d bytes ~:[allocated~;still live~]~@[, ~d dropped~]~%"
+            (alloc-profile-data-nsamples data)
+            total
+            (eq type :live)
+            (let* ((n (alloc-profile-data-ndropped data)))
+              (unless (zerop n) n)))
+    (format stream "~&~%~15@a      %  Type / Function~%" "Bytes")
+    (loop for (site . bytes) in (%sorted-counts sites)
+          for i below max
+          do (format stream "~&~15:d ~6,1f%  ~s / ~a~%"
+                     bytes
+                     (if (zerop total) 0 (/ (* 100.0 bytes) total))
+                     (cdr site)
+                     (if (car site)
+                       (%profile-entry-name (car site))
+                       "?")))
+    (values)))
+
+(provide "PROFILER")
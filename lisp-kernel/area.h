@@ -35,7 +35,9 @@ typedef enum {
   AREA_MANAGED_STATIC = 7<<fixnumshift, /* A resizable static area */
   AREA_STATIC = 8<<fixnumshift, /* A  static section: contains
                                  roots, but not GCed */
-  AREA_DYNAMIC = 9<<fixnumshift /* A heap. Only one such area is "the heap."*/
+  AREA_DYNAMIC = 9<<fixnumshift, /* A heap. Only one such area is "the heap."*/
+  AREA_LARGE_OBJECTS = 10<<fixnumshift /* Big ivectors that the GC doesn't move.
+                                          Not on the list of all areas. */
 } area_code;
 
 typedef struct area {
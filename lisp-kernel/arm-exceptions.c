@@ -514,10 +514,12 @@ handle_gc_trap(ExceptionInformation *xp, TCR *tcr)
       if (selector & GC_TRAP_FUNCTION_SAVE_APPLICATION) {
         OSErr err;
         extern OSErr save_application(unsigned, Boolean);
+        extern Boolean save_image_compressed;
         TCR *tcr = get_tcr(true);
         area *vsarea = tcr->vs_area;
 	
         nrs_TOPLFUNC.vcell = *((LispObj *)(vsarea->high)-1);
+        save_image_compressed = ((selector & GC_TRAP_FUNCTION_SAVE_COMPRESSED) != 0);
         err = save_application(arg, egc_was_enabled);
         if (err == noErr) {
           _exit(0);
@@ -712,8 +714,11 @@ gc_like_from_xp(ExceptionInformation *xp,
   TCR *tcr = get_tcr(true), *other_tcr;
   int result;
   signed_natural inhibit;
+  u64_t t0;
 
+  t0 = gc_timestamp_ns();
   suspend_other_threads(true);
+  gc_event_note_suspend(gc_timestamp_ns()-t0);
   inhibit = (signed_natural)(lisp_global(GC_INHIBIT_COUNT));
   if (inhibit != 0) {
     if (inhibit > 0) {
@@ -758,7 +763,9 @@ gc_like_from_xp(ExceptionInformation *xp,
 
   gc_tcr = NULL;
 
+  t0 = gc_timestamp_ns();
   resume_other_threads(true);
+  gc_event_note_resume(gc_timestamp_ns()-t0);
 
   return result;
 
@@ -53,6 +53,43 @@ set_n_bits(bitvector bits, natural first, natural n)
   }
 }
 
+/*
+  Like set_n_bits, but other threads may be setting bits in the
+  first and last words of the range at the same time.  (Nothing
+  else should be touching the words in between.)
+*/
+void
+atomic_set_n_bits(bitvector bits, natural first, natural n)
+{
+  extern natural atomic_ior(bitvector, natural);
+
+  if (n) {
+    natural
+      lastbit = (first+n)-1,
+      leftbit = first & bitmap_shift_count_mask,
+      leftmask = ALL_ONES >> leftbit,
+      rightmask = ALL_ONES << ((nbits_in_word-1) - (lastbit & bitmap_shift_count_mask)),
+      *wstart = ((natural *) bits) + (first>>bitmap_shift),
+      *wend = ((natural *) bits) + (lastbit>>bitmap_shift);
+
+    if (wstart == wend) {
+      atomic_ior(wstart, leftmask & rightmask);
+    } else {
+      atomic_ior(wstart++, leftmask);
+      n -= (nbits_in_word - leftbit);
+      
+      while (n >= nbits_in_word) {
+        *wstart++ = ALL_ONES;
+        n-= nbits_in_word;
+      }
+      
+      if (n) {
+        atomic_ior(wstart, rightmask);
+      }
+    }
+  }
+}
+
 /* Note that this zeros natural-sized words */
 void
 zero_bits(bitvector bits, natural nbits)
@@ -68,6 +68,7 @@ atomic_set_bit(bitvector bits ,natural bitnum)
 }
 
 void set_n_bits(bitvector,natural,natural);
+void atomic_set_n_bits(bitvector,natural,natural);
 
 static inline int
 clr_bit(bitvector bits, natural bitnum)
@@ -29,6 +29,13 @@
 #include <sys/time.h>
 #endif
 
+#ifdef BACKGROUND_ZEROING
+#include <sched.h>
+#ifdef LINUX
+#include <sys/mman.h>
+#endif
+#endif
+
 #ifndef timeradd
 # define timeradd(a, b, result)						      \
   do {									      \
@@ -87,6 +94,26 @@ static_dnodes_for_area(area *a)
   return 0;
 }
 
+/* The value of *PACKAGE* in TCR, if it's a package; 0 otherwise */
+LispObj
+current_package(TCR *tcr)
+{
+  LispObj
+    pkg,
+    pkgidx = nrs_PACKAGE.binding_index;
+
+  if ((pkgidx >= tcr->tlb_limit) ||
+      ((pkg = tcr->tlb_pointer[pkgidx>>fixnumshift]) == 
+       no_thread_local_binding_marker)) {
+    pkg = nrs_PACKAGE.vcell;
+  }
+  if ((fulltag_of(pkg) == fulltag_misc) &&
+      (header_subtag(header_of(pkg)) == subtag_package)) {
+    return pkg;
+  }
+  return 0;
+}
+
 Boolean GCDebug = false, GCverbose = false;
 bitvector GCmarkbits = NULL, GCdynamic_markbits = NULL, managed_static_refbits = NULL;
 LispObj GCarealow = 0, GCareadynamiclow = 0;
@@ -162,8 +189,9 @@ reapweakv(LispObj weakv)
             ((car_dnode = gc_area_dnode(alist_cell)) < GCndnodes_in_area) &&
             (! ref_bit(markbits, car_dnode)) &&
             (is_node_fulltag(fulltag_of(thecar = car(alist_cell)))) &&
-            ((car_dnode = gc_area_dnode(thecar)) < GCndnodes_in_area) &&
-            (! ref_bit(markbits, car_dnode))) {
+            ((((car_dnode = gc_area_dnode(thecar)) < GCndnodes_in_area) &&
+              (! ref_bit(markbits, car_dnode))) ||
+             large_object_unmarked(thecar))) {
           *prev = rawcons->cdr;
           if (terminatablep) {
             rawcons->cdr = termination_list;
@@ -194,8 +222,9 @@ reapweakv(LispObj weakv)
         cartag = fulltag_of(thecar);
 
         if (is_node_fulltag(cartag) &&
-            ((car_dnode = gc_area_dnode(thecar)) < GCndnodes_in_area) &&
-            (! ref_bit(markbits, car_dnode))) {
+            ((((car_dnode = gc_area_dnode(thecar)) < GCndnodes_in_area) &&
+              (! ref_bit(markbits, car_dnode))) ||
+             large_object_unmarked(thecar))) {
           *prev = rawcons->cdr;
           if (terminatablep) {
             rawcons->cdr = termination_list;
@@ -222,6 +251,68 @@ reapweakv(LispObj weakv)
   }
 }
 
+/*
+  Remove the pairs in [pairp, pairp+2*npairs) whose weak element
+  wasn't marked; return the number of pairs removed.
+*/
+static natural
+reap_hash_pairs(LispObj *pairp, natural npairs, int weak_index, LispObj empty_value)
+{
+  natural dnode, ndeleted = 0;
+  bitvector markbits = GCmarkbits;
+  LispObj weakelement;
+
+  while (npairs--) {
+    weakelement = pairp[weak_index];
+    if (is_node_fulltag(fulltag_of(weakelement))) {
+      dnode = gc_area_dnode(weakelement);
+      if (((dnode < GCndnodes_in_area) && 
+           ! ref_bit(markbits, dnode)) ||
+          large_object_unmarked(weakelement)) {
+        pairp[0] = slot_unbound;
+        pairp[1] = empty_value;
+        ndeleted++;
+      }
+    }
+    pairp += 2;
+  }
+  return ndeleted;
+}
+
+#ifdef PARALLEL_GC
+/* Reap untenured weak hash vectors with at least this many pairs in
+   all GC threads. */
+#define PARALLEL_REAP_MIN_PAIRS (64*1024)
+
+typedef struct {
+  LispObj *pairs;
+  natural npairs;
+  int weak_index;
+  LispObj empty_value;
+  natural ndeleted[MAX_GC_THREADS];
+} reap_hash_pairs_arg;
+
+static void
+reap_hash_pairs_worker(natural me, natural nthreads, void *arg)
+{
+  reap_hash_pairs_arg *r = (reap_hash_pairs_arg *)arg;
+  natural
+    chunk = (r->npairs + nthreads - 1) / nthreads,
+    start = me * chunk,
+    end = start + chunk;
+
+  if (end > r->npairs) {
+    end = r->npairs;
+  }
+  if (start < end) {
+    r->ndeleted[me] = reap_hash_pairs(r->pairs + (start << 1),
+                                      end - start,
+                                      r->weak_index,
+                                      r->empty_value);
+  }
+}
+#endif
+
 /* 
   Screw: doesn't deal with finalization.
   */
@@ -253,27 +344,57 @@ reaphashv(LispObj hashv)
     hashv_tenured = (memo_dnode < tenured_dnodes);
   natural bits, bitidx, *bitsp;
 
-  if (hashv_tenured) {
-    set_bitidx_vars(tenured_area->refbits, memo_dnode, bitsp, bits, bitidx);
+  if (!hashv_tenured) {
+    /* Every pair has to be looked at; there may be a lot of them. */
+    natural ndeleted = 0;
+
+    if (npairs > 0) {
+#ifdef PARALLEL_GC
+      if ((GCthreads > 1) && (npairs >= PARALLEL_REAP_MIN_PAIRS)) {
+        reap_hash_pairs_arg arg;
+        natural i;
+
+        arg.pairs = pairp;
+        arg.npairs = npairs;
+        arg.weak_index = weak_index;
+        arg.empty_value = empty_value;
+        memset(arg.ndeleted, 0, sizeof(arg.ndeleted));
+        gc_run_parallel(reap_hash_pairs_worker, &arg);
+        for (i = 0; i < GCthreads; i++) {
+          ndeleted += arg.ndeleted[i];
+        }
+      } else
+#endif
+      {
+        ndeleted = reap_hash_pairs(pairp, npairs, weak_index, empty_value);
+      }
+    }
+    hashp->count += (ndeleted<<fixnumshift);
+    if (!keys_frozen) {
+      hashp->deleted_count += (ndeleted<<fixnumshift);
+    }
+    deref(hashv, 1) = lisp_global(WEAKVLL);
+    lisp_global(WEAKVLL) = untag(hashv);
+    return;
   }
 
+  set_bitidx_vars(tenured_area->refbits, memo_dnode, bitsp, bits, bitidx);
+
   while (true) {
-    if (hashv_tenured) {
-      while (bits == 0) {
-        int skip = nbits_in_word - bitidx;
+    while (bits == 0) {
+      int skip = nbits_in_word - bitidx;
+      npairs -= skip;
+      if (npairs <= 0) break;
+      pairp += (skip+skip);
+      bitidx = 0;
+      bits = *++bitsp;
+    }
+    if (bits != 0) {
+      int skip = (count_leading_zeros(bits) - bitidx);
+      if (skip != 0) {
         npairs -= skip;
-        if (npairs <= 0) break;
         pairp += (skip+skip);
-        bitidx = 0;
-        bits = *++bitsp;
-      }
-      if (bits != 0) {
-        int skip = (count_leading_zeros(bits) - bitidx);
-        if (skip != 0) {
-          npairs -= skip;
-          pairp += (skip+skip);
-          bitidx += skip;
-        }
+        bitidx += skip;
       }
     }
 
@@ -283,8 +404,9 @@ reaphashv(LispObj hashv)
     tag = fulltag_of(weakelement);
     if (is_node_fulltag(tag)) {
       dnode = gc_area_dnode(weakelement);
-      if ((dnode < GCndnodes_in_area) && 
-          ! ref_bit(markbits, dnode)) {
+      if (((dnode < GCndnodes_in_area) && 
+           ! ref_bit(markbits, dnode)) ||
+          large_object_unmarked(weakelement)) {
 	pairp[0] = slot_unbound;
 	pairp[1] = empty_value;
         hashp->count += (1<<fixnumshift);
@@ -361,8 +483,14 @@ ncircle_mark_weak_htabv(LispObj htabv)
 }
 
 
+/*
+  Mark the non-weak element of each pair whose weak element is marked.
+  Return true if anything new was marked; set *pendingp if some pair's
+  elements are both still unmarked (so that marking something else
+  might make us mark one of them later.)
+*/
 Boolean
-mark_weak_hash_vector(hash_table_vector_header *hashp, natural elements)
+mark_weak_hash_vector(hash_table_vector_header *hashp, natural elements, Boolean *pendingp)
 {
   natural flags = hashp->flags, weak_dnode, nonweak_dnode;
   Boolean 
@@ -424,20 +552,24 @@ mark_weak_hash_vector(hash_table_vector_header *hashp, natural elements)
     nonweak_tag = fulltag_of(nonweak);
     if (is_node_fulltag(nonweak_tag)) {
       nonweak_dnode = gc_area_dnode(nonweak);
-      if ((nonweak_dnode < GCndnodes_in_area) &&
-          ! ref_bit(GCmarkbits,nonweak_dnode)) {
+      if (((nonweak_dnode < GCndnodes_in_area) &&
+           ! ref_bit(GCmarkbits,nonweak_dnode)) ||
+          large_object_unmarked(nonweak)) {
         weak_marked = true;
         weak_tag = fulltag_of(weak);
         if (is_node_fulltag(weak_tag)) {
           weak_dnode = gc_area_dnode(weak);
-          if ((weak_dnode < GCndnodes_in_area) &&
-              ! ref_bit(GCmarkbits, weak_dnode)) {
+          if (((weak_dnode < GCndnodes_in_area) &&
+               ! ref_bit(GCmarkbits, weak_dnode)) ||
+              large_object_unmarked(weak)) {
             weak_marked = false;
           }
         }
         if (weak_marked) {
           mark_root(nonweak);
           marked_new = true;
+        } else {
+          *pendingp = true;
         }
       }
     }
@@ -450,7 +582,7 @@ mark_weak_hash_vector(hash_table_vector_header *hashp, natural elements)
 
 
 Boolean
-mark_weak_alist(LispObj weak_alist, int weak_type)
+mark_weak_alist(LispObj weak_alist, int weak_type, Boolean *pendingp)
 {
   natural
     elements = header_element_count(header_of(weak_alist)),
@@ -476,16 +608,20 @@ mark_weak_alist(LispObj weak_alist, int weak_type)
       if (pair_tag == fulltag_cons) {
         key = car(pair);
         if ((! is_node_fulltag(fulltag_of(key))) ||
-            ((dnode = gc_area_dnode(key)) >= GCndnodes_in_area) ||
-            ref_bit(markbits,dnode)) {
+            ((((dnode = gc_area_dnode(key)) >= GCndnodes_in_area) ||
+              ref_bit(markbits,dnode)) &&
+             !large_object_unmarked(key))) {
           /* key is marked, mark value if necessary */
           value = cdr(pair);
           if (is_node_fulltag(fulltag_of(value)) &&
-              ((dnode = gc_area_dnode(value)) < GCndnodes_in_area) &&
-              (! ref_bit(markbits,dnode))) {
+              ((((dnode = gc_area_dnode(value)) < GCndnodes_in_area) &&
+                (! ref_bit(markbits,dnode))) ||
+               large_object_unmarked(value))) {
             mark_root(value);
             marked_new = true;
           }
+        } else {
+          *pendingp = true;
         }
       } else {
           mark_root(pair);
@@ -524,11 +660,14 @@ mark_termination_lists()
 void
 traditional_markhtabvs()
 {
-  LispObj *base, this, header, pending;
+  LispObj *base, this, header, pending, settled = (LispObj) NULL;
   int subtag;
   hash_table_vector_header *hashp;
-  Boolean marked_new;
+  Boolean marked_new, more_pending;
 
+  /* Weak vectors and hash tables that have nothing left that later
+     passes could mark go on "settled" and aren't looked at again
+     until they're reaped. */
   do {
     pending = (LispObj) NULL;
     marked_new = false;
@@ -539,27 +678,38 @@ traditional_markhtabvs()
       
       header = base[0];
       subtag = header_subtag(header);
+      more_pending = false;
       
       if (subtag == subtag_weak) {
         natural weak_type = base[2];
         this = ptr_to_lispobj(base) + fulltag_misc;
-        base[1] = pending;
-        pending = ptr_to_lispobj(base);
         if ((weak_type & population_type_mask) == population_weak_alist) {
-          if (mark_weak_alist(this, weak_type)) {
+          if (mark_weak_alist(this, weak_type, &more_pending)) {
             marked_new = true;
           }
         }
+        if (more_pending) {
+          base[1] = pending;
+          pending = ptr_to_lispobj(base);
+        } else {
+          base[1] = settled;
+          settled = ptr_to_lispobj(base);
+        }
       } else if (subtag == subtag_hash_vector) {
         natural elements = header_element_count(header);
 
         hashp = (hash_table_vector_header *) base;
         if (hashp->flags & nhash_weak_mask) {
-          base[1] = pending;
-          pending = ptr_to_lispobj(base);
-          if (mark_weak_hash_vector(hashp, elements)) {
+          if (mark_weak_hash_vector(hashp, elements, &more_pending)) {
             marked_new = true;
           }
+          if (more_pending) {
+            base[1] = pending;
+            pending = ptr_to_lispobj(base);
+          } else {
+            base[1] = settled;
+            settled = ptr_to_lispobj(base);
+          }
         } 
       } else {
         Bug(NULL, "Strange object on weak vector linked list: " LISP "\n", base);
@@ -571,11 +721,21 @@ traditional_markhtabvs()
     }
   } while (marked_new);
 
-  /* Now, everything's marked that's going to be,  and "pending" is a list
-     of populations and weak hash tables.  CDR down that list and free
-     anything that isn't marked.
+  /* Now, everything's marked that's going to be,  and "pending" and
+     "settled" are lists of populations and weak hash tables.  CDR
+     down those lists and free anything that isn't marked.
      */
 
+  if (pending) {
+    base = ptr_from_lispobj(pending);
+    while (base[1]) {
+      base = ptr_from_lispobj(base[1]);
+    }
+    base[1] = settled;
+  } else {
+    pending = settled;
+  }
+
   while (pending) {
     base = ptr_from_lispobj(pending);
     pending = base[1];
@@ -624,7 +784,9 @@ ncircle_markhtabvs()
       base[1] = pending;
       pending = ptr_to_lispobj(base);
       if ((weak_type & population_type_mask) == population_weak_alist) {
-        mark_weak_alist(this, weak_type);
+        Boolean ignore;
+
+        mark_weak_alist(this, weak_type, &ignore);
       }
     } else if (subtag == subtag_hash_vector) {
       reaphashv(this);
@@ -672,6 +834,72 @@ mark_tcr_tlb(TCR *tcr)
   }
 }
 
+#ifdef SAMPLING_PROFILER
+/* Objects in profiler samples that lisp hasn't read yet are roots. */
+static void
+mark_profile_buffer_samples(profile_buffer *pb)
+{
+  natural i, j, n;
+  LispObj *rec;
+
+  for (; pb; pb = pb->next) {
+    for (i = pb->tail; i != pb->head; i++) {
+      rec = pb->records + ((i % pb->capacity) * PROFILE_RECORD_WORDS);
+      n = unbox_fixnum(rec[0]);
+      for (j = 0; j < n; j++) {
+        mark_root(rec[2+j]);
+      }
+    }
+  }
+}
+
+void
+mark_profile_samples()
+{
+  mark_profile_buffer_samples(profile_buffers);
+  mark_profile_buffer_samples(alloc_profile_buffers);
+}
+
+static void
+forward_profile_buffer_samples(profile_buffer *pb)
+{
+  natural i, j, n;
+  LispObj *rec;
+
+  for (; pb; pb = pb->next) {
+    for (i = pb->tail; i != pb->head; i++) {
+      rec = pb->records + ((i % pb->capacity) * PROFILE_RECORD_WORDS);
+      n = unbox_fixnum(rec[0]);
+      for (j = 0; j < n; j++) {
+        update_noderef(rec+2+j);
+      }
+    }
+  }
+}
+
+void
+forward_profile_samples()
+{
+  forward_profile_buffer_samples(profile_buffers);
+  forward_profile_buffer_samples(alloc_profile_buffers);
+}
+
+/* For things like purify that move functions without forwarding
+   everything that references them. */
+void
+discard_profile_samples()
+{
+  profile_buffer *pb;
+
+  for (pb = profile_buffers; pb; pb = pb->next) {
+    pb->tail = pb->head;
+  }
+  for (pb = alloc_profile_buffers; pb; pb = pb->next) {
+    pb->tail = pb->head;
+  }
+}
+#endif
+
 /*
   Mark things that're only reachable through some (suspended) TCR.
   (This basically means the tcr's gc_context and the exception
@@ -751,6 +979,7 @@ freeGCptrs()
         destroy_recursive_lock((RECURSIVE_LOCK)addr);
         break;
       case xmacptr_flag_ptr:
+      case xmacptr_flag_wait_queue:
         free(addr);
         break;
       case xmacptr_flag_none:   /* ?? */
@@ -900,6 +1129,101 @@ install_weak_mark_functions(natural set) {
   }
 }
 
+#ifdef PARALLEL_GC
+/*
+  A small pool of threads that help out with the parts of a full GC
+  that can be done in parallel.  The threads are created when the
+  GC thread count is set (never during a GC, when other threads are
+  suspended and might own locks that pthread_create() needs), and
+  spend the rest of their lives waiting on their semaphores.  They
+  don't have TCRs and never run lisp code.
+*/
+
+natural GCthreads = 1;          /* including the thread that does the GC */
+
+typedef struct {
+  void *wakeup;
+  natural index;
+} gc_worker;
+
+static gc_worker gc_workers[MAX_GC_THREADS];
+static natural gc_nworkers = 1;
+static void *gc_workers_done = NULL;
+static gc_parallel_fun gc_parallel_task;
+static void *gc_parallel_arg;
+static natural gc_parallel_nthreads;
+
+static void *
+gc_worker_loop(void *param)
+{
+  gc_worker *w = (gc_worker *)param;
+  sigset_t mask;
+
+  /* Signals are lisp threads' business. */
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  while (1) {
+    SEM_WAIT_FOREVER(w->wakeup);
+    gc_parallel_task(w->index, gc_parallel_nthreads, gc_parallel_arg);
+    SEM_RAISE(gc_workers_done);
+  }
+  return NULL;
+}
+
+/* Try to make N threads available to the GC; return the number that are. */
+natural
+gc_start_workers(natural n)
+{
+  if (n == 0) {
+    n = 1;
+  }
+  if (n > MAX_GC_THREADS) {
+    n = MAX_GC_THREADS;
+  }
+  if ((n > gc_nworkers) && (gc_workers_done == NULL)) {
+    gc_workers_done = new_semaphore(0);
+  }
+  while (gc_nworkers < n) {
+    gc_worker *w = &gc_workers[gc_nworkers];
+
+    w->index = gc_nworkers;
+    w->wakeup = new_semaphore(0);
+    if (!create_system_thread(MIN_CSTACK_SIZE, NULL, gc_worker_loop, w)) {
+      destroy_semaphore(&w->wakeup);
+      break;
+    }
+    gc_nworkers++;
+  }
+  GCthreads = (n < gc_nworkers) ? n : gc_nworkers;
+  return GCthreads;
+}
+
+/*
+  Call FUN in GCthreads threads (the calling thread is worker 0) and
+  wait for all of them to return.
+*/
+void
+gc_run_parallel(gc_parallel_fun fun, void *arg)
+{
+  natural i, n = GCthreads;
+
+  if (n > gc_nworkers) {
+    n = gc_nworkers;
+  }
+  gc_parallel_task = fun;
+  gc_parallel_arg = arg;
+  gc_parallel_nthreads = n;
+  for (i = 1; i < n; i++) {
+    SEM_RAISE(gc_workers[i].wakeup);
+  }
+  fun(0, n, arg);
+  for (i = 1; i < n; i++) {
+    SEM_WAIT_FOREVER(gc_workers_done);
+  }
+}
+#endif
+
 void
 init_weakvll ()
 {
@@ -1029,6 +1353,15 @@ node_forwarding_address(LispObj node)
 
   if ((dnode >= GCndynamic_dnodes_in_area) ||
       (node < GCfirstunmarked)) {
+#ifdef LARGE_OBJECT_SPACE
+    if (GCevacuating_large_objects && large_object_address_p(node)) {
+      LispObj copy = large_object_copy_address(node);
+
+      if (copy) {
+        return node_forwarding_address(copy);
+      }
+    }
+#endif
     return node;
   }
 
@@ -1099,13 +1432,19 @@ typedef struct {
   bitvector refp;
   natural idx;
   bitvector idxbase;
+#ifdef BYTE_REFIDX
+  natural ncards;
+#endif
 } bitidx_state;
 
 natural *
 next_refbits(bitidx_state *s)
 {
   bitvector p, limit;
-  natural idxbit, idx;
+  natural idx;
+#ifndef BYTE_REFIDX
+  natural idxbit;
+#endif
 
   while (1) {
     p = s->refp;
@@ -1120,6 +1459,27 @@ next_refbits(bitidx_state *s)
     if (!s->refidx) {
       return NULL;
     }
+#ifdef BYTE_REFIDX
+    /* If nothing's left in the card that we just finished (and all of
+       it was in range), the card's clean.  s->idx is the index of the
+       next card to look at. */
+    if ((limit == s->idxbase + (256/WORD_SIZE)) && (s->idx != 0)) {
+      for (p = s->idxbase; p < limit; p++) {
+        if (*p) {
+          break;
+        }
+      }
+      if (p == limit) {
+        ((unsigned char *)(s->refidx))[s->idx-1] = 0;
+      }
+    }
+    idx = next_dirty_card((unsigned char *)(s->refidx), s->idx, s->ncards);
+    if (idx == s->ncards) {
+      return NULL;
+    }
+    s->idx = idx+1;
+    p = s->idxbase = s->refbits + (idx * (256/WORD_SIZE));
+#else
     idx = s->idx;
     while (idx == 0) {
       if (s->idxp == s->idxlimit) {
@@ -1135,6 +1495,7 @@ next_refbits(bitidx_state *s)
     idxbit = count_leading_zeros(idx);
     s->idx &= ~(BIT0_MASK>>idxbit);
     p = s->idxbase + (idxbit * (256/WORD_SIZE));
+#endif
     s->refp = p;
     s->rangelimit = p + (256/WORD_SIZE);
     if (s->reflimit < s->rangelimit) {
@@ -1159,6 +1520,9 @@ init_bitidx_state(bitidx_state *s, bitvector refidx, bitvector refbits, natural
   s->idxlimit = refidx + ((((ndnodes + 255) >> 8) + (WORD_SIZE-1)) >> bitmap_shift);
     s->rangelimit = s->idxbase = NULL;
   }
+#ifdef BYTE_REFIDX
+  s->ncards = (ndnodes + 255) >> 8;
+#endif
 }
 
 
@@ -1337,6 +1701,258 @@ Boolean just_purified_p = false;
 
 #define get_time(when) gettimeofday(&when, NULL)
 
+gc_event_log gc_events = {
+  .nevents = GC_EVENT_LOG_SIZE,
+  .nphases = gc_nphases,
+  .event_size = sizeof(gc_event),
+  .next = 0
+};
+
+static gc_event GCevent;        /* the one that gc() is filling in */
+static u64_t GCphase_start = 0, GCsuspend_ns = 0;
+static u64_t GCsafepoint_threads = 0, GCsignalled_threads = 0, GCsafepoint_timeouts = 0;
+static gc_event *GCunresumed_event = NULL;
+
+u64_t
+gc_timestamp_ns()
+{
+#if defined(CLOCK_MONOTONIC) && !defined(WINDOWS)
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((u64_t)ts.tv_sec * 1000000000ULL) + (u64_t)ts.tv_nsec;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return ((u64_t)tv.tv_sec * 1000000000ULL) + ((u64_t)tv.tv_usec * 1000ULL);
+#endif
+}
+
+/* Charge the time since the last phase ended to PHASE. */
+static void
+gc_phase_done(gc_phase phase)
+{
+  u64_t now = gc_timestamp_ns();
+
+  GCevent.phase_ns[phase] += now - GCphase_start;
+  GCphase_start = now;
+}
+
+/* Called with the time that it took to suspend other threads before
+   a GC. */
+void
+gc_event_note_suspend(u64_t ns)
+{
+  GCsuspend_ns = ns;
+}
+
+/* Called when other threads were suspended using safepoints (see
+   suspend_other_threads()), with the number of threads that stopped at
+   a safepoint, the number that had to be signalled, and how many of
+   those were running lisp code but didn't reach a safepoint in time. */
+void
+gc_event_note_safepoints(natural safepoint, natural signalled, natural timeouts)
+{
+  GCsafepoint_threads = safepoint;
+  GCsignalled_threads = signalled;
+  GCsafepoint_timeouts = timeouts;
+}
+
+/* Called after other threads are resumed; if a GC was logged while
+   they were suspended, note how long resuming them took.  The event's
+   already been published, so make its seq odd again while changing it,
+   just as gc_event_publish() does. */
+void
+gc_event_note_resume(u64_t ns)
+{
+  gc_event *e = GCunresumed_event;
+  u64_t seq;
+
+  if (e) {
+    GCunresumed_event = NULL;
+    seq = e->seq;
+    e->seq = seq-1;
+    __sync_synchronize();
+    e->resume_ns = ns;
+    __sync_synchronize();
+    e->seq = seq;
+  }
+}
+
+static void
+gc_event_publish()
+{
+  u64_t n = gc_events.next, ns;
+  gc_event *e = &gc_events.events[n & (GC_EVENT_LOG_SIZE-1)];
+  int i, bucket;
+
+  e->seq = (2*n)+1;
+  __sync_synchronize();
+  GCevent.seq = e->seq;
+  *e = GCevent;
+  __sync_synchronize();
+  e->seq = 2*(n+1);
+  gc_events.next = n+1;
+  GCunresumed_event = e;
+
+  for (i = 0; i < gc_nphases; i++) {
+    ns = GCevent.phase_ns[i];
+    for (bucket = 0; (ns >>= 1) != 0; bucket++);
+    gc_events.histogram[i][bucket]++;
+  }
+}
+
+/*
+  Adaptive EGC thresholds.  Pause times and survival rates of each
+  ephemeral generation are kept as decaying averages.  An EGC's pause
+  is roughly proportional to how much survives it, which (for a given
+  survival rate) is roughly proportional to the generation's threshold,
+  so after an EGC of generation g, g's threshold is scaled by about
+  target/pause.  If the EGC's share of elapsed time exceeds
+  egc_time_percent, the nursery grows so that EGCs happen less often
+  (as far as the pause target allows.)  An intermediate generation
+  that's mostly surviving holds long-lived data, so it shrinks in
+  order to promote that data sooner.
+*/
+u64_t egc_pause_target_ns = 0;
+natural egc_time_percent = 0;
+
+#define EGC_SCALE_ONE 1024
+#define EGC_MIN_THRESHOLD ((natural)256<<10)
+#if WORD_SIZE == 64
+#define EGC_MAX_THRESHOLD ((natural)1<<30)
+#else
+#define EGC_MAX_THRESHOLD ((natural)256<<20)
+#endif
+
+static u64_t
+  egc_pause_ns[3] = {0, 0, 0},  /* per generation */
+  egc_survival[3] = {0, 0, 0},  /* in 1/EGC_SCALE_ONE */
+  egc_gc_ns = 0,                /* any EGC */
+  egc_mutator_ns = 0,           /* between the end of a GC and the next EGC */
+  egc_last_end_ns = 0;
+
+#define egc_average(old,new) (((old) == 0) ? (new) : (((3*(old))+(new))>>2))
+
+static natural
+egc_clamp_threshold(u64_t n, natural min, natural max)
+{
+  if (n > max) {
+    n = max;
+  }
+  if (n < min) {
+    n = min;
+  }
+  /* Like CONFIGURE-EGC, use a multiple of 64KB */
+  return align_to_power_of_2(n, 16);
+}
+
+static void
+adapt_egc_thresholds(int generation, natural collected, natural survived, u64_t start_ns, u64_t end_ns)
+{
+  area *a = active_dynamic_area;
+  u64_t 
+    target = egc_pause_target_ns, 
+    pause = end_ns - start_ns,
+    scale = EGC_SCALE_ONE,
+    survival,
+    n;
+  natural g0max;
+
+  if (generation > 2) {
+    egc_last_end_ns = end_ns;
+    return;
+  }
+  if (egc_last_end_ns) {
+    egc_mutator_ns = egc_average(egc_mutator_ns, start_ns - egc_last_end_ns);
+  }
+  egc_last_end_ns = end_ns;
+  egc_gc_ns = egc_average(egc_gc_ns, pause);
+  pause = egc_pause_ns[generation] = egc_average(egc_pause_ns[generation], pause);
+  survival = collected ? (((u64_t)survived*EGC_SCALE_ONE)/collected) : 0;
+  survival = egc_survival[generation] = egc_average(egc_survival[generation], survival);
+
+  if (((target == 0) && (egc_time_percent == 0)) || (a->older == NULL)) {
+    return;
+  }
+  if (pause == 0) {
+    pause = 1;
+  }
+
+  if (target) {
+    if (pause > target) {
+      scale = (target*EGC_SCALE_ONE)/pause;
+      if (scale < EGC_SCALE_ONE/2) {
+        scale = EGC_SCALE_ONE/2;
+      }
+    } else if (pause < (target-(target>>2))) {
+      /* Go halfway toward what should meet the target. */
+      scale = (EGC_SCALE_ONE+((target*EGC_SCALE_ONE)/pause))>>1;
+      if (scale > (EGC_SCALE_ONE+(EGC_SCALE_ONE/2))) {
+        scale = EGC_SCALE_ONE+(EGC_SCALE_ONE/2);
+      }
+    }
+  }
+
+  if (egc_time_percent && (generation == 0) && (scale >= EGC_SCALE_ONE)) {
+    u64_t 
+      spent = (egc_gc_ns*100*EGC_SCALE_ONE)/(egc_gc_ns+egc_mutator_ns+1),
+      goal = egc_time_percent*EGC_SCALE_ONE;
+
+    if (spent > goal) {
+      n = (spent*EGC_SCALE_ONE)/goal;
+      if (n > 2*EGC_SCALE_ONE) {
+        n = 2*EGC_SCALE_ONE;
+      }
+      if (target && (((pause*n)/EGC_SCALE_ONE) > target)) {
+        n = (target*EGC_SCALE_ONE)/pause;
+      }
+      if (n > scale) {
+        scale = n;
+      }
+    }
+  }
+
+  if ((generation != 0) && (survival > ((3*EGC_SCALE_ONE)/4))) {
+    scale = (scale*7)>>3;
+  }
+
+  if (scale == EGC_SCALE_ONE) {
+    return;
+  }
+
+  /* Keep g0 < g1 < g2, and leave room for the nursery in the
+     dynamic area. */
+  g0max = lisp_heap_gc_threshold>>1;
+  if (g0max > (EGC_MAX_THRESHOLD>>2)) {
+    g0max = EGC_MAX_THRESHOLD>>2;
+  }
+  if (g0max < EGC_MIN_THRESHOLD) {
+    g0max = EGC_MIN_THRESHOLD;
+  }
+  switch (generation) {
+  case 0:
+    n = ((u64_t)a->threshold*scale)/EGC_SCALE_ONE;
+    a->threshold = egc_clamp_threshold(n, EGC_MIN_THRESHOLD, g0max);
+    break;
+  case 1:
+    n = ((u64_t)g1_area->threshold*scale)/EGC_SCALE_ONE;
+    g1_area->threshold = egc_clamp_threshold(n, 2*a->threshold, EGC_MAX_THRESHOLD>>1);
+    break;
+  case 2:
+    n = ((u64_t)g2_area->threshold*scale)/EGC_SCALE_ONE;
+    g2_area->threshold = egc_clamp_threshold(n, 2*g1_area->threshold, EGC_MAX_THRESHOLD);
+    break;
+  }
+  if (g1_area->threshold < 2*a->threshold) {
+    g1_area->threshold = 2*a->threshold;
+  }
+  if (g2_area->threshold < 2*g1_area->threshold) {
+    g2_area->threshold = 2*g1_area->threshold;
+  }
+}
+
 
 
 #ifdef FORCE_DWS_MARK
@@ -1360,6 +1976,12 @@ mark_static_ref(LispObj n, BytePtr dynamic_start, natural ndynamic_dnodes)
       mark_root(n);             /* May or may not mark it */
       return true;              /* but return true 'cause it's a dynamic node */
     }
+#ifdef LARGE_OBJECT_SPACE
+    if (large_object_address_p(n)) {
+      mark_large_object(n);
+      return true;
+    }
+#endif
   }
   return false;                 /* Not a heap pointer or not dynamic */
 }
@@ -1569,6 +2191,9 @@ gc(TCR *tcr, signed_natural param)
   TCR *other_tcr;
   natural static_dnodes;
   natural weak_method = lisp_global(WEAK_GC_METHOD) >> fixnumshift;
+  natural large_bytes_freed = 0;
+  BytePtr collected_low;
+  Boolean thread_roots_scanned = false;
 
 #ifndef FORCE_DWS_MARK
   if ((natural) (TCR_AUX(tcr)->cs_limit) == CS_OVERFLOW_FORCE_LIMIT) {
@@ -1581,6 +2206,14 @@ gc(TCR *tcr, signed_natural param)
 #endif
 
   GCephemeral_low = lisp_global(OLDEST_EPHEMERAL);
+#ifdef LARGE_OBJECT_SPACE
+  if (GCevacuating_large_objects && (GCephemeral_low == 0)) {
+    if (!evacuate_large_objects(a)) {
+      Fatal(":   Kernel memory allocation failure.  ", "can't move large objects into the heap");
+    }
+    oldfree = a->active;
+  }
+#endif
   if (GCephemeral_low) {
     GCn_ephemeral_dnodes=area_dnode(oldfree, GCephemeral_low);
   } else {
@@ -1647,6 +2280,17 @@ gc(TCR *tcr, signed_natural param)
 
   get_time(start);
 
+  memset(&GCevent, 0, sizeof(GCevent));
+  GCevent.gc_num = lisp_global(GC_NUM) >> fixnumshift;
+  GCevent.generation = (GCephemeral_low == 0) ? 3 : (from == g2_area) ? 2 : (from == g1_area) ? 1 : 0;
+  GCevent.suspend_ns = GCsuspend_ns;
+  GCevent.safepoint_threads = GCsafepoint_threads;
+  GCevent.signalled_threads = GCsignalled_threads;
+  GCevent.safepoint_timeouts = GCsafepoint_timeouts;
+  GCsuspend_ns = GCsafepoint_threads = GCsignalled_threads = GCsafepoint_timeouts = 0;
+  GCevent.bytes_allocated = area_dnode(oldfree, a->low) << dnode_shift;
+  GCevent.start_ns = GCphase_start = gc_timestamp_ns();
+
   /* The link-inverting marker might need to write to watched areas */
   unprotect_watched_areas();
 
@@ -1666,6 +2310,7 @@ gc(TCR *tcr, signed_natural param)
   if (from) {
     untenure_from_area(from);
   }
+  collected_low = a->low;
   static_dnodes = static_dnodes_for_area(a);
   GCmarkbits = a->markbits;
   GCarealow = ptr_to_lispobj(a->low);
@@ -1680,24 +2325,19 @@ gc(TCR *tcr, signed_natural param)
     zero_bits(GCmarkbits, GCndnodes_in_area);
 
     init_weakvll();
+    gc_phase_done(gc_phase_setup);
 
     if (GCn_ephemeral_dnodes == 0) {
       /* For GCTWA, mark the internal package hash table vector of
        *PACKAGE*, but don't mark its contents. */
       {
         LispObj
-          itab,
-          pkgidx = nrs_PACKAGE.binding_index;
+          itab;
         natural
           dnode, ndnodes;
       
-        if ((pkgidx >= tcr->tlb_limit) ||
-            ((pkg = tcr->tlb_pointer[pkgidx>>fixnumshift]) == 
-             no_thread_local_binding_marker)) {
-          pkg = nrs_PACKAGE.vcell;
-        }
-        if ((fulltag_of(pkg) == fulltag_misc) &&
-            (header_subtag(header_of(pkg)) == subtag_package)) {
+        pkg = current_package(tcr);
+        if (pkg) {
           itab = ((package *)ptr_from_lispobj(untag(pkg)))->itab;
           itabvec = car(itab);
           dnode = gc_area_dnode(itabvec);
@@ -1709,7 +2349,25 @@ gc(TCR *tcr, signed_natural param)
       }
     }
 
+#ifdef PARALLEL_GC
+    if ((GCephemeral_low == 0) && (GCthreads > 1)) {
+      parallel_mark_begin();
+    }
+#endif
+
+#ifdef CONCURRENT_GC
+    if (GCephemeral_low == 0) {
+      concurrent_mark_finish(itabvec);
+    }
+#endif
+
     mark_root(lisp_global(STATIC_CONSES));
+    gc_phase_done(gc_phase_mark_roots);
+
+#ifdef PARALLEL_GC
+    thread_roots_scanned = scan_thread_roots_in_parallel(a, tcr, false);
+    gc_phase_done(gc_phase_mark_stacks);
+#endif
 
     {
       area *next_area;
@@ -1721,14 +2379,19 @@ gc(TCR *tcr, signed_natural param)
         switch (code) {
         case AREA_TSTACK:
           mark_tstack_area(next_area);
+          gc_phase_done(gc_phase_mark_stacks);
           break;
 
         case AREA_VSTACK:
-          mark_vstack_area(next_area);
+          if (!thread_roots_scanned) {
+            mark_vstack_area(next_area);
+            gc_phase_done(gc_phase_mark_stacks);
+          }
           break;
           
         case AREA_CSTACK:
           mark_cstack_area(next_area);
+          gc_phase_done(gc_phase_mark_stacks);
           break;
 
         case AREA_STATIC:
@@ -1741,6 +2404,7 @@ gc(TCR *tcr, signed_natural param)
           if (next_area->younger == NULL) {
             mark_simple_area_range((LispObj *) next_area->low, (LispObj *) next_area->active);
           }
+          gc_phase_done(gc_phase_mark_roots);
           break;
 
         default:
@@ -1755,13 +2419,25 @@ gc(TCR *tcr, signed_natural param)
     } else {
       mark_managed_static_refs(managed_static_area,low_markable_address,area_dnode(a->active,low_markable_address), managed_static_refidx);
     }
-    other_tcr = tcr;
-    do {
-      mark_tcr_xframes(other_tcr);
-      mark_tcr_tlb(other_tcr);
-      other_tcr = TCR_AUX(other_tcr)->next;
-    } while (other_tcr != tcr);
+    gc_phase_done(gc_phase_mark_memoized);
+    if (!thread_roots_scanned) {
+      other_tcr = tcr;
+      do {
+        mark_tcr_xframes(other_tcr);
+        gc_phase_done(gc_phase_mark_stacks);
+        mark_tcr_tlb(other_tcr);
+        gc_phase_done(gc_phase_mark_roots);
+        other_tcr = TCR_AUX(other_tcr)->next;
+      } while (other_tcr != tcr);
+    }
+#ifdef SAMPLING_PROFILER
+    mark_profile_samples();
+#endif
 
+#ifdef PARALLEL_GC
+    parallel_mark_end();
+    gc_phase_done(gc_phase_mark_parallel);
+#endif
 
 
 
@@ -1827,8 +2503,18 @@ gc(TCR *tcr, signed_natural param)
     }
   
     reap_gcable_ptrs();
+#ifdef PERF_JITDUMP
+    reap_jitdump_functions();
+#endif
 
     preforward_weakvll();
+    gc_phase_done(gc_phase_weak);
+
+#ifdef LARGE_OBJECT_SPACE
+    if (GCevacuating_large_objects && (GCephemeral_low == 0)) {
+      mark_evacuated_large_objects();
+    }
+#endif
 
     GCrelocptr = global_reloctab;
     GCfirstunmarked = calculate_relocation();
@@ -1836,15 +2522,29 @@ gc(TCR *tcr, signed_natural param)
     if (!GCephemeral_low) {
       reclaim_static_dnodes();
     }
+    gc_phase_done(gc_phase_relocate);
 
     forward_range((LispObj *) ptr_from_lispobj(GCarealow), (LispObj *) ptr_from_lispobj(GCfirstunmarked));
 
-    other_tcr = tcr;
-    do {
-      forward_tcr_xframes(other_tcr);
-      forward_tcr_tlb(other_tcr);
-      other_tcr = TCR_AUX(other_tcr)->next;
-    } while (other_tcr != tcr);
+#ifdef PARALLEL_GC
+    thread_roots_scanned = scan_thread_roots_in_parallel(a, tcr, true);
+#else
+    thread_roots_scanned = false;
+#endif
+    if (!thread_roots_scanned) {
+      other_tcr = tcr;
+      do {
+        forward_tcr_xframes(other_tcr);
+        forward_tcr_tlb(other_tcr);
+        other_tcr = TCR_AUX(other_tcr)->next;
+      } while (other_tcr != tcr);
+    }
+#ifdef SAMPLING_PROFILER
+    forward_profile_samples();
+#endif
+#ifdef PERF_JITDUMP
+    forward_jitdump_functions();
+#endif
 
   
     forward_gcable_ptrs();
@@ -1864,7 +2564,9 @@ gc(TCR *tcr, signed_natural param)
           break;
 
         case AREA_VSTACK:
-          forward_vstack_area(next_area);
+          if (!thread_roots_scanned) {
+            forward_vstack_area(next_area);
+          }
           break;
 
         case AREA_CSTACK:
@@ -1891,9 +2593,18 @@ gc(TCR *tcr, signed_natural param)
     } else {
       forward_memoized_area(managed_static_area,area_dnode(managed_static_area->active,managed_static_area->low),managed_static_refbits, NULL);
     }
+    gc_phase_done(gc_phase_forward);
     a->active = (BytePtr) ptr_from_lispobj(compact_dynamic_heap());
+    gc_phase_done(gc_phase_compact);
 
     forward_weakvll_links();
+    gc_phase_done(gc_phase_forward);
+
+#ifdef LARGE_OBJECT_SPACE
+    if (GCephemeral_low == 0) {
+      large_bytes_freed = sweep_large_objects();
+    }
+#endif
 
     if (to) {
       tenure_to_area(to);
@@ -1921,6 +2632,12 @@ gc(TCR *tcr, signed_natural param)
         }
       }
     }
+#ifdef CONCURRENT_GC
+    if (GCephemeral_low) {
+      concurrent_mark_start(tcr);
+    }
+#endif
+    gc_phase_done(gc_phase_tenure);
   }
   lisp_global(GC_NUM) += (1<<fixnumshift);
   if (note) {
@@ -1940,6 +2657,20 @@ gc(TCR *tcr, signed_natural param)
   nrs_GC_EVENT_STATUS_BITS.vcell |= gc_postgc_pending;
   get_time(stop);
 
+  GCevent.bytes_freed = (oldfree - a->active) + large_bytes_freed;
+  GCevent.generation_bytes[0] = a->active - a->low;
+  if (a->older) {
+    GCevent.generation_bytes[1] = g1_area->active - g1_area->low;
+    GCevent.generation_bytes[2] = g2_area->active - g2_area->low;
+    GCevent.generation_bytes[3] = tenured_area->active - tenured_area->low;
+  }
+  gc_event_publish();
+  adapt_egc_thresholds(GCevent.generation,
+                       oldfree - collected_low,
+                       a->active - collected_low,
+                       GCevent.start_ns - GCevent.suspend_ns,
+                       gc_timestamp_ns());
+
   {
     lispsymbol * total_gc_microseconds = (lispsymbol *) &(nrs_TOTAL_GC_MICROSECONDS);
     lispsymbol * total_bytes_freed = (lispsymbol *) &(nrs_TOTAL_BYTES_FREED);
@@ -1958,7 +2689,7 @@ gc(TCR *tcr, signed_natural param)
     val = total_bytes_freed->vcell;
     if ((fulltag_of(val) == fulltag_misc) &&
         (header_subtag(header_of(val)) == subtag_macptr)) {
-      long long justfreed = oldfree - a->active;
+      long long justfreed = (oldfree - a->active) + large_bytes_freed;
       *( (long long *) ptr_from_lispobj(((macptr *) ptr_from_lispobj(untag(val)))->address)) += justfreed;
 
 #ifdef USE_DTRACE
@@ -1999,6 +2730,351 @@ gc(TCR *tcr, signed_natural param)
   }
 }
 
+#ifdef LARGE_OBJECT_SPACE
+/*
+  Big ivectors are allocated in the large object area, above the
+  dynamic area, and the GC never moves them.  Each one gets pages of
+  its own, which are committed when it's allocated and given back to
+  the OS when it's freed.  Since ivectors don't reference anything,
+  marking one is just a matter of noting that it's reachable; a full
+  GC frees the ones that weren't.  An EGC treats them all as live.
+
+  Allocation happens with the exception lock held and freeing happens
+  during a GC, so nothing here needs to be synchronized.  (The
+  parallel marker's threads might all set the same "marked" flag, but
+  that's harmless.)  large_objects is sorted by address; it's mapped
+  once, big enough for the most large objects that could fit in the
+  area.
+*/
+
+typedef struct {
+  BytePtr start;                /* page-aligned */
+  natural nbytes;               /* a multiple of the page size */
+  LispObj copy;                 /* when evacuating: where it's been copied */
+  Boolean marked;
+} large_object;
+
+area *large_object_area = NULL;
+natural large_object_bytes_since_gc = 0;
+Boolean GCevacuating_large_objects = false;
+static large_object *large_objects = NULL;
+static natural nlarge_objects = 0;
+
+void
+init_large_object_area(BytePtr low, BytePtr high)
+{
+  natural max_objects = (high-low)/LARGE_OBJECT_THRESHOLD;
+
+  large_objects = MapMemory(NULL,
+                            align_to_power_of_2(max_objects*sizeof(large_object),log2_page_size),
+                            MEMPROTECT_RW);
+  if (large_objects == MAP_FAILED) {
+    large_objects = NULL;
+    high = low;
+  }
+  large_object_area = new_area(low, high, AREA_LARGE_OBJECTS);
+}
+
+/* The large object that contains address x, or NULL */
+static large_object *
+large_object_containing(LispObj x)
+{
+  natural low = 0, high = nlarge_objects, mid;
+  large_object *lo;
+
+  /* Find the first object that starts after x */
+  while (low < high) {
+    mid = (low+high) >> 1;
+    if ((LispObj)(large_objects[mid].start) <= x) {
+      low = mid+1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0) {
+    return NULL;
+  }
+  lo = large_objects+(low-1);
+  if (x < ((LispObj)(lo->start)+lo->nbytes)) {
+    return lo;
+  }
+  return NULL;
+}
+
+/*
+  Return the (untagged) address of nbytes of zeroed memory in the
+  large object area, or NULL if there isn't room.  Takes the first
+  hole that's big enough.
+*/
+BytePtr
+allocate_large_object(natural nbytes)
+{
+  natural i, need = align_to_power_of_2(nbytes, log2_page_size);
+  BytePtr start = large_object_area->low, limit;
+  large_object *lo;
+
+  for (i = 0; ; i++) {
+    if (i == nlarge_objects) {
+      limit = large_object_area->high;
+    } else {
+      limit = large_objects[i].start;
+    }
+    if ((natural)(limit-start) >= need) {
+      break;
+    }
+    if (i == nlarge_objects) {
+      return NULL;
+    }
+    start = large_objects[i].start + large_objects[i].nbytes;
+  }
+  if (!CommitMemory(start, need)) {
+    return NULL;
+  }
+  lo = large_objects+i;
+  memmove(lo+1, lo, (nlarge_objects-i)*sizeof(large_object));
+  nlarge_objects++;
+  lo->start = start;
+  lo->nbytes = need;
+  lo->copy = 0;
+  lo->marked = false;
+  large_object_bytes_since_gc += need;
+  return start;
+}
+
+void
+mark_large_object(LispObj x)
+{
+  large_object *lo;
+
+  if (GCephemeral_low == 0) {
+    lo = large_object_containing(x);
+    if (lo) {
+      lo->marked = true;
+    }
+  }
+}
+
+Boolean
+large_object_marked(LispObj x)
+{
+  large_object *lo;
+
+  if (GCephemeral_low) {
+    return true;
+  }
+  lo = large_object_containing(x);
+  return ((lo == NULL) || lo->marked);
+}
+
+/*
+  Purifying or saving an image has to get rid of the large object
+  area, so the first full GC when that's going to happen copies each
+  large object to the end of the dynamic area.  The GC treats the
+  copies as ordinary (unmarked) ivectors and marks the ones whose
+  originals were marked, so references to the originals are forwarded
+  to wherever the copies get compacted to.  The originals are freed
+  afterwards.
+*/
+Boolean
+evacuate_large_objects(area *a)
+{
+  natural i, nbytes, total = 0, avail = a->high - a->active;
+  large_object *lo;
+  BytePtr dest = a->active;
+
+  for (i = 0, lo = large_objects; i < nlarge_objects; i++, lo++) {
+    total += ((BytePtr)skip_over_ivector((LispObj)(lo->start), *(LispObj *)(lo->start))) - lo->start;
+  }
+  if ((total > avail) && !grow_dynamic_area(total-avail)) {
+    return false;
+  }
+  for (i = 0, lo = large_objects; i < nlarge_objects; i++, lo++) {
+    nbytes = ((BytePtr)skip_over_ivector((LispObj)(lo->start), *(LispObj *)(lo->start))) - lo->start;
+    memcpy(dest, lo->start, nbytes);
+    lo->copy = (LispObj)dest;
+    dest += nbytes;
+  }
+  a->active = dest;
+  if (heap_dirty_limit < dest) {
+    heap_dirty_limit = dest;
+  }
+  return true;
+}
+
+/* Once marking's done, mark the copies of marked large objects */
+void
+mark_evacuated_large_objects()
+{
+  natural i, dnode, nbytes;
+  large_object *lo;
+
+  for (i = 0, lo = large_objects; i < nlarge_objects; i++, lo++) {
+    if (lo->marked) {
+      nbytes = ((BytePtr)skip_over_ivector(lo->copy, header_of(lo->copy))) - ((BytePtr)(lo->copy));
+      dnode = gc_area_dnode(lo->copy);
+      set_n_bits(GCmarkbits, dnode, nbytes >> dnode_shift);
+    }
+  }
+}
+
+/* When evacuating, the address in a live object's copy that
+   corresponds to x, else 0 */
+LispObj
+large_object_copy_address(LispObj x)
+{
+  large_object *lo = large_object_containing(x);
+
+  if (lo && lo->marked && lo->copy) {
+    return lo->copy + (x - (LispObj)(lo->start));
+  }
+  return 0;
+}
+
+/*
+  After a full GC: free the large objects that weren't marked (or all
+  of them, if they've been evacuated) and clear the survivors' marks.
+  Returns the number of bytes freed by the former.
+*/
+natural
+sweep_large_objects()
+{
+  natural i, j, freed = 0;
+  large_object *lo;
+
+  for (i = j = 0, lo = large_objects; i < nlarge_objects; i++, lo++) {
+    if (GCevacuating_large_objects) {
+      UnCommitMemory(lo->start, lo->nbytes);
+    } else if (lo->marked) {
+      lo->marked = false;
+      large_objects[j++] = *lo;
+    } else {
+      UnCommitMemory(lo->start, lo->nbytes);
+      freed += lo->nbytes;
+    }
+  }
+  nlarge_objects = j;
+  large_object_bytes_since_gc = 0;
+  GCevacuating_large_objects = false;
+  return freed;
+}
+#endif
+
+/*
+  Threads can claim heap segments without holding the exception lock
+  (see claim_heap_segment() below.)  Code that changes the dynamic
+  area's active or high pointers while other threads are running has
+  to keep those claims out by bracketing the change with
+  inhibit_heap_claims() and allow_heap_claims().  (The GC doesn't
+  need to: a thread claiming a segment has all signals blocked, so it
+  can't be suspended until it's done.)
+
+  heap_claims is twice the number of claims in progress, plus 1 while
+  claims are inhibited.  heap_claims_inhibit_depth is only touched by
+  the thread that owns the exception lock.
+*/
+
+extern natural
+store_conditional(natural*, natural, natural);
+
+extern signed_natural
+atomic_incf_by(signed_natural *, signed_natural);
+
+signed_natural heap_claims = 0;
+static natural heap_claims_inhibit_depth = 0;
+
+#ifdef BACKGROUND_ZEROING
+/* The low end of the chunk that the heap zeroer is clearing, if any. */
+static natural heap_zeroing_low = ~(natural)0;
+#endif
+
+void
+inhibit_heap_claims()
+{
+  if (heap_claims_inhibit_depth++ == 0) {
+    atomic_incf_by(&heap_claims, 1);
+    while (*((volatile signed_natural *)&heap_claims) != 1) {
+      /* wait for claims in progress to finish */
+    }
+  }
+}
+
+void
+allow_heap_claims()
+{
+  if (--heap_claims_inhibit_depth == 0) {
+    atomic_incf_by(&heap_claims, -1);
+  }
+}
+
+/*
+  Try to atomically advance the dynamic area's active pointer far
+  enough to allocate an object of size "need" in a segment of the
+  thread's allocation quantum.  Fails (without changing anything) if
+  the area doesn't have room.
+*/
+static Boolean
+bump_heap_active(area *a, natural need, natural log2_allocation_quantum,
+                 natural *oldlimitp, natural *newlimitp)
+{
+  natural oldlimit, newlimit;
+
+  do {
+    oldlimit = (natural) a->active;
+    newlimit = (align_to_power_of_2(oldlimit, log2_allocation_quantum) +
+                align_to_power_of_2(need, log2_allocation_quantum));
+    if (newlimit > (natural) (a->high)) {
+      return false;
+    }
+  } while (store_conditional((natural *)&(a->active), oldlimit, newlimit) != oldlimit);
+  *oldlimitp = oldlimit;
+  *newlimitp = newlimit;
+  return true;
+}
+
+/*
+  Hand [oldlimit,newlimit) to the thread, zeroing any part of it
+  that's been used since the last time that the heap was cleared.
+  Other threads may be doing the same thing with adjacent segments,
+  so heap_dirty_limit can only be raised atomically.  If the heap
+  zeroer is clearing a chunk that overlaps the segment, wait until
+  it's done and has lowered heap_dirty_limit.
+*/
+static void
+use_heap_segment(ExceptionInformation *xp, TCR *tcr, natural oldlimit, natural newlimit)
+{
+  natural dirty_limit;
+
+  platform_new_heap_segment(xp, tcr, (BytePtr)oldlimit, (BytePtr)newlimit);
+#ifdef BACKGROUND_ZEROING
+  {
+    int spins = 0;
+
+    while (newlimit > *((volatile natural *)&heap_zeroing_low)) {
+      /* wait for the zeroer to finish its chunk */
+      if (++spins < 1000) {
+        SPIN_WAIT();
+      } else {
+        sched_yield();
+      }
+    }
+  }
+#endif
+  dirty_limit = (natural) heap_dirty_limit;
+  if (oldlimit < dirty_limit) {
+    if (newlimit < dirty_limit) {
+      zero_dnodes((void *)oldlimit,area_dnode(newlimit,oldlimit)); 
+    } else {
+      zero_dnodes((void *)oldlimit,area_dnode(dirty_limit,oldlimit));
+    }
+  }
+  while (newlimit > dirty_limit) {
+    if (store_conditional((natural *)&heap_dirty_limit, dirty_limit, newlimit) == dirty_limit) {
+      break;
+    }
+    dirty_limit = (natural) heap_dirty_limit;
+  }
+}
+
 /*
   This doesn't GC; it returns true if it made enough room, false
   otherwise.
@@ -2018,38 +3094,34 @@ new_heap_segment(ExceptionInformation *xp, natural need, Boolean extend, TCR *tc
   }
 
   a  = active_dynamic_area;
-  oldlimit = (natural) a->active;
-  newlimit = (align_to_power_of_2(oldlimit, log2_allocation_quantum) +
-	      align_to_power_of_2(need, log2_allocation_quantum));
-  if (newlimit > (natural) (a->high)) {
+  if (!bump_heap_active(a, need, log2_allocation_quantum, &oldlimit, &newlimit)) {
     if (extend) {
       signed_natural inhibit = (signed_natural)(lisp_global(GC_INHIBIT_COUNT));
       natural extend_by = inhibit ? 0 : lisp_heap_gc_threshold;
-      do {
-        if (resize_dynamic_heap(a->active, (newlimit-oldlimit)+extend_by)) {
-          break;
-        }
-        extend_by = align_to_power_of_2(extend_by>>1,log2_allocation_quantum);
-        if (extend_by < 4<<20) {
-          return false;
-        }
-      } while (1);
+
+      inhibit_heap_claims();
+      oldlimit = (natural) a->active;
+      newlimit = (align_to_power_of_2(oldlimit, log2_allocation_quantum) +
+                  align_to_power_of_2(need, log2_allocation_quantum));
+      if (newlimit > (natural) (a->high)) {
+        do {
+          if (resize_dynamic_heap(a->active, (newlimit-oldlimit)+extend_by)) {
+            break;
+          }
+          extend_by = align_to_power_of_2(extend_by>>1,log2_allocation_quantum);
+          if (extend_by < 4<<20) {
+            allow_heap_claims();
+            return false;
+          }
+        } while (1);
+      }
+      a->active = (BytePtr) newlimit;
+      allow_heap_claims();
     } else {
       return false;
     }
   }
-  a->active = (BytePtr) newlimit;
-  platform_new_heap_segment(xp, tcr, (BytePtr)oldlimit, (BytePtr)newlimit);
-  if ((BytePtr)oldlimit < heap_dirty_limit) {
-    if ((BytePtr)newlimit < heap_dirty_limit) {
-      zero_dnodes((void *)oldlimit,area_dnode(newlimit,oldlimit)); 
-    } else {
-      zero_dnodes((void *)oldlimit,area_dnode(heap_dirty_limit,oldlimit));
-    }
-  }
-  if ((BytePtr)newlimit > heap_dirty_limit) {
-    heap_dirty_limit = (BytePtr)newlimit;       
-  }
+  use_heap_segment(xp, tcr, oldlimit, newlimit);
 
   if (crossed_threshold && (!extend)) {
     if (((a->high - (BytePtr)newlimit) < lisp_heap_notify_threshold)&&
@@ -2061,3 +3133,233 @@ new_heap_segment(ExceptionInformation *xp, natural need, Boolean extend, TCR *tc
 
   return true;
 }
+
+/*
+  Like new_heap_segment() without "extend", but callable without
+  holding the exception lock.  Returns false if segments can't be
+  claimed right now, if there isn't room, or if the claim might
+  cross the GC notification threshold when "notify" is true; the
+  caller should take the usual (locked) path in that case.
+*/
+Boolean
+claim_heap_segment(ExceptionInformation *xp, natural need, TCR *tcr, Boolean notify)
+{
+  area *a = active_dynamic_area;
+  natural newlimit, oldlimit,
+    log2_allocation_quantum = TCR_AUX(tcr)->log2_allocation_quantum;
+  Boolean claimed = false;
+
+  if (atomic_incf_by(&heap_claims, 2) & 1) {
+    atomic_incf_by(&heap_claims, -2);
+    return false;
+  }
+  if ((!notify) ||
+      ((natural)(a->high - a->active) >=
+       (lisp_heap_notify_threshold +
+        align_to_power_of_2(need, log2_allocation_quantum) +
+        (1L<<log2_allocation_quantum)))) {
+    if (bump_heap_active(a, need, log2_allocation_quantum, &oldlimit, &newlimit)) {
+      use_heap_segment(xp, tcr, oldlimit, newlimit);
+      claimed = true;
+    }
+  }
+  atomic_incf_by(&heap_claims, -2);
+  return claimed;
+}
+
+#ifdef BACKGROUND_ZEROING
+/*
+  After a GC, the free part of the heap between a->active and
+  heap_dirty_limit is full of garbage, and use_heap_segment() has to
+  zero each segment in it before handing it out; that's a lot of
+  work for the threads that allocate right after a GC.  When it's
+  enabled, the heap zeroer (a thread that never runs lisp code)
+  clears that region from the top down while those threads run,
+  lowering heap_dirty_limit as it goes, then makes sure that the
+  next few megabytes above heap_dirty_limit are resident, so that
+  the segments claimed after that don't take page faults.
+
+  The zeroer works a chunk at a time, as if each chunk was a heap
+  claim, so inhibit_heap_claims() keeps it out.  It announces the
+  chunk in heap_zeroing_low before checking a->active, and a thread
+  that's bumped a->active into the chunk waits (in use_heap_segment())
+  until it's done; since both sides write before reading, one of
+  them always sees the other.  gc_like_from_xp() pauses the zeroer
+  before changing the heap and resumes it afterwards.
+*/
+
+#define HEAP_ZEROING_CHUNK (1L<<20)
+#define HEAP_PREFAULT_BYTES (32L<<20)
+
+static struct {
+  void *wakeup;                 /* raised to start a pass */
+  void *parked;                 /* raised when a pass ends */
+  Boolean enabled;
+  Boolean running;              /* a pass was started and not waited for */
+  volatile Boolean stop;
+} HZ;
+
+static Boolean
+heap_zeroer_enter()
+{
+  while (!HZ.stop) {
+    if ((atomic_incf_by(&heap_claims, 2) & 1) == 0) {
+      return true;
+    }
+    atomic_incf_by(&heap_claims, -2);
+    sched_yield();
+  }
+  return false;
+}
+
+static void
+heap_zeroer_exit()
+{
+  atomic_incf_by(&heap_claims, -2);
+}
+
+/*
+  Zero the chunk just below heap_dirty_limit and lower the limit, unless
+  a thread has claimed (or is about to claim) part of it.  Returns false
+  if there's nothing left to do.
+*/
+static Boolean
+zero_heap_chunk(area *a)
+{
+  natural high = (natural)heap_dirty_limit, low;
+
+  if (high < ((natural)(a->active) + HEAP_ZEROING_CHUNK)) {
+    return false;
+  }
+  low = high - HEAP_ZEROING_CHUNK;
+  heap_zeroing_low = low;
+  __sync_synchronize();
+  if ((natural)(*((BytePtr volatile *)&(a->active))) > low) {
+    heap_zeroing_low = ~(natural)0;
+    return false;
+  }
+  zero_dnodes((void *)low, area_dnode(high, low));
+  *((BytePtr volatile *)&heap_dirty_limit) = (BytePtr)low;
+  __sync_synchronize();
+  heap_zeroing_low = ~(natural)0;
+  return true;
+}
+
+/*
+  Make the (clean) pages in [low,high) resident without changing their
+  contents: other threads may already be allocating there.
+*/
+static void
+prefault_heap_pages(natural low, natural high)
+{
+#ifdef MADV_POPULATE_WRITE
+  if (madvise((void *)low, high-low, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+#endif
+  for (; low < high; low += page_size) {
+    atomic_incf_by((signed_natural *)low, 0);
+  }
+}
+
+static void
+heap_zeroer_run()
+{
+  area *a = active_dynamic_area;
+  natural low = 0, high = 0, limit = 0;
+  Boolean more;
+
+  do {
+    if (!heap_zeroer_enter()) {
+      return;
+    }
+    more = zero_heap_chunk(a);
+    heap_zeroer_exit();
+  } while (more);
+
+  while (heap_zeroer_enter()) {
+    if (limit == 0) {
+      low = align_to_power_of_2((natural)heap_dirty_limit, log2_page_size);
+      limit = low + HEAP_PREFAULT_BYTES;
+    }
+    if (limit > (natural)(a->high)) {
+      limit = (natural)(a->high);
+    }
+    high = low + HEAP_ZEROING_CHUNK;
+    if (high > limit) {
+      high = limit;
+    }
+    if (low < high) {
+      prefault_heap_pages(low, high);
+    }
+    heap_zeroer_exit();
+    if (high >= limit) {
+      break;
+    }
+    low = high;
+  }
+}
+
+static void *
+heap_zeroer_loop(void *param)
+{
+  sigset_t mask;
+
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  while (1) {
+    SEM_WAIT_FOREVER(HZ.wakeup);
+    heap_zeroer_run();
+    SEM_RAISE(HZ.parked);
+  }
+  return NULL;
+}
+
+/* Called by the thread that's about to do a GC or something like one */
+void
+heap_zeroer_pause()
+{
+  if (HZ.running) {
+    HZ.stop = true;
+    SEM_WAIT_FOREVER(HZ.parked);
+    HZ.running = false;
+  }
+}
+
+void
+heap_zeroer_resume()
+{
+  if (HZ.enabled && !HZ.running) {
+    HZ.stop = false;
+    HZ.running = true;
+    SEM_RAISE(HZ.wakeup);
+  }
+}
+
+/*
+  Enable background zeroing if ENABLE is positive, disable it if it's
+  0.  Return true if it's enabled.  This creates a thread, so it
+  mustn't be called during a GC.
+*/
+Boolean
+heap_zeroer_control(int enable)
+{
+  if ((enable > 0) && !HZ.enabled) {
+    if (HZ.wakeup == NULL) {
+      HZ.wakeup = new_semaphore(0);
+      HZ.parked = new_semaphore(0);
+      if (!create_system_thread(MIN_CSTACK_SIZE, NULL, heap_zeroer_loop, NULL)) {
+        destroy_semaphore(&HZ.wakeup);
+        destroy_semaphore(&HZ.parked);
+        return false;
+      }
+    }
+    HZ.enabled = true;
+    heap_zeroer_resume();
+  } else if (enable == 0) {
+    HZ.enabled = false;
+  }
+  return HZ.enabled;
+}
+#endif
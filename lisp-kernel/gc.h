@@ -86,6 +86,9 @@ void delete_protected_area(protected_area_ptr);
 Boolean egc_control(Boolean, BytePtr);
 Boolean free_segments_zero_filled_by_OS;
 Boolean new_heap_segment(ExceptionInformation *, natural, Boolean , TCR *, Boolean *);
+Boolean claim_heap_segment(ExceptionInformation *, natural, TCR *, Boolean);
+void inhibit_heap_claims(void);
+void allow_heap_claims(void);
 void platform_new_heap_segment(ExceptionInformation *, TCR*, BytePtr, BytePtr);
 /* an type representing 1/4 of a natural word */
 #if WORD_SIZE == 64
@@ -141,6 +144,7 @@ void report_paging_info_delta(FILE*, paging_info *, paging_info *);
 #define GC_TRAP_FUNCTION_IMPURIFY 2
 #define GC_TRAP_FUNCTION_FLASH_FREEZE 4
 #define GC_TRAP_FUNCTION_SAVE_APPLICATION 8
+#define GC_TRAP_FUNCTION_SAVE_COMPRESSED 4 /* only with SAVE_APPLICATION */
 
 #define GC_TRAP_FUNCTION_GET_LISP_HEAP_THRESHOLD 16
 #define GC_TRAP_FUNCTION_SET_LISP_HEAP_THRESHOLD 17
@@ -149,6 +153,12 @@ void report_paging_info_delta(FILE*, paging_info *, paging_info *);
 #define GC_TRAP_FUNCTION_GET_GC_NOTIFICATION_THRESHOLD 20
 #define GC_TRAP_FUNCTION_SET_GC_NOTIFICATION_THRESHOLD 21
 #define GC_TRAP_FUNCTION_ALLOCATION_CONTROL 22
+#define GC_TRAP_FUNCTION_GC_THREADS 23
+#define GC_TRAP_FUNCTION_CONCURRENT_GC 24
+#define GC_TRAP_FUNCTION_EGC_PAUSE_TARGET 25
+#define GC_TRAP_FUNCTION_EGC_TIME_GOAL 26
+#define GC_TRAP_FUNCTION_BACKGROUND_ZEROING 27
+#define GC_TRAP_FUNCTION_SNAPSHOT 28
 #define GC_TRAP_FUNCTION_EGC_CONTROL 32
 #define GC_TRAP_FUNCTION_CONFIGURE_EGC 64
 #define GC_TRAP_FUNCTION_FREEZE 129
@@ -174,8 +184,8 @@ const unsigned char _one_bits[256];
 natural static_dnodes_for_area(area *a);
 void reapweakv(LispObj weakv);
 void reaphashv(LispObj hashv);
-Boolean mark_weak_hash_vector(hash_table_vector_header *hashp, natural elements);
-Boolean mark_weak_alist(LispObj weak_alist, int weak_type);
+Boolean mark_weak_hash_vector(hash_table_vector_header *hashp, natural elements, Boolean *pendingp);
+Boolean mark_weak_alist(LispObj weak_alist, int weak_type, Boolean *pendingp);
 void mark_tcr_tlb(TCR *);
 void mark_tcr_xframes(TCR *);
 void freeGCptrs(void);
@@ -239,6 +249,7 @@ typedef enum {
   xmacptr_flag_ptr,             /* malloc/free */
   xmacptr_flag_rwlock,          /* read/write lock */
   xmacptr_flag_semaphore,        /* semaphore */
+  xmacptr_flag_wait_queue,      /* wait queue; malloc/free */
   xmacptr_flag_user_first = 8,  /* first user-defined dispose fn */
   xmacptr_flag_user_last = 16   /* exclusive upper bound */
 } xmacptr_flag;
@@ -256,5 +267,191 @@ did_gc_notification_since_last_full_gc;
 extern BytePtr heap_dirty_limit;
 extern void zero_dnodes(void *,natural);
 
+#if defined(X8664) && !defined(WINDOWS)
+#define PARALLEL_GC 1
+#endif
+
+#ifdef PARALLEL_GC
+#define MAX_GC_THREADS 64
+
+/* (worker index, number of workers, arg) */
+typedef void (*gc_parallel_fun)(natural, natural, void *);
+
+extern natural GCthreads;
+extern Boolean GCdefer_marking;
+natural gc_start_workers(natural);
+void gc_run_parallel(gc_parallel_fun, void *);
+void defer_mark(LispObj);
+void defer_rip_check(LispObj);
+void parallel_mark_begin(void);
+void parallel_mark_end(void);
+Boolean scan_thread_roots_in_parallel(area *, TCR *, Boolean);
+#endif
+
+#if defined(PARALLEL_GC) && defined(LINUX)
+#define CONCURRENT_GC 1
+#endif
+
+#ifdef CONCURRENT_GC
+extern Boolean GCconcurrent_discard;
+Boolean concurrent_mark_control(int);
+void concurrent_mark_start(TCR *);
+void concurrent_mark_finish(LispObj);
+void concurrent_mark_abandon(void);
+#endif
+
+#ifdef PARALLEL_GC
+#define BACKGROUND_ZEROING 1
+#endif
+
+#ifdef BACKGROUND_ZEROING
+Boolean heap_zeroer_control(int);
+void heap_zeroer_pause(void);
+void heap_zeroer_resume(void);
+#endif
+
+#if defined(X8664) && !defined(WINDOWS)
+#define LARGE_OBJECT_SPACE 1
+#endif
+
+#ifdef LARGE_OBJECT_SPACE
+/* ivectors at least this big (including the header) are allocated
+   in the large object space */
+#define LARGE_OBJECT_THRESHOLD (1<<20)
+
+extern area *large_object_area;
+extern natural large_object_bytes_since_gc;
+extern Boolean GCevacuating_large_objects;
+
+#define large_object_address_p(x) \
+  (((BytePtr)(x) >= large_object_area->low) && \
+   ((BytePtr)(x) < large_object_area->high))
+
+/* Mark x if it's a large object and a full GC's marking */
+#define note_large_object_ref(x) do { \
+    if (large_object_address_p(x)) { \
+      mark_large_object(x); \
+    } \
+  } while(0)
+
+#define large_object_unmarked(x) \
+  (large_object_address_p(x) && !large_object_marked(x))
+
+void init_large_object_area(BytePtr, BytePtr);
+BytePtr allocate_large_object(natural);
+void mark_large_object(LispObj);
+Boolean large_object_marked(LispObj);
+LispObj large_object_copy_address(LispObj);
+Boolean evacuate_large_objects(area *);
+void mark_evacuated_large_objects(void);
+natural sweep_large_objects(void);
+#else
+#define note_large_object_ref(x)
+#define large_object_unmarked(x) false
+#endif
+
+#ifdef X8664
+#define BYTE_REFIDX 1
+#endif
+
+/* Each element of a refidx vector says whether any refbits in the
+   corresponding 256 dnodes might be set.  With BYTE_REFIDX, elements
+   are bytes (which the write barrier can set with a plain store);
+   otherwise, they're bits. */
+#ifdef BYTE_REFIDX
+#define refidx_bytes(ndnodes) (((ndnodes)+255)>>8)
+#define set_refidx(refidx,i) (((unsigned char *)(refidx))[i] = 1)
+#define atomic_set_refidx(refidx,i) set_refidx(refidx,i)
+#define ref_refidx(refidx,i) (((unsigned char *)(refidx))[i] != 0)
+natural next_dirty_card(unsigned char *, natural, natural);
+#else
+#define refidx_bytes(ndnodes) (((((ndnodes)+255)>>8)+7)>>3)
+#define set_refidx(refidx,i) set_bit(refidx,i)
+#define atomic_set_refidx(refidx,i) atomic_set_bit(refidx,i)
+#define ref_refidx(refidx,i) ref_bit(refidx,i)
+#endif
+
+/*
+  A record of the last GC_EVENT_LOG_SIZE GCs, which lisp code can read
+  while other threads are running.  The GC is the only writer: an event's
+  seq is odd while it's being (re)written and 2*(its index+1) when it's
+  complete, so a reader that sees the same even value before and after
+  copying an event has a consistent copy.
+*/
+typedef enum {
+  gc_phase_setup,               /* untenuring, clearing markbits */
+  gc_phase_mark_roots,          /* static areas, thread-local bindings */
+  gc_phase_mark_stacks,         /* stacks, exception frames */
+  gc_phase_mark_memoized,       /* refbits, in the EGC */
+  gc_phase_mark_parallel,       /* waiting for parallel marking to finish */
+  gc_phase_weak,                /* populations, weak hash tables, GCTWA */
+  gc_phase_relocate,
+  gc_phase_forward,
+  gc_phase_compact,
+  gc_phase_tenure,              /* tenuring, resizing the heap */
+  gc_nphases
+} gc_phase;
+
+#define GC_EVENT_LOG_SIZE 256   /* a power of 2 */
+#define GC_HISTOGRAM_BUCKETS 64 /* bucket i counts times in [2^i, 2^(i+1)) ns */
+
+typedef struct {
+  u64_t seq;
+  u64_t gc_num;                 /* value of GC_NUM before this GC */
+  u64_t generation;             /* 0-2 for an EGC, 3 for a full GC */
+  u64_t start_ns;               /* CLOCK_MONOTONIC, when available */
+  u64_t suspend_ns;             /* time spent stopping other threads */
+  u64_t resume_ns;              /* time spent restarting them */
+  u64_t bytes_allocated;        /* in the area being collected */
+  u64_t bytes_freed;
+  u64_t generation_bytes[4];    /* after the GC: g0, g1, g2, tenured */
+  u64_t phase_ns[gc_nphases];
+  u64_t safepoint_threads;      /* threads that stopped at a safepoint */
+  u64_t signalled_threads;      /* threads that were sent a signal */
+  u64_t safepoint_timeouts;     /* ... because they didn't reach one */
+} gc_event;
+
+typedef struct {
+  u64_t nevents;                /* GC_EVENT_LOG_SIZE */
+  u64_t nphases;                /* gc_nphases */
+  u64_t event_size;             /* sizeof(gc_event) */
+  u64_t next;                   /* number of events ever logged */
+  u64_t histogram[gc_nphases][GC_HISTOGRAM_BUCKETS];
+  gc_event events[GC_EVENT_LOG_SIZE];
+} gc_event_log;
+
+extern gc_event_log gc_events;
+u64_t gc_timestamp_ns(void);
+void gc_event_note_suspend(u64_t);
+void gc_event_note_safepoints(natural, natural, natural);
+void gc_event_note_resume(u64_t);
+
+/*
+  When either of these is non-zero, the ephemeral generations' thresholds
+  are adjusted after each EGC: to keep EGC pauses under egc_pause_target_ns
+  and/or to keep the fraction of time spent in the EGC under
+  egc_time_percent.
+*/
+extern u64_t egc_pause_target_ns;
+extern natural egc_time_percent;
+
+#if defined(LINUX) && defined(X8664)
+#define PERF_JITDUMP 1
+#endif
+
+#ifdef PERF_JITDUMP
+/*
+  Functions that lisp has registered with jitdump_note_function() are
+  described to perf (in a jitdump file and/or a perf map); the GC
+  reports it when they move and forgets them when they die.
+*/
+void reap_jitdump_functions(void);
+void forward_jitdump_functions(void);
+void purify_jitdump_functions(BytePtr, BytePtr);
+void impurify_jitdump_functions(LispObj, LispObj, signed_natural);
+#endif
+
+LispObj current_package(TCR *);
+
 
 #endif                          /* __GC_H__ */
@@ -27,6 +27,9 @@
 #include <stdio.h>
 #include <limits.h>
 #include <time.h>
+#ifndef WINDOWS
+#include <pthread.h>
+#endif
 
 
 #if defined(PPC64) || defined(X8632)
@@ -134,7 +137,350 @@ seek_to_next_page(int fd)
   pos = align_to_power_of_2(pos, log2_page_size);
   return LSEEK(fd, pos, SEEK_SET);
 }
-  
+
+/*
+  A small LZ77 codec for compressed images; its output is an LZ4
+  "block".  Each sequence is a token byte (the number of literal
+  bytes in the high nibble, the match length minus 4 in the low one,
+  with 15 in either meaning that more length bytes follow), the
+  literals, and a 2-byte little-endian offset back to the match.  The
+  last sequence has only literals.  Compression isn't very thorough,
+  but heap images have lots of redundancy and decompression is just
+  copying.
+*/
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_BOUND(n) ((n)+((n)/255)+16)
+
+static unsigned
+lz_read32(const unsigned char *p)
+{
+  unsigned v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static unsigned char *
+lz_put_length(unsigned char *op, natural len)
+{
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+static unsigned char *
+lz_put_literals(unsigned char *op, const unsigned char *p, natural n, natural mlen)
+{
+  *op++ = (unsigned char)((((n >= 15) ? 15 : n) << 4) |
+                          ((mlen >= 15) ? 15 : mlen));
+  if (n >= 15) {
+    op = lz_put_length(op, n-15);
+  }
+  memcpy(op, p, n);
+  return op+n;
+}
+
+/* DST must have room for LZ_BOUND(N) bytes; returns the compressed size */
+static natural
+lz_compress(const unsigned char *src, natural n, unsigned char *dst)
+{
+  unsigned table[1<<LZ_HASH_BITS], h, seq;
+  const unsigned char
+    *ip = src, *anchor = src, *end = src+n, *mflimit, *matchlimit, *ref, *m;
+  unsigned char *op = dst;
+  natural mlen, offset, misses = 0;
+
+  memset(table, 0, sizeof(table));
+  if (n > 12) {
+    /* Matches have to start 12 bytes and end 5 bytes before the end */
+    mflimit = end-12;
+    matchlimit = end-5;
+    while (ip < mflimit) {
+      seq = lz_read32(ip);
+      h = (seq * 2654435761U) >> (32-LZ_HASH_BITS);
+      ref = src+table[h];
+      table[h] = (unsigned)(ip-src);
+      if ((ref >= ip) || ((ip-ref) > LZ_MAX_OFFSET) || (lz_read32(ref) != seq)) {
+        /* Skip faster through data that doesn't compress */
+        ip += 1+(misses++ >> 6);
+        continue;
+      }
+      misses = 0;
+      for (m = ip+LZ_MIN_MATCH; (m < matchlimit) && (*m == ref[m-ip]); m++);
+      mlen = (m-ip)-LZ_MIN_MATCH;
+      offset = ip-ref;
+      op = lz_put_literals(op, anchor, ip-anchor, mlen);
+      *op++ = (unsigned char)offset;
+      *op++ = (unsigned char)(offset>>8);
+      if (mlen >= 15) {
+        op = lz_put_length(op, mlen-15);
+      }
+      ip = anchor = m;
+    }
+  }
+  op = lz_put_literals(op, anchor, end-anchor, 0);
+  return op-dst;
+}
+
+static Boolean
+lz_get_length(const unsigned char **ipp, const unsigned char *iend, natural *lenp)
+{
+  const unsigned char *ip = *ipp;
+  unsigned b;
+
+  do {
+    if (ip >= iend) {
+      return false;
+    }
+    b = *ip++;
+    *lenp += b;
+  } while (b == 255);
+  *ipp = ip;
+  return true;
+}
+
+/* Returns false unless SRC decompresses to exactly N bytes */
+static Boolean
+lz_decompress(const unsigned char *src, natural srclen, unsigned char *dst, natural n)
+{
+  const unsigned char *ip = src, *iend = src+srclen, *match;
+  unsigned char *op = dst, *oend = dst+n;
+  unsigned token;
+  natural len, offset;
+
+  while (ip < iend) {
+    token = *ip++;
+    len = token >> 4;
+    if ((len == 15) && !lz_get_length(&ip, iend, &len)) {
+      return false;
+    }
+    if ((len > (natural)(iend-ip)) || (len > (natural)(oend-op))) {
+      return false;
+    }
+    memcpy(op, ip, len);
+    op += len;
+    ip += len;
+    if (ip == iend) {
+      break;
+    }
+    if ((iend-ip) < 2) {
+      return false;
+    }
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if ((offset == 0) || (offset > (natural)(op-dst))) {
+      return false;
+    }
+    len = token & 15;
+    if ((len == 15) && !lz_get_length(&ip, iend, &len)) {
+      return false;
+    }
+    len += LZ_MIN_MATCH;
+    if (len > (natural)(oend-op)) {
+      return false;
+    }
+    match = op-offset;
+    if (offset >= len) {
+      memcpy(op, match, len);
+      op += len;
+    } else {
+      while (len--) {
+        *op++ = *match++;
+      }
+    }
+  }
+  return op == oend;
+}
+
+/* Where the data starts, relative to its chunk index */
+static natural
+chunk_data_offset(natural nchunks)
+{
+  return align_to_power_of_2(sizeof(openmcl_image_chunk_index) +
+                             ((nchunks+1)*sizeof(natural)),
+                             log2_page_size);
+}
+
+static Boolean image_compressed = false;
+Boolean save_image_compressed = false;
+
+static Boolean
+read_image_bytes(int fd, void *buf, natural n, off_t pos)
+{
+  char *p = buf;
+  signed_natural count;
+
+#ifdef WINDOWS
+  if (LSEEK(fd, pos, SEEK_SET) < 0) {
+    return false;
+  }
+#endif
+  while (n) {
+#ifdef WINDOWS
+    count = read(fd, p, (n > INT_MAX) ? INT_MAX : n);
+#else
+    count = pread(fd, p, (n > INT_MAX) ? INT_MAX : n, pos);
+#endif
+    if (count <= 0) {
+      return false;
+    }
+    p += count;
+    pos += count;
+    n -= count;
+  }
+  return true;
+}
+
+typedef struct {
+  int fd;
+  off_t data_pos;
+  char *dest;
+  natural nbytes;
+  natural nchunks;
+  natural *offsets;
+  signed_natural next;          /* the next chunk to claim */
+  Boolean failed;
+} image_decompression;
+
+extern signed_natural
+atomic_incf_by(signed_natural *, signed_natural);
+
+static void *
+decompress_image_chunks(void *param)
+{
+  image_decompression *d = (image_decompression *)param;
+  unsigned char *buf = malloc(IMAGE_CHUNK_SIZE);
+  natural i, start, len, clen;
+
+  if (buf == NULL) {
+    d->failed = true;
+  }
+  while (!d->failed) {
+    i = atomic_incf_by(&d->next, 1)-1;
+    if (i >= d->nchunks) {
+      break;
+    }
+    start = i*IMAGE_CHUNK_SIZE;
+    len = d->nbytes-start;
+    if (len > IMAGE_CHUNK_SIZE) {
+      len = IMAGE_CHUNK_SIZE;
+    }
+    clen = d->offsets[i+1]-d->offsets[i];
+    if (clen == len) {
+      if (!read_image_bytes(d->fd, d->dest+start, len, d->data_pos+d->offsets[i])) {
+        d->failed = true;
+      }
+    } else if ((clen > len) ||
+               !read_image_bytes(d->fd, buf, clen, d->data_pos+d->offsets[i]) ||
+               !lz_decompress(buf, clen, (unsigned char *)d->dest+start, len)) {
+      d->failed = true;
+    }
+  }
+  free(buf);
+  return NULL;
+}
+
+/*
+  Read and decompress chunks in as many threads as seem useful.  Lisp
+  threads don't exist yet, so plain pthreads are fine.
+*/
+#define IMAGE_LOAD_THREADS 8
+
+static Boolean
+decompress_image_data(image_decompression *d)
+{
+#ifndef WINDOWS
+  pthread_t threads[IMAGE_LOAD_THREADS];
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  natural i, nthreads = (ncpus > 1) ? ncpus : 1;
+
+  if (nthreads > IMAGE_LOAD_THREADS) {
+    nthreads = IMAGE_LOAD_THREADS;
+  }
+  if (nthreads > d->nchunks) {
+    nthreads = d->nchunks;
+  }
+  for (i = 1; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, decompress_image_chunks, d) != 0) {
+      break;
+    }
+  }
+  nthreads = i;
+  decompress_image_chunks(d);
+  for (i = 1; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+#else
+  decompress_image_chunks(d);
+#endif
+  return !d->failed;
+}
+
+/*
+  Make the NBYTES of section data at POS in the image file appear at
+  ADDR, and set *DISK_BYTES to the amount of space that it occupies
+  in the file.  Uncompressed data is mapped from the file, as usual.
+*/
+static Boolean
+map_image_data(LogicalAddress addr, off_t pos, natural nbytes, int permissions,
+               int fd, natural *disk_bytes)
+{
+  openmcl_image_chunk_index index;
+  image_decompression d;
+  natural data_offset, noffsets;
+  Boolean ok;
+
+  if (!image_compressed) {
+    *disk_bytes = nbytes;
+    return MapFile(addr, pos, nbytes, permissions, fd);
+  }
+  *disk_bytes = 0;
+  if (nbytes == 0) {
+    return true;
+  }
+  if (!read_image_bytes(fd, &index, sizeof(index), pos) ||
+      (index.nbytes > nbytes)) {
+    return false;
+  }
+  data_offset = chunk_data_offset(index.nchunks);
+  if (index.nchunks == 0) {
+    *disk_bytes = data_offset+index.nbytes;
+    return MapFile(addr, pos+data_offset, nbytes, permissions, fd);
+  }
+  if (index.nchunks != ((index.nbytes+IMAGE_CHUNK_SIZE-1)/IMAGE_CHUNK_SIZE)) {
+    return false;
+  }
+  noffsets = index.nchunks+1;
+  d.offsets = malloc(noffsets*sizeof(natural));
+  if ((d.offsets == NULL) ||
+      !read_image_bytes(fd, d.offsets, noffsets*sizeof(natural),
+                        pos+sizeof(index)) ||
+      !CommitMemory(addr, nbytes)) {
+    free(d.offsets);
+    return false;
+  }
+  d.fd = fd;
+  d.data_pos = pos+data_offset;
+  d.dest = (char *)addr;
+  d.nbytes = index.nbytes;
+  d.nchunks = index.nchunks;
+  d.next = 0;
+  d.failed = false;
+  ok = decompress_image_data(&d);
+  *disk_bytes = data_offset+d.offsets[index.nchunks];
+  free(d.offsets);
+  if (ok && (permissions == MEMPROTECT_RX)) {
+    ProtectMemory(addr, nbytes);
+  }
+  return ok;
+}
+
 /*
   fd is positioned to EOF; header has been allocated by caller.
   If we find a trailer (and that leads us to the header), read
@@ -192,7 +538,7 @@ find_openmcl_image_file_header(int fd, openmcl_image_file_header *header)
     fprintf(dbgout, "Heap image is too new for this kernel.\n");
     return false;
   }
-  flags = header->flags;
+  flags = header->flags & ~IMAGE_FLAG_COMPRESSED;
   if (flags != PLATFORM) {
     fprintf(dbgout, "Heap image was saved for another platform.\n");
     return false;
@@ -205,21 +551,21 @@ load_image_section(int fd, openmcl_image_section_header *sect)
 {
   extern area* allocate_dynamic_area(natural);
   off_t
-    pos = seek_to_next_page(fd), advance;
+    pos = seek_to_next_page(fd);
   natural
-    mem_size = sect->memory_size;
+    mem_size = sect->memory_size, advance = mem_size;
   char *addr;
   area *a;
 
-  advance = mem_size;
   switch(sect->code) {
   case AREA_READONLY:
     if (mem_size != 0) {
-      if (!MapFile(pure_space_active,
-                   pos,
-                   align_to_power_of_2(mem_size,log2_page_size),
-                   MEMPROTECT_RX,
-                   fd)) {
+      if (!map_image_data(pure_space_active,
+                          pos,
+                          align_to_power_of_2(mem_size,log2_page_size),
+                          MEMPROTECT_RX,
+                          fd,
+                          &advance)) {
         return;
       }
     }
@@ -230,11 +576,12 @@ load_image_section(int fd, openmcl_image_section_header *sect)
     break;
 
   case AREA_STATIC:
-    if (!MapFile(static_space_active,
-		 pos,
-		 align_to_power_of_2(mem_size,log2_page_size),
-		 MEMPROTECT_RWX,
-		 fd)) {
+    if (!map_image_data(static_space_active,
+                        pos,
+                        align_to_power_of_2(mem_size,log2_page_size),
+                        MEMPROTECT_RWX,
+                        fd,
+                        &advance)) {
       return;
     }
     a = new_area(static_space_active, static_space_limit, AREA_STATIC);
@@ -245,11 +592,12 @@ load_image_section(int fd, openmcl_image_section_header *sect)
 
   case AREA_DYNAMIC:
     a = allocate_dynamic_area(mem_size);
-    if (!MapFile(a->low,
-		 pos,
-		 align_to_power_of_2(mem_size,log2_page_size),
-		 MEMPROTECT_RWX,
-		 fd)) {
+    if (!map_image_data(a->low,
+                        pos,
+                        align_to_power_of_2(mem_size,log2_page_size),
+                        MEMPROTECT_RWX,
+                        fd,
+                        &advance)) {
       return;
     }
 
@@ -263,38 +611,30 @@ load_image_section(int fd, openmcl_image_section_header *sect)
     if (mem_size) {
       natural
         refbits_size = align_to_power_of_2((((mem_size>>dnode_shift)+7)>>3),
-                                           log2_page_size);
-      if (!MapFile(a->low,
-                   pos,
-                   align_to_power_of_2(mem_size,log2_page_size),
-                   MEMPROTECT_RWX,
-                   fd)) {
+                                           log2_page_size),
+        refbits_advance;
+      if (!map_image_data(a->low,
+                          pos,
+                          align_to_power_of_2(mem_size,log2_page_size),
+                          MEMPROTECT_RWX,
+                          fd,
+                          &advance)) {
         return;
       }
       if (!CommitMemory(global_mark_ref_bits,refbits_size)) {
         return;
       }
       /* Need to save/restore persistent refbits. */
-      if (!MapFile(managed_static_refbits,
-                   align_to_power_of_2(pos+mem_size,log2_page_size),
-                   refbits_size,
-                   MEMPROTECT_RW,
-                   fd)) {
+      advance = align_to_power_of_2(advance,log2_page_size);
+      if (!map_image_data(managed_static_refbits,
+                          pos+advance,
+                          refbits_size,
+                          MEMPROTECT_RW,
+                          fd,
+                          &refbits_advance)) {
         return;
       }
-      /* Should change image format and store this in the image */
-      {
-        natural ndnodes = area_dnode(a->active, a->low), i;
-        if (!CommitMemory(managed_static_refidx,(((ndnodes +255)>>8)+7)>>3)) {
-          return;
-        }
-        for (i=0; i < ndnodes; i++) {
-          if (ref_bit(managed_static_refbits,i)) {
-            set_bit(managed_static_refidx,i>>8);
-          }
-        }
-      }
-      advance += refbits_size;
+      advance += refbits_advance;
     }
     sect->area = a;
     a->ndnodes = area_dnode(a->active, a->low);
@@ -313,11 +653,12 @@ load_image_section(int fd, openmcl_image_section_header *sect)
     addr = (char *) lisp_global(HEAP_START);
     a = new_area(addr-align_to_power_of_2(mem_size,log2_page_size), addr, AREA_STATIC_CONS);
     if (mem_size) {      
-      if (!MapFile(a->low,
-                   pos,
-                   align_to_power_of_2(mem_size,log2_page_size),
-                   MEMPROTECT_RWX,
-                   fd)) {
+      if (!map_image_data(a->low,
+                          pos,
+                          align_to_power_of_2(mem_size,log2_page_size),
+                          MEMPROTECT_RWX,
+                          fd,
+                          &advance)) {
         return;
       }
     }
@@ -333,6 +674,48 @@ load_image_section(int fd, openmcl_image_section_header *sect)
   LSEEK(fd, pos+advance, SEEK_SET);
 }
 
+/*
+  Map the managed static area's refidx if the image contains it (right
+  after the last section); otherwise, compute it from the refbits.  The
+  latter touches every page of the refbits, so processes sharing an
+  image don't share those pages as well.
+*/
+Boolean
+load_managed_static_refidx(int fd, openmcl_image_section_header *sect)
+{
+  area *a = sect->area;
+  natural 
+    ndnodes = area_dnode(a->active, a->low),
+    nbytes = refidx_bytes(ndnodes),
+    i;
+
+  if (ndnodes == 0) {
+    return true;
+  }
+  if (sect->static_dnodes == nbytes) {
+    off_t pos = seek_to_next_page(fd);
+    natural disk_bytes;
+
+    if (map_image_data(managed_static_refidx,
+                       pos,
+                       align_to_power_of_2(nbytes,log2_page_size),
+                       MEMPROTECT_RW,
+                       fd,
+                       &disk_bytes)) {
+      return true;
+    }
+  }
+  if (!CommitMemory(managed_static_refidx,nbytes)) {
+    return false;
+  }
+  for (i=0; i < ndnodes; i++) {
+    if (ref_bit(managed_static_refbits,i)) {
+      set_refidx(managed_static_refidx,i>>8);
+    }
+  }
+  return true;
+}
+
 LispObj
 load_openmcl_image(int fd, openmcl_image_file_header *h)
 {
@@ -351,6 +734,7 @@ load_openmcl_image(int fd, openmcl_image_file_header *h)
 	nsections * sizeof(openmcl_image_section_header)) {
       return 0;
     }
+    image_compressed = ((h->flags & IMAGE_FLAG_COMPRESSED) != 0);
 #if WORD_SIZE == 64
     LSEEK(fd, section_data_delta, SEEK_CUR);
 #endif
@@ -361,6 +745,12 @@ load_openmcl_image(int fd, openmcl_image_file_header *h)
 	return 0;
       }
     }
+    for (i = 0, sect = sections; i < nsections; i++, sect++) {
+      if ((sect->code == AREA_MANAGED_STATIC) &&
+          !load_managed_static_refidx(fd, sect)) {
+        return 0;
+      }
+    }
 
     for (i = 0, sect = sections; i < nsections; i++, sect++) {
       a = sect->area;
@@ -511,6 +901,69 @@ writebuf(int fd, char *bytes, natural n)
   return 0;
 }
 
+/*
+  Write N bytes of section data, compressed as described in image.h
+  if the image is being compressed.  The file position is
+  page-aligned.  If the data doesn't compress well, don't bother:
+  uncompressed data can be mapped from the file when the image is
+  loaded, rather than being read and copied.
+*/
+natural
+write_section_data(int fd, char *bytes, natural n)
+{
+  natural nchunks, data_offset, bufsize, i, start, len, clen, total = 0, err;
+  openmcl_image_chunk_index *index;
+  natural *offsets;
+  char *buf;
+
+  if (!save_image_compressed) {
+    return writebuf(fd, bytes, n);
+  }
+  if (n == 0) {
+    return 0;
+  }
+  nchunks = (n+IMAGE_CHUNK_SIZE-1)/IMAGE_CHUNK_SIZE;
+  data_offset = chunk_data_offset(nchunks);
+  bufsize = align_to_power_of_2(data_offset+(nchunks*LZ_BOUND(IMAGE_CHUNK_SIZE)),
+                                log2_page_size);
+  /* Mostly untouched, if things compress well */
+  buf = MapMemory(NULL, bufsize, MEMPROTECT_RW);
+  if ((buf == NULL) || (buf == MAP_FAILED)) {
+    return ENOMEM;
+  }
+  index = (openmcl_image_chunk_index *)buf;
+  offsets = (natural *)(index+1);
+  for (i = 0, start = 0; i < nchunks; i++, start += len) {
+    len = n-start;
+    if (len > IMAGE_CHUNK_SIZE) {
+      len = IMAGE_CHUNK_SIZE;
+    }
+    offsets[i] = total;
+    clen = lz_compress((unsigned char *)bytes+start, len,
+                       (unsigned char *)buf+data_offset+total);
+    if (clen >= len) {
+      memcpy(buf+data_offset+total, bytes+start, len);
+      clen = len;
+    }
+    total += clen;
+  }
+  offsets[nchunks] = total;
+  index->nbytes = n;
+  if (total > (n-(n>>3))) {
+    index->nchunks = 0;
+    memset(offsets, 0, (nchunks+1)*sizeof(natural));
+    err = writebuf(fd, buf, chunk_data_offset(0));
+    if (err == 0) {
+      err = writebuf(fd, bytes, n);
+    }
+  } else {
+    index->nchunks = nchunks;
+    err = writebuf(fd, buf, data_offset+total);
+  }
+  UnMapMemory(buf, bufsize);
+  return err;
+}
+
 void
 prepare_to_write_static_space(Boolean egc_was_enabled)
 {
@@ -596,6 +1049,8 @@ save_application_internal(unsigned fd, Boolean egc_was_enabled)
     sections[i].memory_size  = a->active - a->low;
     if (a == active_dynamic_area) {
       sections[i].static_dnodes = tenured_area->static_dnodes;
+    } else if ((a == managed_static_area) && (a->active != a->low)) {
+      sections[i].static_dnodes = refidx_bytes(area_dnode(a->active, a->low));
     } else {
       sections[i].static_dnodes = 0;
     }
@@ -617,6 +1072,9 @@ save_application_internal(unsigned fd, Boolean egc_was_enabled)
   fh.pad1[0] = fh.pad1[1] = fh.pad1[2] = fh.pad1[3] = 0;
 #endif
   fh.flags = PLATFORM;
+  if (save_image_compressed) {
+    fh.flags |= IMAGE_FLAG_COMPRESSED;
+  }
 
 #if WORD_SIZE == 64
   image_data_pos = seek_to_next_page(fd);
@@ -636,7 +1094,7 @@ save_application_internal(unsigned fd, Boolean egc_was_enabled)
     a = areas[i];
     seek_to_next_page(fd);
     n = sections[i].memory_size;
-    if (writebuf(fd, a->low, n)) {
+    if (write_section_data(fd, a->low, n)) {
 	return errno;
     }
     if (n &&  ((sections[i].code) == AREA_MANAGED_STATIC)) {
@@ -644,12 +1102,19 @@ save_application_internal(unsigned fd, Boolean egc_was_enabled)
       natural nrefbytes = align_to_power_of_2((ndnodes+7)>>3,log2_page_size);
 
       seek_to_next_page(fd);
-      if (writebuf(fd,(char*)managed_static_refbits,nrefbytes)) {
+      if (write_section_data(fd,(char*)managed_static_refbits,nrefbytes)) {
         return errno;
       }
     }
   }
 
+  if (managed_static_area->active != managed_static_area->low) {
+    seek_to_next_page(fd);
+    if (write_section_data(fd,(char*)managed_static_refidx,sections[3].static_dnodes)) {
+      return errno;
+    }
+  }
+
 #if WORD_SIZE == 64
   seek_to_next_page(fd);
   section_data_delta = -((LSEEK(fd,0,SEEK_CUR)+sizeof(fh)+sizeof(sections)) -
@@ -41,6 +41,15 @@
    prepended to it.  This is supposed to simplify distribution.
 */
 
+/*
+   The managed static area's section data is followed by its refbits.
+   If that section's static_dnodes field is non-zero, it's the size in
+   bytes of the area's refidx, which is written on the page after the
+   last section's data (where kernels that don't know about it won't
+   look.)  Images that don't have it get their refidx recomputed from
+   the refbits at startup.
+*/
+
 typedef struct {
   natural code;
   area *area;
@@ -48,6 +57,28 @@ typedef struct {
   natural static_dnodes;
 } openmcl_image_section_header;
 
+/*
+   If the file header's flags include IMAGE_FLAG_COMPRESSED, each
+   piece of page-aligned data described above (including the managed
+   static area's refbits and refidx) starts with an
+   openmcl_image_chunk_index.  That's followed by nchunks+1 naturals
+   and then, on the next page, by the data itself, split into
+   IMAGE_CHUNK_SIZE chunks that are compressed separately (so that
+   they can be decompressed in parallel.)  The naturals are the
+   offsets of the compressed chunks from the start of the data, and
+   a chunk whose compressed size is the same as its real size is
+   stored as is.  If nchunks is 0, the data isn't compressed at all
+   and can be mapped from the file.  Kernels that don't know about
+   compression reject these images because of the flag.
+*/
+#define IMAGE_FLAG_COMPRESSED (1<<16)
+#define IMAGE_CHUNK_SIZE (1<<20)
+
+typedef struct {
+  natural nbytes;               /* uncompressed */
+  natural nchunks;
+} openmcl_image_chunk_index;
+
 typedef struct {
   unsigned sig0, sig1, sig2, sig3;
   unsigned timestamp;
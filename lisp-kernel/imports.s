@@ -101,6 +101,9 @@ import_ptrs_start:
         defimport(lisp_gettimeofday)
         defimport(lisp_sigexit)
         defimport(jvm_init)
+        defimport(utf8_decode_run)
+        defimport(utf8_encode_run)
+        defimport(utf8_length_of_encoding)
    
         .globl C(import_ptrs_base)
 C(import_ptrs_base):
@@ -0,0 +1,410 @@
+/*
+   This file is part of Clozure CL.
+
+   Clozure CL is licensed under the terms of the Lisp Lesser GNU Public
+   License , known as the LLGPL and distributed with Clozure CL as the
+   file "LICENSE".  The LLGPL consists of a preamble and the LGPL,
+   which is distributed with Clozure CL as the file "LGPL".  Where these
+   conflict, the preamble takes precedence.
+
+   Clozure CL is referenced in the preamble as the "LIBRARY."
+
+   The LLGPL is also available online at
+   http://opensource.franz.com/preamble.html
+*/
+
+/*
+  Tell the Linux "perf" tools where compiled lisp functions are.
+
+  Lisp functions live in the (anonymous) lisp heap and the GC moves
+  them around, so perf can't symbolize them on its own.  Once lisp
+  calls jitdump_open(), it registers functions as they're created (and
+  any that already exist) via jitdump_note_function(), and the GC
+  calls the *_jitdump_functions() hooks when registered functions move
+  or die.
+
+  Two formats are supported:
+
+  - a "jitdump" file (DIR/jit-PID.dump), which records each function's
+    name and code, and the times at which functions moved.  "perf
+    record -k mono" notices the file (since it's mapped executable),
+    and "perf inject --jit" turns its contents into symbol tables.
+
+  - a "perf map" (/tmp/perf-PID.map), which "perf report" reads
+    directly.  It has no notion of time, so once a function has moved
+    it has two entries; that's generally harmless, since most functions
+    don't move after they've survived a few GCs.
+*/
+
+#include "lisp.h"
+#include "lisp_globals.h"
+#include "gc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef PERF_JITDUMP
+
+#define JITDUMP_MAGIC 0x4A695444
+#define JITDUMP_VERSION 1
+#define JITDUMP_EM_X86_64 62
+
+#define JIT_CODE_LOAD 0
+#define JIT_CODE_MOVE 1
+#define JIT_CODE_CLOSE 3
+
+#define JITDUMP_WRITE_JITDUMP 1
+#define JITDUMP_WRITE_PERF_MAP 2
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+} jitdump_header;
+
+typedef struct {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+} jitdump_record_prefix;
+
+typedef struct {
+  jitdump_record_prefix p;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+  /* followed by the name (NUL-terminated) and the code */
+} jitdump_code_load;
+
+typedef struct {
+  jitdump_record_prefix p;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t old_code_addr;
+  uint64_t new_code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+} jitdump_code_move;
+
+typedef struct {
+  LispObj fn;
+  uint64_t index;               /* as perf knows it */
+  char *name;                   /* if there's a perf map */
+} jitdump_function;
+
+static FILE *jitdump_file = NULL, *perf_map_file = NULL;
+static void *jitdump_marker = NULL;
+static jitdump_function *jitdump_functions = NULL;
+static natural jitdump_nfunctions = 0, jitdump_functions_size = 0;
+static uint64_t jitdump_next_index = 0;
+static pthread_mutex_t jitdump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static natural
+jitdump_code_size(LispObj fn)
+{
+  unsigned code_words = *((unsigned *)ptr_from_lispobj(untag(fn)+node_size));
+
+  return ((code_words-1) * sizeof(LispObj)) + 1;
+}
+
+static uint32_t
+jitdump_tid()
+{
+  return (uint32_t)syscall(SYS_gettid);
+}
+
+/* size is passed in, since the function may be at either address */
+static void
+jitdump_write_move(LispObj old, LispObj new, natural size, uint64_t index, char *name)
+{
+  if (jitdump_file) {
+    jitdump_code_move r;
+
+    r.p.id = JIT_CODE_MOVE;
+    r.p.total_size = sizeof(r);
+    r.p.timestamp = gc_timestamp_ns();
+    r.pid = getpid();
+    r.tid = jitdump_tid();
+    r.vma = r.new_code_addr = new;
+    r.old_code_addr = old;
+    r.code_size = size;
+    r.code_index = index;
+    fwrite(&r, sizeof(r), 1, jitdump_file);
+  }
+  if (perf_map_file) {
+    /* The old entry can't be removed; the new one's just as good. */
+    fprintf(perf_map_file, "%lx %lx %s\n",
+            (unsigned long)new, (unsigned long)size, name);
+  }
+}
+
+static void
+jitdump_flush()
+{
+  if (jitdump_file) {
+    fflush(jitdump_file);
+  }
+  if (perf_map_file) {
+    fflush(perf_map_file);
+  }
+}
+
+/*
+  Start describing functions to perf: in a jitdump file in DIR if
+  (flags & 1), in /tmp/perf-PID.map if (flags & 2).  Returns 0 or an
+  errno value.
+*/
+int
+jitdump_open(char *dir, int flags)
+{
+  char path[PATH_MAX];
+  int fd, err = 0;
+  pid_t pid = getpid();
+
+  pthread_mutex_lock(&jitdump_lock);
+  if (jitdump_file || perf_map_file) {
+    err = EBUSY;
+  } else if ((flags & (JITDUMP_WRITE_JITDUMP|JITDUMP_WRITE_PERF_MAP)) == 0) {
+    err = EINVAL;
+  }
+  if ((err == 0) && (flags & JITDUMP_WRITE_JITDUMP)) {
+    jitdump_header h;
+
+    snprintf(path, sizeof(path), "%s/jit-%d.dump", dir, (int)pid);
+    fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    if (fd < 0) {
+      err = errno;
+    } else {
+      /* perf only notices the file if it sees it mapped executable */
+      jitdump_marker = mmap(NULL, page_size, PROT_READ|PROT_EXEC, MAP_PRIVATE, fd, 0);
+      if (jitdump_marker == MAP_FAILED) {
+        err = errno;
+        jitdump_marker = NULL;
+        close(fd);
+      } else {
+        jitdump_file = fdopen(fd, "w");
+        memset(&h, 0, sizeof(h));
+        h.magic = JITDUMP_MAGIC;
+        h.version = JITDUMP_VERSION;
+        h.total_size = sizeof(h);
+        h.elf_mach = JITDUMP_EM_X86_64;
+        h.pid = pid;
+        h.timestamp = gc_timestamp_ns();
+        fwrite(&h, sizeof(h), 1, jitdump_file);
+      }
+    }
+  }
+  if ((err == 0) && (flags & JITDUMP_WRITE_PERF_MAP)) {
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)pid);
+    perf_map_file = fopen(path, "w");
+    if (perf_map_file == NULL) {
+      err = errno;
+    }
+  }
+  if (err == 0) {
+    jitdump_flush();
+  } else if (err != EBUSY) {
+    if (jitdump_file) {
+      fclose(jitdump_file);
+      jitdump_file = NULL;
+      munmap(jitdump_marker, page_size);
+      jitdump_marker = NULL;
+    }
+  }
+  pthread_mutex_unlock(&jitdump_lock);
+  return err;
+}
+
+void
+jitdump_close()
+{
+  natural i;
+
+  pthread_mutex_lock(&jitdump_lock);
+  if (jitdump_file) {
+    jitdump_record_prefix r;
+
+    r.id = JIT_CODE_CLOSE;
+    r.total_size = sizeof(r);
+    r.timestamp = gc_timestamp_ns();
+    fwrite(&r, sizeof(r), 1, jitdump_file);
+    fclose(jitdump_file);
+    jitdump_file = NULL;
+    munmap(jitdump_marker, page_size);
+    jitdump_marker = NULL;
+  }
+  if (perf_map_file) {
+    fclose(perf_map_file);
+    perf_map_file = NULL;
+  }
+  for (i = 0; i < jitdump_nfunctions; i++) {
+    free(jitdump_functions[i].name);
+  }
+  free(jitdump_functions);
+  jitdump_functions = NULL;
+  jitdump_nfunctions = jitdump_functions_size = 0;
+  pthread_mutex_unlock(&jitdump_lock);
+}
+
+/*
+  Describe the function fn, whose name is name.  Lisp must keep the
+  GC from running while this is called, since fn is passed as an
+  address.  Returns 0 or an errno value.
+*/
+int
+jitdump_note_function(LispObj fn, char *name)
+{
+  natural size;
+  uint64_t index;
+
+  if (fulltag_of(fn) != fulltag_function) {
+    return EINVAL;
+  }
+  pthread_mutex_lock(&jitdump_lock);
+  if ((jitdump_file == NULL) && (perf_map_file == NULL)) {
+    pthread_mutex_unlock(&jitdump_lock);
+    return EBADF;
+  }
+  if (jitdump_nfunctions == jitdump_functions_size) {
+    natural newsize = jitdump_functions_size ? jitdump_functions_size*2 : 1024;
+    jitdump_function *p = realloc(jitdump_functions, newsize*sizeof(jitdump_function));
+
+    if (p == NULL) {
+      pthread_mutex_unlock(&jitdump_lock);
+      return ENOMEM;
+    }
+    jitdump_functions = p;
+    jitdump_functions_size = newsize;
+  }
+  index = jitdump_next_index++;
+  jitdump_functions[jitdump_nfunctions].fn = fn;
+  jitdump_functions[jitdump_nfunctions].index = index;
+  jitdump_functions[jitdump_nfunctions].name = perf_map_file ? strdup(name) : NULL;
+  jitdump_nfunctions++;
+
+  size = jitdump_code_size(fn);
+  if (jitdump_file) {
+    jitdump_code_load r;
+    natural namelen = strlen(name)+1;
+
+    r.p.id = JIT_CODE_LOAD;
+    r.p.total_size = sizeof(r)+namelen+size;
+    r.p.timestamp = gc_timestamp_ns();
+    r.pid = getpid();
+    r.tid = jitdump_tid();
+    r.vma = r.code_addr = fn;
+    r.code_size = size;
+    r.code_index = index;
+    fwrite(&r, sizeof(r), 1, jitdump_file);
+    fwrite(name, namelen, 1, jitdump_file);
+    fwrite(ptr_from_lispobj(fn), size, 1, jitdump_file);
+  }
+  if (perf_map_file) {
+    fprintf(perf_map_file, "%lx %lx %s\n",
+            (unsigned long)fn, (unsigned long)size, name);
+  }
+  jitdump_flush();
+  pthread_mutex_unlock(&jitdump_lock);
+  return 0;
+}
+
+/*
+  The GC hooks run with all other threads suspended, and lisp doesn't
+  call jitdump_note_function() while a GC can happen, so they don't
+  need the lock.
+*/
+
+/* Forget about functions that the GC didn't mark. */
+void
+reap_jitdump_functions()
+{
+  natural i, j, dnode;
+  LispObj fn;
+
+  for (i = j = 0; i < jitdump_nfunctions; i++) {
+    fn = jitdump_functions[i].fn;
+    dnode = gc_area_dnode(fn);
+    if ((dnode >= GCndnodes_in_area) ||
+        (ref_bit(GCmarkbits,dnode))) {
+      jitdump_functions[j++] = jitdump_functions[i];
+    } else {
+      free(jitdump_functions[i].name);
+    }
+  }
+  jitdump_nfunctions = j;
+}
+
+void
+forward_jitdump_functions()
+{
+  natural i;
+  LispObj old, new;
+
+  for (i = 0; i < jitdump_nfunctions; i++) {
+    old = jitdump_functions[i].fn;
+    new = node_forwarding_address(old);
+    if (new != old) {
+      jitdump_functions[i].fn = new;
+      /* The heap hasn't been compacted yet */
+      jitdump_write_move(old, new, jitdump_code_size(old),
+                         jitdump_functions[i].index, jitdump_functions[i].name);
+    }
+  }
+  jitdump_flush();
+}
+
+/* purify() leaves forwarding pointers behind in [low,high) */
+void
+purify_jitdump_functions(BytePtr low, BytePtr high)
+{
+  natural i;
+  LispObj old, new;
+
+  for (i = 0; i < jitdump_nfunctions; i++) {
+    old = jitdump_functions[i].fn;
+    if ((((BytePtr)ptr_from_lispobj(old)) > low) &&
+        (((BytePtr)ptr_from_lispobj(old)) < high) &&
+        (deref(old,0) == forward_marker)) {
+      new = untag(deref(old,1)) + fulltag_of(old);
+      jitdump_functions[i].fn = new;
+      jitdump_write_move(old, new, jitdump_code_size(new),
+                         jitdump_functions[i].index, jitdump_functions[i].name);
+    }
+  }
+  jitdump_flush();
+}
+
+void
+impurify_jitdump_functions(LispObj low, LispObj high, signed_natural delta)
+{
+  natural i;
+  LispObj old, new;
+
+  for (i = 0; i < jitdump_nfunctions; i++) {
+    old = jitdump_functions[i].fn;
+    if ((old >= low) && (old < high)) {
+      new = old+delta;
+      jitdump_functions[i].fn = new;
+      jitdump_write_move(old, new, jitdump_code_size(new),
+                         jitdump_functions[i].index, jitdump_functions[i].name);
+    }
+  }
+  jitdump_flush();
+}
+#endif
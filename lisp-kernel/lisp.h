@@ -78,8 +78,10 @@ print_lisp_object(LispObj);
 
 #ifdef WINDOWS
 Boolean check_for_embedded_image (wchar_t *);
+BytePtr saved_image_base (wchar_t *);
 #else
 Boolean check_for_embedded_image (char *);
+BytePtr saved_image_base (char *);
 #endif
 natural xStackSpace();
 void init_threads(void *, TCR *);
@@ -843,12 +843,12 @@ load_native_library(char *path)
     nrefbytes = msr_end - ms_end;
     CommitMemory(global_mark_ref_bits,align_to_power_of_2(nrefbytes, 12));
     CommitMemory(managed_static_refbits,align_to_power_of_2(nrefbytes, 12));
-    CommitMemory(managed_static_refidx,(managed_static_area->ndnodes+255)>>3);
+    CommitMemory(managed_static_refidx,refidx_bytes(managed_static_area->ndnodes));
     memcpy(managed_static_refbits,ms_end,nrefbytes);
     memset(ms_end,0,nrefbytes);
     for (i = 0; i < managed_static_area->ndnodes; i++) {
       if (ref_bit(managed_static_refbits,i)) {
-        set_bit(managed_static_refidx,i>>8);
+        set_refidx(managed_static_refidx,i>>8);
       }
     }
     return image_nil;
@@ -61,6 +61,146 @@ lisp_free(void *p)
   free(p);
 }
 
+#ifdef HEAP_PLACEMENT
+#include <sys/syscall.h>
+
+/* From <numaif.h>, which we'd rather not depend on. */
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+
+#define HEAP_NUMA_MAX_NODES 1024
+
+natural heap_placement = 0;
+
+static unsigned long
+heap_numa_nodes[HEAP_NUMA_MAX_NODES/(8*sizeof(unsigned long))];
+
+/*
+  Parse a node list like "0-3,5" (the syntax of numactl and of
+  /sys/devices/system/node/online) into heap_numa_nodes.
+*/
+static Boolean
+parse_numa_node_list(char *s)
+{
+  char *p = s;
+  unsigned long lo, hi, n;
+  int bits = 8*sizeof(unsigned long);
+
+  memset(heap_numa_nodes, 0, sizeof(heap_numa_nodes));
+  if (*p == 0) {
+    return false;
+  }
+  while (*p) {
+    if (!isdigit((unsigned char)*p)) {
+      return false;
+    }
+    lo = hi = strtoul(p, &p, 10);
+    if (*p == '-') {
+      p++;
+      if (!isdigit((unsigned char)*p)) {
+        return false;
+      }
+      hi = strtoul(p, &p, 10);
+    }
+    if ((hi < lo) || (hi >= HEAP_NUMA_MAX_NODES)) {
+      return false;
+    }
+    for (n = lo; n <= hi; n++) {
+      heap_numa_nodes[n/bits] |= (1UL << (n%bits));
+    }
+    if (*p == ',') {
+      p++;
+    } else if (*p && !isspace((unsigned char)*p)) {
+      return false;
+    } else {
+      break;
+    }
+  }
+  return true;
+}
+
+/*
+  The argument to --heap-numa: "interleave" (across all online nodes),
+  "interleave:NODES" or "bind:NODES".
+*/
+Boolean
+parse_heap_numa_option(char *arg)
+{
+  char *nodes = NULL;
+
+  if (strncmp(arg, "interleave", 10) == 0) {
+    heap_placement |= HEAP_NUMA_INTERLEAVE;
+    if (arg[10] == ':') {
+      nodes = arg+11;
+    } else if (arg[10]) {
+      return false;
+    }
+  } else if (strncmp(arg, "bind:", 5) == 0) {
+    heap_placement |= HEAP_NUMA_BIND;
+    nodes = arg+5;
+  } else {
+    return false;
+  }
+  if (nodes == NULL) {
+    char buf[256];
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    Boolean ok = false;
+
+    if (f) {
+      if (fgets(buf, sizeof(buf), f)) {
+        ok = parse_numa_node_list(buf);
+      }
+      fclose(f);
+    }
+    if (!ok) {
+      /* No NUMA support in the OS; nothing to interleave. */
+      heap_placement &= ~HEAP_NUMA_INTERLEAVE;
+    }
+    return true;
+  }
+  return parse_numa_node_list(nodes);
+}
+
+natural
+heap_page_alignment()
+{
+  return (heap_placement & HEAP_HUGE_PAGES) ? HEAP_HUGE_PAGE_SIZE : 4096;
+}
+
+/*
+  Apply the requested placement to a newly mapped range of the heap.
+  Failures just mean that the OS can't do what we asked; say so once
+  and stop asking.
+*/
+void
+place_heap_memory(LogicalAddress start, natural len)
+{
+  if ((heap_placement & HEAP_HUGE_PAGES) &&
+      (madvise(start, len, MADV_HUGEPAGE) != 0)) {
+    fprintf(dbgout, "Can't use transparent huge pages for the heap: %s\n",
+            strerror(errno));
+    heap_placement &= ~HEAP_HUGE_PAGES;
+  }
+  if (heap_placement & (HEAP_NUMA_INTERLEAVE|HEAP_NUMA_BIND)) {
+    int mode = (heap_placement & HEAP_NUMA_BIND) ? MPOL_BIND : MPOL_INTERLEAVE;
+
+    if (syscall(SYS_mbind, start, len, mode, heap_numa_nodes,
+                HEAP_NUMA_MAX_NODES+1, 0) != 0) {
+      fprintf(dbgout, "Can't set a NUMA policy for the heap: %s\n",
+              strerror(errno));
+      heap_placement &= ~(HEAP_NUMA_INTERLEAVE|HEAP_NUMA_BIND);
+    }
+  }
+}
+#endif
+
 
 LogicalAddress
 ReserveMemoryForHeap(LogicalAddress want, natural totalsize)
@@ -86,8 +226,15 @@ ReserveMemoryForHeap(LogicalAddress want, natural totalsize)
     }
   }
 #else
+  natural align = heap_segment_size;
+
+#ifdef HEAP_PLACEMENT
+  if (heap_page_alignment() > align) {
+    align = heap_page_alignment();
+  }
+#endif
   start = mmap((void *)want,
-	       totalsize + heap_segment_size,
+	       totalsize + align,
 	       PROT_NONE,
 	       MAP_PRIVATE | MAP_ANON | MAP_NORESERVE,
 	       -1,
@@ -97,8 +244,8 @@ ReserveMemoryForHeap(LogicalAddress want, natural totalsize)
   }
 
   if (start != want) {
-    munmap(start, totalsize+heap_segment_size);
-    start = (void *)((((natural)start)+heap_segment_size-1) & ~(heap_segment_size-1));
+    munmap(start, totalsize+align);
+    start = (void *)((((natural)start)+align-1) & ~(align-1));
     if(mmap(start, totalsize, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_FIXED | MAP_NORESERVE, -1, 0) != start) {
       return NULL;
     }
@@ -143,6 +290,13 @@ CommitMemory (LogicalAddress start, natural len)
   for (i = 0; i < 3; i++) {
     addr = mmap(start, len, MEMPROTECT_RWX, MAP_PRIVATE|MAP_ANON|MAP_FIXED, -1, 0);
     if (addr == start) {
+#ifdef HEAP_PLACEMENT
+      if (heap_placement &&
+          (start >= (LogicalAddress)image_base) &&
+          ((start+len) <= (LogicalAddress)reserved_region_end)) {
+        place_heap_memory(start, len);
+      }
+#endif
       return true;
     } else {
       mmap(addr, len, MEMPROTECT_NONE, MAP_PRIVATE|MAP_ANON|MAP_FIXED, -1, 0);
@@ -399,6 +553,23 @@ void
 zero_refbits(bitvector refidx, bitvector refbits, natural ndnodes)
 {
   bitvector refbase = refbits, refword, limit = refbase + ((ndnodes + (WORD_SIZE-1)) >> node_shift), reflimit;
+#ifdef BYTE_REFIDX
+  unsigned char *cards = (unsigned char *)refidx;
+  natural i = 0, n = (ndnodes + 255) >> 8;
+
+  while ((i = next_dirty_card(cards, i, n)) < n) {
+    cards[i] = 0;
+    refword = refbase + i * (256/WORD_SIZE);
+    reflimit = refword + (256/WORD_SIZE);
+    if (limit < reflimit) {
+      reflimit = limit;
+    }
+    while (refword < reflimit) {
+      *refword++ = 0;
+    }
+    i++;
+  }
+#else
   natural i, n = (((ndnodes + 255) >> 8) + (WORD_SIZE-1)) >> bitmap_shift, bit, idx;
 
   for (i = 0; i < n; i++, refbase += WORD_SIZE * (256 / WORD_SIZE)) {
@@ -421,6 +592,7 @@ zero_refbits(bitvector refidx, bitvector refbits, natural ndnodes)
     }
     refidx++;
   }
+#endif
 #if 0
   /* Check,slowly */
   for (i=0;i<ndnodes;i++) {
@@ -681,7 +853,11 @@ tenure_to_area(area *target)
   if (target == tenured_area) {
     zero_refbits(global_refidx,managed_static_area->refbits, managed_static_area->ndnodes);
     zero_bits(refbits, new_tenured_dnodes);
+#ifdef BYTE_REFIDX
+    memset(dynamic_refidx,0,refidx_bytes(new_tenured_dnodes));
+#else
     zero_bits(dynamic_refidx,(new_tenured_dnodes+255)>>8);
+#endif
     lisp_global(OLDEST_EPHEMERAL) = ptr_to_lispobj(curfree);
   } else {
     /* Need more (zeroed) refbits & fewer markbits */
@@ -77,6 +77,30 @@ UnProtectMemory(LogicalAddress, natural);
 
 int
 MapFile(LogicalAddress addr, natural pos, natural nbytes, int permissions, int fd);
+
+/*
+  On Linux, the heap can be asked (from the command line) to use
+  transparent huge pages and/or a NUMA memory policy.  The kernel
+  forgets both when a range is re-mmapped, so CommitMemory() reapplies
+  them to whatever part of the reserved heap region it maps.
+*/
+#ifdef LINUX
+#define HEAP_PLACEMENT 1
+#endif
+
+#ifdef HEAP_PLACEMENT
+#define HEAP_HUGE_PAGES      1 /* align to and madvise(MADV_HUGEPAGE) */
+#define HEAP_NUMA_INTERLEAVE 2 /* interleave pages across nodes */
+#define HEAP_NUMA_BIND       4 /* allocate only on the given nodes */
+#define HEAP_HUGE_PAGE_SIZE  ((natural)(2<<20))
+
+extern natural heap_placement;
+Boolean parse_heap_numa_option(char *);
+natural heap_page_alignment(void);
+void place_heap_memory(LogicalAddress, natural);
+#else
+#define heap_page_alignment() ((natural)4096)
+#endif
 void allocation_failure(Boolean pointerp, natural size);
 
 void protect_watched_areas(void);
@@ -373,6 +373,12 @@ unsigned unsigned_max(unsigned x, unsigned y)
 natural
 reserved_area_size = MAXIMUM_MAPPABLE_MEMORY;
 
+#ifdef LARGE_OBJECT_SPACE
+/* Reserved above (and in addition to) the heap reserve */
+natural
+large_object_area_size = (8L<<30L);
+#endif
+
 BytePtr reserved_region_end = NULL;
 
 area 
@@ -505,6 +511,7 @@ extend_readonly_area(natural more)
 }
 
 LispObj image_base=0;
+BytePtr preferred_image_base = NULL;
 BytePtr pure_space_start, pure_space_active, pure_space_limit;
 BytePtr static_space_start, static_space_active, static_space_limit;
 
@@ -531,7 +538,7 @@ create_reserved_area(natural totalsize)
     end, 
     lastbyte, 
     start, 
-    want = (BytePtr)IMAGE_BASE_ADDRESS;
+    want = preferred_image_base ? preferred_image_base : (BytePtr)IMAGE_BASE_ADDRESS;
   area *reserved;
   Boolean fatal = false;
 
@@ -541,6 +548,10 @@ create_reserved_area(natural totalsize)
     totalsize = PURESPACE_RESERVE + MIN_DYNAMIC_SIZE;
     fatal = true;
   }
+#ifdef LARGE_OBJECT_SPACE
+  large_object_area_size = align_to_power_of_2((void *)large_object_area_size, log2_heap_segment_size);
+  totalsize += large_object_area_size;
+#endif
 
   start = ReserveMemoryForHeap(want, totalsize);
 
@@ -573,16 +584,34 @@ create_reserved_area(natural totalsize)
   end = lastbyte;
   reserved_region_end = lastbyte;
   refbits_size = ((totalsize+63)>>6); /* word size! */
-  end = (BytePtr) ((natural)((((natural)end) - refbits_size) & ~4095));
+  end = (BytePtr) ((natural)((((natural)end) - refbits_size) & ~(heap_page_alignment()-1)));
 
   global_mark_ref_bits = (bitvector)end;
+#ifdef BYTE_REFIDX
+  end  = (BytePtr) ((natural)((((natural)end) - refidx_bytes(totalsize>>dnode_shift)) & ~4095));
+#else
   end  = (BytePtr) ((natural)((((natural)end) - ((refbits_size+255) >> 8)) & ~4095));
+#endif
   global_refidx = (bitvector)end;
   /* Don't really want to commit so much so soon */
   CommitMemory((BytePtr)global_refidx,(BytePtr)global_mark_ref_bits-(BytePtr)global_refidx);
     
   end = (BytePtr) ((natural)((((natural)end) - ((totalsize+63) >> 6)) & ~4095));
   global_reloctab = (LispObj *) end;
+#ifdef LARGE_OBJECT_SPACE
+  /* Large objects go at the top, above anything that the dynamic area
+     can grow into. */
+  {
+    BytePtr los_start = (BytePtr) (((natural)end - large_object_area_size) & ~(heap_segment_size-1));
+
+    if ((los_start > start) && (los_start < end)) {
+      init_large_object_area(los_start, end);
+      end = los_start;
+    } else {
+      init_large_object_area(end, end);
+    }
+  }
+#endif
   reserved = new_area(start, end, AREA_VOID);
   /* The root of all evil is initially linked to itself. */
   reserved->pred = reserved->succ = reserved;
@@ -598,7 +627,7 @@ create_reserved_area(natural totalsize)
 #endif
       exit(1);
     }
-    managed_static_refidx = ReserveMemory(((((MANAGED_STATIC_SIZE>>dnode_shift)+255)>>8)+7)>>3);
+    managed_static_refidx = ReserveMemory(refidx_bytes(MANAGED_STATIC_SIZE>>dnode_shift));
     if (managed_static_refidx == NULL) {
 #ifdef WINDOWS
       wperror("allocate refidx for managed static area");
@@ -667,10 +696,14 @@ map_initial_markbits(BytePtr low, BytePtr high)
     fprintf(dbgout, "warning: prefix_dnodes not a multiple of 256\n");
   }
   prefix_index_bits = prefix_dnodes>>8;
+#ifdef BYTE_REFIDX
+  dynamic_refidx = (bitvector)(((BytePtr)global_refidx)+prefix_index_bits);
+#else
   if (prefix_index_bits & (WORD_SIZE-1)) {
     fprintf(dbgout, "warning: prefix_index_bits not a multiple of %d\n", WORD_SIZE);
   }
   dynamic_refidx = (bitvector)(((BytePtr)global_refidx)+(prefix_index_bits>>3));
+#endif
   relocatable_mark_ref_bits = dynamic_mark_ref_bits;
   n = align_to_power_of_2(markbits_size,log2_page_size);
   markbits_limit = ((BytePtr)dynamic_mark_ref_bits)+n;
@@ -683,8 +716,7 @@ lower_heap_start(BytePtr new_low, area *a)
   natural new_dnodes = area_dnode(low_markable_address,new_low);
 
   if (new_dnodes) {
-    natural n = (new_dnodes+7)>>3,
-      nidx = ((((new_dnodes+255)>>8)+7)>>3)>>node_shift;
+    natural n = (new_dnodes+7)>>3;
 
     BytePtr old_markbits = (BytePtr)dynamic_mark_ref_bits,
       new_markbits = old_markbits-n;
@@ -696,7 +728,11 @@ lower_heap_start(BytePtr new_low, area *a)
     a->static_dnodes += new_dnodes;
     a->ndnodes += new_dnodes;
     a->low = new_low;
-    a->refidx -= nidx;
+#ifdef BYTE_REFIDX
+    a->refidx = (bitvector)(((BytePtr)a->refidx)-(new_dnodes>>8));
+#else
+    a->refidx -= ((((new_dnodes+255)>>8)+7)>>3)>>node_shift;
+#endif
     low_markable_address = new_low;
     lisp_global(HEAP_START) = (LispObj)new_low;
     static_cons_area->ndnodes = area_dnode(static_cons_area->high,new_low);
@@ -1150,6 +1186,27 @@ usage_exit(char *herald, int exit_status, char* other_args)
   fprintf(dbgout, "\t-S, --stack-size <n>: set  size of initial thread's control stack to <n>\n");
   fprintf(dbgout, "\t-Z, --thread-stack-size <n>: set default size of first (listener)  thread's stacks based on <n>\n");
   fprintf(dbgout, "\t-b, --batch: exit when EOF on *STANDARD-INPUT*\n");
+#ifdef PARALLEL_GC
+  fprintf(dbgout, "\t--gc-threads <n>: use <n> threads to mark the heap during full GCs\n");
+#endif
+#ifdef CONCURRENT_GC
+  fprintf(dbgout, "\t--concurrent-gc: mark the tenured generation in the background\n");
+#endif
+#ifdef BACKGROUND_ZEROING
+  fprintf(dbgout, "\t--background-zeroing: clear free heap space in the background after GCs\n");
+#endif
+#ifdef HEAP_PLACEMENT
+  fprintf(dbgout, "\t--huge-pages: use transparent huge pages for the heap\n");
+  fprintf(dbgout, "\t--heap-numa <policy>: interleave, interleave:<nodes> or bind:<nodes>\n");
+#endif
+#ifdef LARGE_OBJECT_SPACE
+  fprintf(dbgout, "\t--large-object-space <n>: reserve <n> (default: %lld) bytes\n",
+          (u64_t) large_object_area_size);
+  fprintf(dbgout, "\t\t for large ivectors, in addition to the heap reserve\n");
+#endif
+#ifdef GC_SAFEPOINTS
+  fprintf(dbgout, "\t--safepoints: stop threads for the GC at safepoint polls when possible\n");
+#endif
   fprintf(dbgout, "\t--no-sigtrap : obscure option for running under GDB\n");
   fprintf(dbgout, "\t-I, --image-name <image-name>\n");
 #ifndef WINDOWS
@@ -1165,6 +1222,12 @@ usage_exit(char *herald, int exit_status, char* other_args)
 }
 
 int no_sigtrap = 0;
+#ifdef CONCURRENT_GC
+Boolean concurrent_gc_option = false;
+#endif
+#ifdef BACKGROUND_ZEROING
+Boolean background_zeroing_option = false;
+#endif
 #ifdef WINDOWS
 wchar_t *image_name = NULL;
 #else
@@ -1347,6 +1410,54 @@ process_options(int argc, char *argv[], wchar_t *shadow[])
           
 	}
 
+#ifdef PARALLEL_GC
+      } else if (strcmp(arg, "--gc-threads") == 0) {
+	if ((i+1) < argc) {
+	  val = argv[i+1];
+	  num_elide = 2;
+	  GCthreads = parse_numeric_option(val, "--gc-threads", 1);
+	} else {
+	  arg_error = 1;
+	}
+#endif
+#ifdef CONCURRENT_GC
+      } else if (strcmp(arg, "--concurrent-gc") == 0) {
+	concurrent_gc_option = true;
+	num_elide = 1;
+#endif
+#ifdef BACKGROUND_ZEROING
+      } else if (strcmp(arg, "--background-zeroing") == 0) {
+	background_zeroing_option = true;
+	num_elide = 1;
+#endif
+#ifdef HEAP_PLACEMENT
+      } else if (strcmp(arg, "--huge-pages") == 0) {
+	heap_placement |= HEAP_HUGE_PAGES;
+	num_elide = 1;
+      } else if (strcmp(arg, "--heap-numa") == 0) {
+	if (((i+1) < argc) && parse_heap_numa_option(argv[i+1])) {
+	  num_elide = 2;
+	} else {
+	  arg_error = 1;
+	}
+#endif
+#ifdef LARGE_OBJECT_SPACE
+      } else if (strcmp(arg, "--large-object-space") == 0) {
+	if ((i+1) < argc) {
+	  val = argv[i+1];
+	  num_elide = 2;
+	  large_object_area_size = parse_numeric_option(val,
+							"--large-object-space",
+							large_object_area_size);
+	} else {
+	  arg_error = 1;
+	}
+#endif
+#ifdef GC_SAFEPOINTS
+      } else if (strcmp(arg, "--safepoints") == 0) {
+	safepoint_timeout_usecs = 1000;
+	num_elide = 1;
+#endif
       } else if (strcmp(arg, "--no-sigtrap") == 0) {
 	no_sigtrap = 1;
 	num_elide = 1;
@@ -1981,6 +2092,7 @@ main
     }
   }
 
+  preferred_image_base = saved_image_base(image_name);
   while (1) {
     if (create_reserved_area(reserved_area_size)) {
       break;
@@ -2091,7 +2203,22 @@ main
   } else {
     lisp_global(OLDSPACE_DNODE_COUNT) = 0;
   }
+#ifdef PARALLEL_GC
+  if (GCthreads > 1) {
+    gc_start_workers(GCthreads);
+  }
+#endif
+#ifdef CONCURRENT_GC
+  if (concurrent_gc_option && !concurrent_mark_control(1)) {
+    fprintf(dbgout, "Concurrent marking isn't supported on this system.\n");
+  }
+#endif
   heap_dirty_limit = active_dynamic_area->active;
+#ifdef BACKGROUND_ZEROING
+  if (background_zeroing_option && !heap_zeroer_control(1)) {
+    fprintf(dbgout, "Couldn't start the heap zeroing thread.\n");
+  }
+#endif
   lisp_global(MANAGED_STATIC_REFBITS) = (LispObj)managed_static_refbits;
   lisp_global(MANAGED_STATIC_REFIDX) = (LispObj)managed_static_refidx;
   lisp_global(MANAGED_STATIC_DNODES) = (LispObj)managed_static_area->ndnodes;
@@ -2243,6 +2370,43 @@ check_for_embedded_image (
   return image_is_embedded;
 }
 
+/*
+  If the image at PATH was saved by a lisp whose heap wasn't at
+  IMAGE_BASE_ADDRESS, return the address that it was at: if we can
+  reserve the heap there, the image doesn't need to be relocated (which
+  would write to every page of it, so that processes using the same
+  image couldn't share them.)  Return NULL otherwise.
+*/
+BytePtr
+saved_image_base(
+#ifdef WINDOWS
+                 wchar_t *path
+#else
+                 char *path
+#endif
+                 )
+{
+#ifdef WINDOWS
+  int fd = wopen(path, O_RDONLY);
+#else  
+  int fd = open(path, O_RDONLY);
+#endif
+  BytePtr base = NULL;
+
+  if (fd >= 0) {
+    openmcl_image_file_header h;
+
+    if (find_openmcl_image_file_header(fd, &h) &&
+        (CANONICAL_IMAGE_BASE(&h) == (natural)IMAGE_BASE_ADDRESS) &&
+        (ACTUAL_IMAGE_BASE(&h) != (natural)IMAGE_BASE_ADDRESS) &&
+        ((ACTUAL_IMAGE_BASE(&h) & (heap_segment_size-1)) == 0)) {
+      base = (BytePtr)ACTUAL_IMAGE_BASE(&h);
+    }
+    close(fd);
+  }
+  return base;
+}
+
 LispObj
 load_image(
 #ifdef WINDOWS
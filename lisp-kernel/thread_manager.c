@@ -247,9 +247,57 @@ get_spin_lock(signed_natural *p, TCR *tcr)
 #endif
 
 #ifndef USE_FUTEX
+/*
+  A recursive lock is "avail" (0) or held (1).  A thread that finds it
+  held spins for a while if spinning has recently been worthwhile for
+  this lock, then registers itself as "waiting" and parks on the lock's
+  semaphore.  "spin_estimate" is a running average of the number of
+  spins that it took to get the lock (counting a thread that had to
+  park as 0), and a thread spins up to about twice that many times.
+  A lock whose owner usually holds it across blocking calls soon
+  stops being spun on.  (The spinner can't look at the owner's TCR to
+  see whether it's running: the owner might exit and free its TCR at
+  any time.)  When the owner releases a lock that
+  has parked waiters, it doesn't make it available: it sets "handoff"
+  and wakes one waiter, which takes ownership.  Newcomers can't barge
+  in ahead of parked waiters, and semaphores wake waiters in roughly
+  the order in which they started waiting.  Lisp code (%LOCK-RECURSIVE-LOCK-PTR
+  and friends) follows the same protocol on the same locks.
+*/
+int recursive_lock_spin_tries = 0;
+
+static signed_natural
+recursive_lock_spin_limit(RECURSIVE_LOCK m)
+{
+  signed_natural limit = (m->spin_estimate * 2) + 16;
+
+  return (limit < recursive_lock_spin_tries) ? limit : recursive_lock_spin_tries;
+}
+
+/* Caller holds the spinlock. */
+static void
+note_recursive_lock_spins(RECURSIVE_LOCK m, signed_natural spins)
+{
+  m->spin_estimate += (spins - m->spin_estimate) / 8;
+}
+
+static void
+take_recursive_lock(RECURSIVE_LOCK m, TCR *tcr, Boolean contended)
+{
+  m->avail = 1;
+  m->owner = tcr;
+  m->count = 1;
+  m->acquisitions++;
+  if (contended) {
+    m->contended++;
+  }
+}
+
 int
 lock_recursive_lock(RECURSIVE_LOCK m, TCR *tcr)
 {
+  signed_natural i, limit;
+  u64_t start = 0;
 
   if (tcr == NULL) {
     tcr = get_tcr(true);
@@ -258,19 +306,53 @@ lock_recursive_lock(RECURSIVE_LOCK m, TCR *tcr)
     m->count++;
     return 0;
   }
-  while (1) {
-    LOCK_SPINLOCK(m->spinlock,tcr);
-    ++m->avail;
-    if (m->avail == 1) {
-      m->owner = tcr;
-      m->count = 1;
+  limit = recursive_lock_spin_limit(m);
+  for (i = 0; ; i++) {
+    if (m->avail == 0) {
+      LOCK_SPINLOCK(m->spinlock,tcr);
+      if (m->avail == 0) {
+        take_recursive_lock(m, tcr, i != 0);
+        if (i != 0) {
+          note_recursive_lock_spins(m, i);
+        }
+        RELEASE_SPINLOCK(m->spinlock);
+        return 0;
+      }
       RELEASE_SPINLOCK(m->spinlock);
+    }
+    if (i == 0) {
+      /* Contended: the wait starts now, spinning included */
+      start = gc_timestamp_ns();
+    }
+    if (i >= limit) {
       break;
     }
+    SPIN_WAIT();
+  }
+  LOCK_SPINLOCK(m->spinlock,tcr);
+  if (m->avail == 0) {
+    take_recursive_lock(m, tcr, true);
     RELEASE_SPINLOCK(m->spinlock);
+    return 0;
+  }
+  if (limit != 0) {
+    note_recursive_lock_spins(m, 0);
+  }
+  m->waiting++;
+  RELEASE_SPINLOCK(m->spinlock);
+  while (1) {
     SEM_WAIT_FOREVER(m->signal);
+    LOCK_SPINLOCK(m->spinlock,tcr);
+    if (m->handoff) {
+      m->handoff = 0;
+      m->waiting--;
+      take_recursive_lock(m, tcr, true);
+      m->wait_usecs += (gc_timestamp_ns()-start)/1000;
+      RELEASE_SPINLOCK(m->spinlock);
+      return 0;
+    }
+    RELEASE_SPINLOCK(m->spinlock);
   }
-  return 0;
 }
 
 #else /* USE_FUTEX */
@@ -323,7 +405,8 @@ lock_recursive_lock(RECURSIVE_LOCK m, TCR *tcr)
 int
 unlock_recursive_lock(RECURSIVE_LOCK m, TCR *tcr)
 {
-  int ret = EPERM, pending;
+  int ret = EPERM;
+  Boolean wake = false;
 
   if (tcr == NULL) {
     tcr = get_tcr(true);
@@ -334,16 +417,14 @@ unlock_recursive_lock(RECURSIVE_LOCK m, TCR *tcr)
     if (m->count == 0) {
       LOCK_SPINLOCK(m->spinlock,tcr);
       m->owner = NULL;
-      pending = m->avail-1 + m->waiting;     /* Don't count us */
-      m->avail = 0;
-      --pending;
-      if (pending > 0) {
-        m->waiting = pending;
+      if (m->waiting > 0) {
+        m->handoff = 1;         /* still held, on behalf of a waiter */
+        wake = true;
       } else {
-        m->waiting = 0;
+        m->avail = 0;
       }
       RELEASE_SPINLOCK(m->spinlock);
-      if (pending >= 0) {
+      if (wake) {
 	SEM_RAISE(m->signal);
       }
     }
@@ -392,29 +473,24 @@ destroy_recursive_lock(RECURSIVE_LOCK m)
 int
 recursive_lock_trylock(RECURSIVE_LOCK m, TCR *tcr, int *was_free)
 {
-  TCR *owner = m->owner;
+  int ret = EBUSY;
 
   LOCK_SPINLOCK(m->spinlock,tcr);
-  if (owner == tcr) {
+  if (m->owner == tcr) {
     m->count++;
     if (was_free) {
       *was_free = 0;
-      RELEASE_SPINLOCK(m->spinlock);
-      return 0;
     }
-  }
-  if (store_conditional((natural*)&(m->avail), 0, 1) == 0) {
-    m->owner = tcr;
-    m->count = 1;
+    ret = 0;
+  } else if (m->avail == 0) {
+    take_recursive_lock(m, tcr, false);
     if (was_free) {
       *was_free = 1;
     }
-    RELEASE_SPINLOCK(m->spinlock);
-    return 0;
+    ret = 0;
   }
-
   RELEASE_SPINLOCK(m->spinlock);
-  return EBUSY;
+  return ret;
 }
 #else
 int
@@ -605,6 +681,89 @@ suspend_resume_handler(int signo, siginfo_t *info, ExceptionInformation *context
   SIGRETURN(context);
 }
 
+#ifdef GC_SAFEPOINTS
+natural safepoint_timeout_usecs = 0;
+
+/*
+  Whichever of the suspending thread and the target thread clears
+  the target's safepoint request flag handles the request: the target
+  by stopping at its safepoint, the suspending thread by falling back
+  to thread_suspend_signal.
+*/
+Boolean
+claim_safepoint_request(TCR *tcr)
+{
+  natural old, mask = ((natural)1)<<TCR_FLAG_BIT_SAFEPOINT_REQUEST;
+
+  do {
+    old = tcr->flags;
+    if ((old & mask) == 0) {
+      return false;
+    }
+  } while (store_conditional(&(tcr->flags), old, old & ~mask) != old);
+  return true;
+}
+
+/*
+  Called from the handler for a safepoint-poll trap.  If the thread
+  claims the request, it does just what suspend_resume_handler() would
+  have done: stop, or (at interrupt level -2 or below, where it mustn't
+  be suspended) note that a suspend is pending.  If the suspending
+  thread's already claimed the request, thread_suspend_signal is on
+  its way.  Either way, there's nothing else to do: the poll has
+  nothing to do with lisp interrupts.
+*/
+void
+stop_at_safepoint(TCR *tcr, ExceptionInformation *context)
+{
+  if (claim_safepoint_request(tcr)) {
+    if (TCR_INTERRUPT_LEVEL(tcr) <= (-2<<fixnumshift)) {
+      SET_TCR_FLAG(tcr,TCR_FLAG_BIT_PENDING_SUSPEND);
+    } else {
+      TCR_AUX(tcr)->suspend_context = context;
+      SEM_RAISE(TCR_AUX(tcr)->suspend);
+      SEM_WAIT_FOREVER(TCR_AUX(tcr)->resume);
+      TCR_AUX(tcr)->suspend_context = NULL;
+    }
+  }
+}
+
+static Boolean
+request_safepoint(TCR *tcr)
+{
+  if (atomic_incf(&(TCR_AUX(tcr)->suspend_count)) == 1) {
+    SET_TCR_FLAG(tcr,TCR_FLAG_BIT_SUSPEND_ACK_PENDING);
+    SET_TCR_FLAG(tcr,TCR_FLAG_BIT_SAFEPOINT_REQUEST);
+    return true;
+  }
+  return false;
+}
+
+/*
+  Wait until TCR claims its safepoint request.  If it's in (or enters)
+  foreign code, or doesn't reach a poll before the timeout, claim the
+  request and send it thread_suspend_signal instead.  Returns true if
+  the thread stopped at a safepoint.
+*/
+static Boolean
+await_safepoint(TCR *tcr, u64_t deadline)
+{
+  while (tcr->flags & (((natural)1)<<TCR_FLAG_BIT_SAFEPOINT_REQUEST)) {
+    if (((tcr->valence != TCR_STATE_LISP) ||
+         (gc_timestamp_ns() >= deadline)) &&
+        claim_safepoint_request(tcr)) {
+      if (pthread_kill((pthread_t)(tcr->osid), thread_suspend_signal) != 0) {
+        tcr->osid = 0;
+        CLR_TCR_FLAG(tcr,TCR_FLAG_BIT_SUSPEND_ACK_PENDING);
+      }
+      return false;
+    }
+    sched_yield();
+  }
+  return true;
+}
+#endif
+
   
 
 /*
@@ -1381,6 +1540,10 @@ shutdown_thread_tcr(void *arg)
 #ifdef DARWIN
 #endif
     LOCK(lisp_global(TCR_AREA_LOCK),current);
+#ifdef SAMPLING_PROFILER
+    profile_thread_stop(tcr);
+    alloc_profile_thread_stop(tcr);
+#endif
     vs = tcr->vs_area;
     tcr->vs_area = NULL;
 #ifndef ARM
@@ -1539,6 +1702,12 @@ thread_init_tcr(TCR *tcr, void *stack_base, natural stack_size)
 #ifdef LINUX
   linux_exception_init(tcr);
 #endif
+#ifdef SAMPLING_PROFILER
+  LOCK(lisp_global(TCR_AREA_LOCK),tcr);
+  profile_thread_start(tcr);
+  alloc_profile_thread_start(tcr);
+  UNLOCK(lisp_global(TCR_AREA_LOCK),tcr);
+#endif
 #ifdef WINDOWS
   TCR_AUX(tcr)->io_datum = (VOID *)CreateEvent(NULL, true, false, NULL);
   TCR_AUX(tcr)->native_thread_info = malloc(sizeof(CONTEXT));
@@ -1605,6 +1774,7 @@ count_cpus()
   GetSystemInfo(&si);
   if (si.dwNumberOfProcessors > 1) {
     spin_lock_tries = 1024;
+    recursive_lock_spin_tries = 1024;
   }
 }
 #else
@@ -1615,6 +1785,7 @@ count_cpus()
   
   if (n > 1) {
     spin_lock_tries = 1024;
+    recursive_lock_spin_tries = 1024;
   }
 }
 #endif
@@ -2318,10 +2489,22 @@ suspend_other_threads(Boolean for_gc)
   TCR *current = get_tcr(true), *other, *next;
   int dead_tcr_count = 0;
   Boolean all_acked;
+#ifdef GC_SAFEPOINTS
+  Boolean safepoints = for_gc && (safepoint_timeout_usecs != 0);
+  natural nsafepoint = 0, nsignalled = 0, ntimeouts = 0;
+  u64_t deadline;
+#endif
 
   LOCK(lisp_global(TCR_AREA_LOCK), current);
   for (other = TCR_AUX(current)->next; other != current; other = TCR_AUX(other)->next) {
     if ((TCR_AUX(other)->osid != 0)) {
+#ifdef GC_SAFEPOINTS
+      if (safepoints && (other->valence == TCR_STATE_LISP)) {
+        request_safepoint(other);
+        continue;
+      }
+      nsignalled++;
+#endif
       suspend_tcr(other);
       if (TCR_AUX(other)->osid == 0) {
 	dead_tcr_count++;
@@ -2331,6 +2514,30 @@ suspend_other_threads(Boolean for_gc)
     }
   }
 
+#ifdef GC_SAFEPOINTS
+  if (safepoints) {
+    deadline = gc_timestamp_ns() + (safepoint_timeout_usecs * 1000);
+    for (other = TCR_AUX(current)->next; other != current; other = TCR_AUX(other)->next) {
+      if (other->flags & (((natural)1)<<TCR_FLAG_BIT_SAFEPOINT_REQUEST)) {
+        if (await_safepoint(other, deadline)) {
+          nsafepoint++;
+        } else {
+          nsignalled++;
+          if (other->valence == TCR_STATE_LISP) {
+            ntimeouts++;
+          }
+          if (TCR_AUX(other)->osid == 0) {
+            dead_tcr_count++;
+          }
+        }
+      }
+    }
+  }
+  if (for_gc) {
+    gc_event_note_safepoints(nsafepoint, nsignalled, ntimeouts);
+  }
+#endif
+
   do {
     all_acked = true;
     for (other = TCR_AUX(current)->next; other != current; other = TCR_AUX(other)->next) {
@@ -109,6 +109,13 @@ Boolean extern log_tcr_info;
 #define LOCK_SPINLOCK(x,tcr) get_spin_lock(&(x),tcr)
 #define RELEASE_SPINLOCK(x) (x)=0
 
+/* Tell the processor that we're busy-waiting */
+#if defined(X86) && defined(__GNUC__)
+#define SPIN_WAIT() __asm__ __volatile__("pause")
+#else
+#define SPIN_WAIT()
+#endif
+
 #ifdef WIN_32
 #define TCR_TO_TSD(tcr) ((void *)((natural)(tcr)))
 #define TCR_FROM_TSD(tsd) ((TCR *)((natural)(tsd)))
@@ -167,6 +174,11 @@ typedef struct
   signed_natural waiting;
   void *malloced_ptr;
   signed_natural spinlock;
+  signed_natural handoff;       /* owner released it to a parked waiter */
+  natural acquisitions;         /* contention statistics, updated */
+  natural contended;            /* while holding the spinlock */
+  natural wait_usecs;
+  signed_natural spin_estimate; /* average spins that got the lock */
 } _recursive_lock, *RECURSIVE_LOCK;
 
 
@@ -218,6 +230,24 @@ Boolean lisp_resume_tcr(TCR *);
 void lisp_suspend_other_threads(void);
 void lisp_resume_other_threads(void);
 
+/*
+  Code compiled with *COMPILE-SAFEPOINT-POLLS* checks the safepoint
+  request bit in tcr->flags on function entry and at loop heads, and
+  traps (XUUO_SAFEPOINT) if it's set.  If safepoint_timeout_usecs is
+  non-zero, the GC asks threads that're running lisp code to stop at
+  their next poll, and only signals threads that're in foreign code or
+  that don't reach a poll in time.
+*/
+#if defined(X86) && !defined(WINDOWS)
+#define GC_SAFEPOINTS 1
+#endif
+
+#ifdef GC_SAFEPOINTS
+extern natural safepoint_timeout_usecs;
+Boolean claim_safepoint_request(TCR *);
+void stop_at_safepoint(TCR *, ExceptionInformation *);
+#endif
+
 typedef struct
 {
   signed_natural spin; /* need spin lock to change fields */
@@ -264,6 +294,63 @@ allocate_stack(natural);
 void
 suspend_resume_handler(int, siginfo_t *, ExceptionInformation *);
 
+#if defined(X8664) && defined(LINUX)
+#define SAMPLING_PROFILER 1
+#endif
+
+#ifdef SAMPLING_PROFILER
+/*
+  While the profiler's running, each lisp thread has a CPU-time timer
+  that sends it SIGPROF; the handler records a sample in the thread's
+  profile_buffer.  Records are PROFILE_RECORD_WORDS words long: a
+  fixnum N, a fixnum kind, and N more words: for a sample taken in
+  foreign code, the PC as a fixnum, then (for any kind but GC) the
+  functions on the lisp stack, innermost first.  Only the thread
+  writes records in [tail,head) and only the reader (lisp) advances
+  tail; the GC treats the functions in unread records as roots.
+  Buffers outlive their threads; they're all on profile_buffers until
+  the profiler discards them.
+
+  The allocation profiler uses the same kind of buffers (on
+  alloc_profile_buffers) to sample about one allocation per so many
+  bytes that a thread conses.  Its records are of kind ALLOC: the
+  words after the kind are the new object (or 0 if it couldn't safely
+  be recorded), its size in bytes and its subtag (as fixnums), then
+  the functions on the lisp stack.
+*/
+#define PROFILE_RECORD_WORDS 32
+#define PROFILE_SAMPLE_LISP 0
+#define PROFILE_SAMPLE_FOREIGN 1
+#define PROFILE_SAMPLE_GC 2
+#define PROFILE_SAMPLE_ALLOC 3
+
+typedef struct profile_buffer {
+  struct profile_buffer *next;
+  natural header_words;         /* offset of records[], in words */
+  natural record_words;         /* PROFILE_RECORD_WORDS */
+  natural capacity;             /* in records */
+  natural head;                 /* records ever written */
+  natural tail;                 /* records ever read */
+  natural dropped;              /* samples lost because the buffer was full */
+  natural tid;                  /* of the thread that owns it */
+  natural live;                 /* false once the thread's exited */
+  natural countdown;            /* allocation: bytes until the next sample */
+  natural random_state;         /* allocation: for jittering countdown */
+  timer_t timer;
+  LispObj records[1];
+} profile_buffer;
+
+extern profile_buffer *profile_buffers;
+void profile_thread_start(TCR *);
+void profile_thread_stop(TCR *);
+extern profile_buffer *alloc_profile_buffers;
+void alloc_profile_thread_start(TCR *);
+void alloc_profile_thread_stop(TCR *);
+void mark_profile_samples(void);
+void forward_profile_samples(void);
+void discard_profile_samples(void);
+#endif
+
 /* Maybe later
 Boolean
 rwlock_try_rlock(rwlock *);
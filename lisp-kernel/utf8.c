@@ -0,0 +1,256 @@
+/*
+   This file is part of Clozure CL.
+
+   Clozure CL is licensed under the terms of the Lisp Lesser GNU Public
+   License , known as the LLGPL and distributed with Clozure CL as the
+   file "LICENSE".  The LLGPL consists of a preamble and the LGPL,
+   which is distributed with Clozure CL as the file "LGPL".  Where these
+   conflict, the preamble takes precedence.
+
+   Clozure CL is referenced in the preamble as the "LIBRARY."
+
+   The LLGPL is also available online at
+   http://opensource.franz.com/preamble.html
+*/
+
+/*
+  Bulk conversion between UTF-8 octets and lisp (UTF-32) strings.
+
+  The lisp side (the :UTF-8 character encoding's vector functions and
+  the UTF-8 stream READ-LINE and READ-VECTOR functions) calls these
+  with the GC disabled and pointers to the data of octet vectors and
+  strings.  Runs of ASCII characters are handled 16 at a time with
+  SSE2 when it's available; other well-formed sequences are converted
+  one at a time.  Anything that isn't well-formed (or that's truncated
+  by the end of the input) stops the conversion, so that the lisp code
+  can deal with it (and report or replace it) the way it always has.
+*/
+
+#include "lisp.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+  Decode at most NSRC octets from SRC into at most NDST code points at
+  DST.  Stop before an octet equal to STOP (which must be < #x80, or
+  negative if there's no stop octet) and before any ill-formed or
+  incomplete sequence.  Return the number of code points stored and
+  set *NUSED to the number of octets consumed.
+*/
+natural
+utf8_decode_run(unsigned char *src, natural nsrc,
+                unsigned *dst, natural ndst,
+                int stop, natural *nused)
+{
+  natural i = 0, j = 0;
+  unsigned c, c1, c2, c3, code;
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128(),
+    stops = _mm_set1_epi8((char)((stop < 0) ? 0x80 : stop));
+#endif
+
+  while ((i < nsrc) && (j < ndst)) {
+    c = src[i];
+    if (c < 0x80) {
+      if ((int)c == stop) {
+        break;
+      }
+      dst[j++] = c;
+      i++;
+#ifdef __SSE2__
+      while (((i + 16) <= nsrc) && ((j + 16) <= ndst)) {
+        __m128i v = _mm_loadu_si128((__m128i *)(src + i)), lo, hi;
+        int mask = _mm_movemask_epi8(v) |
+          _mm_movemask_epi8(_mm_cmpeq_epi8(v, stops));
+
+        if (mask) {
+          break;
+        }
+        lo = _mm_unpacklo_epi8(v, zero);
+        hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(dst + j + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(dst + j + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i *)(dst + j + 12), _mm_unpackhi_epi16(hi, zero));
+        i += 16;
+        j += 16;
+      }
+#endif
+      continue;
+    }
+    if (c < 0xc2) {
+      break;
+    }
+    if (c < 0xe0) {
+      if ((i + 1) >= nsrc) {
+        break;
+      }
+      c1 = src[i+1] ^ 0x80;
+      if (c1 >= 0x40) {
+        break;
+      }
+      dst[j++] = ((c & 0x1f) << 6) | c1;
+      i += 2;
+    } else if (c < 0xf0) {
+      if ((i + 2) >= nsrc) {
+        break;
+      }
+      c1 = src[i+1] ^ 0x80;
+      c2 = src[i+2] ^ 0x80;
+      if ((c1 >= 0x40) || (c2 >= 0x40) || ((c == 0xe0) && (c1 < 0x20))) {
+        break;
+      }
+      code = ((c & 0xf) << 12) | (c1 << 6) | c2;
+      if ((code >= 0xd800) && (code < 0xe000)) {
+        break;
+      }
+      dst[j++] = code;
+      i += 3;
+    } else if (c < 0xf8) {
+      if ((i + 3) >= nsrc) {
+        break;
+      }
+      c1 = src[i+1] ^ 0x80;
+      c2 = src[i+2] ^ 0x80;
+      c3 = src[i+3] ^ 0x80;
+      if ((c1 >= 0x40) || (c2 >= 0x40) || (c3 >= 0x40) ||
+          ((c == 0xf0) && (c1 < 0x10))) {
+        break;
+      }
+      code = ((c & 7) << 18) | (c1 << 12) | (c2 << 6) | c3;
+      if (code >= 0x110000) {
+        break;
+      }
+      dst[j++] = code;
+      i += 4;
+    } else {
+      break;
+    }
+  }
+  *nused = i;
+  return j;
+}
+
+/*
+  Encode at most NSRC code points from SRC as UTF-8, storing at most
+  NDST octets at DST; stop before a character whose encoding wouldn't
+  fit.  Return the number of octets stored and set *NUSED to the number
+  of code points consumed.
+*/
+natural
+utf8_encode_run(unsigned *src, natural nsrc,
+                unsigned char *dst, natural ndst,
+                natural *nused)
+{
+  natural i = 0, j = 0;
+  unsigned code;
+#ifdef __SSE2__
+  __m128i high = _mm_set1_epi32(~0x7f), zero = _mm_setzero_si128();
+#endif
+
+  while (i < nsrc) {
+    code = src[i];
+    if (code < 0x80) {
+      if (j == ndst) {
+        break;
+      }
+      dst[j++] = code;
+      i++;
+#ifdef __SSE2__
+      while (((i + 16) <= nsrc) && ((j + 16) <= ndst)) {
+        __m128i a = _mm_loadu_si128((__m128i *)(src + i)),
+          b = _mm_loadu_si128((__m128i *)(src + i + 4)),
+          c = _mm_loadu_si128((__m128i *)(src + i + 8)),
+          d = _mm_loadu_si128((__m128i *)(src + i + 12)),
+          any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, high), zero)) != 0xffff) {
+          break;
+        }
+        _mm_storeu_si128((__m128i *)(dst + j),
+                         _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                          _mm_packs_epi32(c, d)));
+        i += 16;
+        j += 16;
+      }
+#endif
+      continue;
+    }
+    if (code < 0x800) {
+      if ((j + 2) > ndst) {
+        break;
+      }
+      dst[j] = 0xc0 | (code >> 6);
+      dst[j+1] = 0x80 | (code & 0x3f);
+      j += 2;
+    } else if (code < 0x10000) {
+      if ((j + 3) > ndst) {
+        break;
+      }
+      dst[j] = 0xe0 | (code >> 12);
+      dst[j+1] = 0x80 | ((code >> 6) & 0x3f);
+      dst[j+2] = 0x80 | (code & 0x3f);
+      j += 3;
+    } else {
+      if ((j + 4) > ndst) {
+        break;
+      }
+      dst[j] = 0xf0 | ((code >> 18) & 7);
+      dst[j+1] = 0x80 | ((code >> 12) & 0x3f);
+      dst[j+2] = 0x80 | ((code >> 6) & 0x3f);
+      dst[j+3] = 0x80 | (code & 0x3f);
+      j += 4;
+    }
+    i++;
+  }
+  *nused = i;
+  return j;
+}
+
+/*
+  Count the characters encoded in the first NSRC octets at SRC, the
+  way the lisp UTF-8-LENGTH-OF-VECTOR-ENCODING function does: judging
+  the length of each sequence by its first octet, without validating
+  the rest, and not counting a sequence that would extend past the end.
+  Return the count and set *NUSED to the number of octets it covers.
+*/
+natural
+utf8_length_of_encoding(unsigned char *src, natural nsrc, natural *nused)
+{
+  natural i = 0, nchars = 0, next;
+  unsigned c;
+
+  while (i < nsrc) {
+#ifdef __SSE2__
+    while (((i + 16) <= nsrc) &&
+           (_mm_movemask_epi8(_mm_loadu_si128((__m128i *)(src + i))) == 0)) {
+      i += 16;
+      nchars += 16;
+    }
+    if (i == nsrc) {
+      break;
+    }
+#endif
+    c = src[i];
+    if (c < 0xc2) {
+      next = i + 1;
+    } else if (c < 0xe0) {
+      next = i + 2;
+    } else if (c < 0xf0) {
+      next = i + 3;
+    } else if (c < 0xf8) {
+      next = i + 4;
+    } else {
+      next = i + 1;
+    }
+    if (next > nsrc) {
+      break;
+    }
+    nchars++;
+    i = next;
+  }
+  *nused = i;
+  return nchars;
+}
@@ -327,6 +327,11 @@ typedef struct tcr {
   void *safe_ref_address;
   void *pending_io_info;
   void *io_datum;
+  LispObj allocation_gc_num;    /* GC_NUM as of last new segment */
+  natural allocation_refills;   /* new segments since then */
+  void *profile_buffer;         /* for the sampling profiler */
+  void *alloc_profile_buffer;   /* for the allocation profiler */
+  char *allocation_segment_base; /* save_allocbase may be above this */
 } TCR;
 
 #define t_offset (t_value-nil_value)
@@ -772,6 +772,11 @@ TCR_BIAS = 0
          _node(safe_ref_address)
          _node(pending_io_info)
          _node(io_datum)
+         _node(allocation_gc_num) /* GC_NUM as of last new segment   */
+         _node(allocation_refills) /* new segments since then   */
+         _node(profile_buffer)  /* for the sampling profiler   */
+         _node(alloc_profile_buffer) /* for the allocation profiler   */
+         _node(allocation_segment_base) /* save_allocbase may be above this   */
 	_ends
 
         _struct(win64_context,0)
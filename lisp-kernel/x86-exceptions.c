@@ -31,6 +31,7 @@
 #include <sys/mman.h>
 #include <fpu_control.h>
 #include <linux/prctl.h>
+#include <sys/syscall.h>
 #endif
 #ifdef DARWIN
 #include <sysexits.h>
@@ -128,6 +129,17 @@ update_bytes_allocated(TCR* tcr, void *cur_allocptr)
 
   if (last && (tcr->save_allocbase != ((void *)VOID_ALLOCPTR))) {
     *bytes_allocated += last - current;
+#ifdef SAMPLING_PROFILER
+    {
+      profile_buffer *pb = tcr->alloc_profile_buffer;
+
+      if (pb) {
+        natural consumed = last - current;
+
+        pb->countdown = (consumed < pb->countdown) ? pb->countdown - consumed : 0;
+      }
+    }
+#endif
   }
   tcr->last_allocptr = 0;
 }
@@ -141,6 +153,169 @@ update_bytes_allocated(TCR* tcr, void *cur_allocptr)
 
 
 
+#ifdef X8664
+/*
+  Adapt a thread's allocation quantum to how fast it conses.  A thread
+  that's needed several new segments since the last GC gets bigger
+  ones, so it traps less often; one that's hardly allocated anything
+  between GCs drifts back toward the default quantum, so memory isn't
+  tied up in big, mostly empty segments.  A segment never takes more
+  than 1/16 of what's left before the next GC.
+*/
+#define ALLOCATION_REFILLS_PER_GROWTH 4
+#define MAX_LOG2_ALLOCATION_QUANTUM (log2_heap_segment_size+4)
+
+void
+adapt_allocation_quantum(TCR *tcr)
+{
+  area *a = active_dynamic_area;
+  natural
+    log2_quantum = tcr->log2_allocation_quantum,
+    log2_default = unbox_fixnum(lisp_global(DEFAULT_ALLOCATION_QUANTUM)),
+    room = a->high - a->active;
+  LispObj gc_num = lisp_global(GC_NUM);
+
+  if (tcr->allocation_gc_num != gc_num) {
+    if ((tcr->allocation_refills < 2) && (log2_quantum > log2_default)) {
+      log2_quantum--;
+    }
+    tcr->allocation_gc_num = gc_num;
+    tcr->allocation_refills = 0;
+  }
+  if (a->older && lisp_global(OLDEST_EPHEMERAL)) {
+    natural used = a->active - a->low;
+
+    room = (used < a->threshold) ? a->threshold - used : 0;
+  }
+  if (((++tcr->allocation_refills % ALLOCATION_REFILLS_PER_GROWTH) == 0) &&
+      (log2_quantum < MAX_LOG2_ALLOCATION_QUANTUM) &&
+      ((1L<<(log2_quantum+1)) <= (room >> 4))) {
+    log2_quantum++;
+  }
+  tcr->log2_allocation_quantum = log2_quantum;
+}
+#endif
+
+#ifdef SAMPLING_PROFILER
+/*
+  The allocation profiler samples an allocation whenever a thread's
+  consed another (jittered) alloc_profile_interval bytes.  Rather than
+  checking in the allocation sequence, it raises tcr.save_allocbase
+  to the next sample point, so that the allocation that crosses it
+  traps; fast_handle_alloc_trap() records it and moves the limit on,
+  in the same segment.  tcr.allocation_segment_base is the segment's
+  real base.
+*/
+static natural alloc_profile_interval = 0, alloc_profile_capacity = 0;
+profile_buffer *alloc_profile_buffers = NULL;
+
+static Boolean profile_code_address_p(LispObj);
+natural profile_record_frames(TCR *, lisp_frame *, LispObj *, natural, natural);
+
+static natural
+next_allocation_sample_interval(profile_buffer *pb)
+{
+  natural x = pb->random_state;
+
+  /* xorshift64; jitter so that sampling doesn't fall into step with
+     a program's allocation pattern. */
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  pb->random_state = x;
+  return (alloc_profile_interval/2) + (x % alloc_profile_interval);
+}
+
+/* Make the thread trap when it's allocated pb->countdown more bytes
+   (or at the end of the segment) */
+static void
+set_allocation_sample_limit(TCR *tcr)
+{
+  profile_buffer *pb = tcr->alloc_profile_buffer;
+  BytePtr
+    base = (BytePtr)tcr->allocation_segment_base,
+    last = (BytePtr)tcr->last_allocptr;
+
+  if (tcr->save_allocbase == (void *)VOID_ALLOCPTR) {
+    return;
+  }
+  if (pb && last && ((natural)(last - base) > pb->countdown)) {
+    tcr->save_allocbase = (void *)(last - pb->countdown);
+  } else {
+    tcr->save_allocbase = (void *)base;
+  }
+}
+
+/*
+  Record the allocation of nbytes at obj, with the header in
+  "header" if obj is a uvector.  obj is 0 if the object might be seen
+  by the GC before it's initialized.
+*/
+static void
+record_allocation_sample(profile_buffer *pb, ExceptionInformation *xp, TCR *tcr,
+                         LispObj obj, natural nbytes, LispObj header)
+{
+  natural head, n = 3;
+  LispObj *rec, f;
+
+  head = pb->head;
+  pb->countdown = next_allocation_sample_interval(pb);
+  if ((head - pb->tail) >= pb->capacity) {
+    pb->dropped++;
+    return;
+  }
+  rec = pb->records + ((head % pb->capacity) * PROFILE_RECORD_WORDS);
+  rec[2] = obj;
+  rec[3] = box_fixnum(nbytes);
+  rec[4] = box_fixnum(header ? header_subtag(header) : fulltag_cons);
+  f = xpGPR(xp,Ifn);
+  if (functionp(f) && profile_code_address_p(f)) {
+    rec[2+n++] = f;
+  }
+  n = profile_record_frames(tcr, (lisp_frame *)xpGPR(xp,Ifp), rec+2, n, PROFILE_RECORD_WORDS-2);
+  rec[0] = box_fixnum(n);
+  rec[1] = box_fixnum(PROFILE_SAMPLE_ALLOC);
+  __sync_synchronize();
+  pb->head = head+1;
+}
+
+/*
+  The allocation that trapped at xp has just been satisfied; sample it
+  if it crossed the sample point, then set the next one.
+*/
+static void
+note_allocation(ExceptionInformation *xp, TCR *tcr, natural bytes_needed, Boolean crossed)
+{
+  profile_buffer *pb = tcr->alloc_profile_buffer;
+  LispObj obj = xpGPR(xp,Iallocptr);
+
+  if (pb && (crossed || (pb->countdown < bytes_needed))) {
+    record_allocation_sample(pb, xp, tcr, obj, bytes_needed,
+                             (fulltag_of(obj) == fulltag_misc) ? xpGPR(xp,Iimm0) : 0);
+  }
+  set_allocation_sample_limit(tcr);
+}
+
+/*
+  Large ivectors are allocated on the slow path, where the thread may
+  be suspended (and its allocation backed out) before the object's
+  initialized, so the object itself isn't recorded.
+*/
+static void
+note_large_allocation(ExceptionInformation *xp, TCR *tcr, natural bytes_needed)
+{
+  profile_buffer *pb = tcr->alloc_profile_buffer;
+
+  if (pb) {
+    if (pb->countdown < bytes_needed) {
+      record_allocation_sample(pb, xp, tcr, 0, bytes_needed, xpGPR(xp,Iimm0));
+    } else {
+      pb->countdown -= bytes_needed;
+    }
+  }
+}
+#endif
+
 void
 platform_new_heap_segment(ExceptionInformation *xp, TCR *tcr, BytePtr low, BytePtr high)
 {
@@ -148,6 +323,13 @@ platform_new_heap_segment(ExceptionInformation *xp, TCR *tcr, BytePtr low, ByteP
   tcr->save_allocptr = (void *)high;
   xpGPR(xp,Iallocptr) = (LispObj) high;
   tcr->save_allocbase = (void *) low;
+#ifdef X8664
+  adapt_allocation_quantum(tcr);
+#endif
+#ifdef SAMPLING_PROFILER
+  tcr->allocation_segment_base = (char *)low;
+  set_allocation_sample_limit(tcr);
+#endif
 }
 
 Boolean
@@ -197,6 +379,12 @@ allocate_object(ExceptionInformation *xp,
 
 natural gc_deferred = 0, full_gc_deferred = 0;
 
+#ifdef LINUX
+static ExceptionInformation *snapshot_xp = NULL;
+static natural snapshot_flags = 0;
+signed_natural fork_heap_snapshot(TCR *, signed_natural);
+#endif
+
 signed_natural
 flash_freeze(TCR *tcr, signed_natural param)
 {
@@ -218,6 +406,9 @@ handle_gc_trap(ExceptionInformation *xp, TCR *tcr)
   
   natural gc_previously_deferred = gc_deferred;
 
+  /* Several of these change the dynamic area's active or high
+     pointers, sometimes without stopping other threads. */
+  inhibit_heap_claims();
   switch (selector) {
   case GC_TRAP_FUNCTION_EGC_CONTROL:
     egc_control(arg != 0, a->active);
@@ -271,6 +462,62 @@ handle_gc_trap(ExceptionInformation *xp, TCR *tcr)
     xpGPR(xp, Iimm0) = lisp_heap_notify_threshold;
     break;
 
+  case GC_TRAP_FUNCTION_GC_THREADS:
+#ifdef PARALLEL_GC
+    if (((signed_natural)xpGPR(xp, Iarg_z)) > 0) {
+      gc_start_workers(unbox_fixnum(xpGPR(xp, Iarg_z)));
+    }
+    xpGPR(xp, Iarg_z) = box_fixnum(GCthreads);
+#else
+    xpGPR(xp, Iarg_z) = box_fixnum(1);
+#endif
+    break;
+
+  case GC_TRAP_FUNCTION_CONCURRENT_GC:
+#ifdef CONCURRENT_GC
+    xpGPR(xp, Iarg_z) = lisp_nil +
+      (concurrent_mark_control(unbox_fixnum(xpGPR(xp, Iarg_z))) ? t_offset : 0);
+#else
+    xpGPR(xp, Iarg_z) = lisp_nil;
+#endif
+    break;
+
+  case GC_TRAP_FUNCTION_BACKGROUND_ZEROING:
+#ifdef BACKGROUND_ZEROING
+    xpGPR(xp, Iarg_z) = lisp_nil +
+      (heap_zeroer_control(unbox_fixnum(xpGPR(xp, Iarg_z))) ? t_offset : 0);
+#else
+    xpGPR(xp, Iarg_z) = lisp_nil;
+#endif
+    break;
+
+  case GC_TRAP_FUNCTION_SNAPSHOT:
+#ifdef LINUX
+    snapshot_xp = xp;
+    snapshot_flags = unbox_fixnum(xpGPR(xp, Iarg_y));
+    xpGPR(xp, Iarg_z) = box_fixnum(gc_like_from_xp(xp, fork_heap_snapshot, arg));
+    snapshot_xp = NULL;
+#else
+    xpGPR(xp, Iarg_z) = box_fixnum(-ENOSYS);
+#endif
+    break;
+
+  case GC_TRAP_FUNCTION_EGC_PAUSE_TARGET:
+    /* In microseconds; 0 disables it */
+    if (((signed_natural)xpGPR(xp, Iarg_z)) >= 0) {
+      egc_pause_target_ns = (u64_t)unbox_fixnum(xpGPR(xp, Iarg_z))*1000;
+    }
+    xpGPR(xp, Iarg_z) = box_fixnum(egc_pause_target_ns/1000);
+    break;
+
+  case GC_TRAP_FUNCTION_EGC_TIME_GOAL:
+    /* A percentage of elapsed time; 0 disables it */
+    if (((signed_natural)xpGPR(xp, Iarg_z)) >= 0) {
+      egc_time_percent = unbox_fixnum(xpGPR(xp, Iarg_z));
+    }
+    xpGPR(xp, Iarg_z) = box_fixnum(egc_time_percent);
+    break;
+
   case GC_TRAP_FUNCTION_ENSURE_STATIC_CONSES:
     ensure_static_conses(xp, tcr, 32768);
     break;
@@ -300,6 +547,15 @@ handle_gc_trap(ExceptionInformation *xp, TCR *tcr)
       selector = GC_TRAP_FUNCTION_GC;
     }
     
+#ifdef CONCURRENT_GC
+    /* Don't let anything that's become garbage since the tenured
+       generation was marked survive an explicit full GC */
+    GCconcurrent_discard = true;
+#endif
+#ifdef LARGE_OBJECT_SPACE
+    /* Purified areas and saved images can't reference large objects */
+    GCevacuating_large_objects = (selector > GC_TRAP_FUNCTION_GC);
+#endif
     if (egc_was_enabled) {
       egc_control(false, (BytePtr) a->active);
     }
@@ -325,12 +581,14 @@ handle_gc_trap(ExceptionInformation *xp, TCR *tcr)
       if (selector & GC_TRAP_FUNCTION_SAVE_APPLICATION) {
         OSErr err;
         extern OSErr save_application(int, Boolean);
+        extern Boolean save_image_compressed;
         area *vsarea = tcr->vs_area;
 
 #ifdef WINDOWS	
         arg = _open_osfhandle(arg,0);
 #endif
         nrs_TOPLFUNC.vcell = *((LispObj *)(vsarea->high)-1);
+        save_image_compressed = ((selector & GC_TRAP_FUNCTION_SAVE_COMPRESSED) != 0);
         err = save_application((int)arg, egc_was_enabled);
         if (err == noErr) {
           _exit(0);
@@ -352,6 +610,7 @@ handle_gc_trap(ExceptionInformation *xp, TCR *tcr)
     }
     break;
   }
+  allow_heap_claims();
   return true;
 }
 
@@ -581,27 +840,84 @@ allocate_list(ExceptionInformation *xp, TCR *tcr)
   return true;
 }
 
-Boolean
-handle_alloc_trap(ExceptionInformation *xp, TCR *tcr, Boolean *notify)
+/* How many bytes the allocation that trapped at xp needs, and its
+   displacement from the allocptr. */
+natural
+alloc_trap_bytes_needed(ExceptionInformation *xp, signed_natural *disp)
 {
-  natural cur_allocptr, bytes_needed;
-  unsigned allocptr_tag;
-  signed_natural disp;
-  
-  cur_allocptr = xpGPR(xp,Iallocptr);
-  allocptr_tag = fulltag_of(cur_allocptr);
+  natural cur_allocptr = xpGPR(xp,Iallocptr);
+  unsigned allocptr_tag = fulltag_of(cur_allocptr);
+
   if (allocptr_tag == fulltag_misc) {
 #ifdef X8664
-    disp = xpGPR(xp,Iimm1);
+    *disp = xpGPR(xp,Iimm1);
 #else
-    disp = xpGPR(xp,Iimm0);
+    *disp = xpGPR(xp,Iimm0);
 #endif
   } else {
-    disp = dnode_size-fulltag_cons;
+    *disp = dnode_size-fulltag_cons;
   }
-  bytes_needed = disp+allocptr_tag;
+  return *disp+allocptr_tag;
+}
+
+#ifdef LARGE_OBJECT_SPACE
+/*
+  If the allocation that trapped at xp is of a big enough ivector,
+  put it in the large object area, where the GC won't have to copy it
+  around.  The thread's allocation segment is left as it was: the
+  trapping code stores the header through the allocptr register and
+  clears the tag bits in tcr.save_allocptr, as usual.
+*/
+Boolean
+allocate_large_ivector(ExceptionInformation *xp, natural bytes_needed, signed_natural disp, TCR *tcr)
+{
+  BytePtr p;
+  LispObj segment_allocptr;
 
-  update_bytes_allocated(tcr,((BytePtr)(cur_allocptr+disp)));
+  if ((bytes_needed < LARGE_OBJECT_THRESHOLD) ||
+      (fulltag_of(xpGPR(xp,Iallocptr)) != fulltag_misc) ||
+      (!immheader_tag_p(fulltag_of(xpGPR(xp,Iimm0))))) {
+    return false;
+  }
+  if (large_object_bytes_since_gc >= lisp_heap_gc_threshold) {
+    untenure_from_area(tenured_area); /* force a full GC */
+    gc_from_xp(xp, 0L);
+    did_gc_notification_since_last_full_gc = false;
+  }
+  p = allocate_large_object(bytes_needed);
+  if (p == NULL) {
+    return false;
+  }
+  /* A GC voids the thread's segment */
+  if (tcr->save_allocbase == (void *)VOID_ALLOCPTR) {
+    segment_allocptr = VOID_ALLOCPTR;
+  } else {
+    segment_allocptr = xpGPR(xp,Iallocptr)+disp;
+    tcr->last_allocptr = (void *)segment_allocptr;
+  }
+  *(u64_t *)&TCR_AUX(tcr)->bytes_allocated += bytes_needed;
+#ifdef SAMPLING_PROFILER
+  note_large_allocation(xp, tcr, bytes_needed);
+#endif
+  xpGPR(xp,Iallocptr) = (LispObj)p+fulltag_misc;
+  tcr->save_allocptr = (void *)(segment_allocptr+fulltag_misc);
+  return true;
+}
+#endif
+
+Boolean
+handle_alloc_trap(ExceptionInformation *xp, TCR *tcr, Boolean *notify)
+{
+  natural bytes_needed;
+  signed_natural disp;
+  
+  bytes_needed = alloc_trap_bytes_needed(xp, &disp);
+  update_bytes_allocated(tcr,((BytePtr)(xpGPR(xp,Iallocptr)+disp)));
+#ifdef LARGE_OBJECT_SPACE
+  if (allocate_large_ivector(xp, bytes_needed, disp, tcr)) {
+    return true;
+  }
+#endif
   if (allocate_object(xp, bytes_needed, disp, tcr, notify)) {
     if (notify && *notify) {
       xpPC(xp)+=2;
@@ -618,6 +934,77 @@ handle_alloc_trap(ExceptionInformation *xp, TCR *tcr, Boolean *notify)
   return true;
 }
 
+#ifdef X8664
+/*
+  Most allocation traps just need a new segment, and there's usually
+  room for one.  Try to claim it right away - on the signal stack,
+  without switching stacks or taking the exception lock - and fall
+  back to handle_alloc_trap() if anything else (a GC, a GC
+  notification, growing the heap) might be needed.  All signals are
+  blocked while this runs, so the thread can't be suspended in the
+  middle of it.
+*/
+Boolean
+fast_handle_alloc_trap(ExceptionInformation *xp, TCR *tcr, siginfo_t *info)
+{
+  pc program_counter = (pc)xpPC(xp);
+  area *a = active_dynamic_area;
+  natural bytes_needed;
+  signed_natural disp;
+
+  if ((tcr->valence != TCR_STATE_LISP) ||
+      (tcr->flags & (1<<TCR_FLAG_BIT_PENDING_SUSPEND)) ||
+      (!IS_MAYBE_INT_TRAP(info,xp)) ||
+      (program_counter == NULL) ||
+      (program_counter[0] != INTN_OPCODE) ||
+      (program_counter[1] != UUO_ALLOC_TRAP)) {
+    return false;
+  }
+  if (a->older && lisp_global(OLDEST_EPHEMERAL) &&
+      ((a->active - a->low) >= a->threshold)) {
+    return false;               /* time for an EGC */
+  }
+  bytes_needed = alloc_trap_bytes_needed(xp, &disp);
+#ifdef LARGE_OBJECT_SPACE
+  if (bytes_needed >= LARGE_OBJECT_THRESHOLD) {
+    return false;               /* might belong in the large object area */
+  }
+#endif
+#ifdef SAMPLING_PROFILER
+  {
+    BytePtr
+      cur = (BytePtr)(xpGPR(xp,Iallocptr)+disp),
+      base = (BytePtr)tcr->allocation_segment_base;
+
+    if ((tcr->save_allocbase != (void *)VOID_ALLOCPTR) &&
+        ((BytePtr)tcr->save_allocbase > base) &&
+        (cur > base) &&
+        ((natural)(cur - base) >= bytes_needed)) {
+      /* Hit the sample point; the segment still has room. */
+      update_bytes_allocated(tcr, cur);
+      tcr->last_allocptr = (void *)cur;
+      tcr->save_allocptr = (void *) (xpGPR(xp, Iallocptr));
+      tcr->save_allocbase = (void *)base;
+      note_allocation(xp, tcr, bytes_needed, true);
+      xpPC(xp) += 2;
+      return true;
+    }
+  }
+#endif
+  update_bytes_allocated(tcr,((BytePtr)(xpGPR(xp,Iallocptr)+disp)));
+  if (!claim_heap_segment(xp, bytes_needed, tcr,
+                          !did_gc_notification_since_last_full_gc)) {
+    return false;
+  }
+  xpGPR(xp, Iallocptr) -= disp;
+  tcr->save_allocptr = (void *) (xpGPR(xp, Iallocptr));
+#ifdef SAMPLING_PROFILER
+  note_allocation(xp, tcr, bytes_needed, false);
+#endif
+  xpPC(xp) += 2;
+  return true;
+}
+#endif
   
 int
 callback_to_lisp (TCR * tcr, LispObj callback_macptr, ExceptionInformation *xp,
@@ -1264,6 +1651,12 @@ handle_exception(int signum, siginfo_t *info, ExceptionInformation  *context, TC
         xpPC(context)+=3;
         return true;
 
+      case XUUO_SAFEPOINT:
+        /* Handled in signal_handler() when safepoints are supported;
+           otherwise, nothing ever asks for one. */
+        xpPC(context)+=3;
+        return true;
+
       default:
 	return false;
       }
@@ -1408,6 +1801,19 @@ exit_signal_handler(TCR *tcr, int old_valence)
   tcr->pending_exception_context = NULL;
 }
 
+#ifdef GC_SAFEPOINTS
+static Boolean
+safepoint_poll_p(int signum, ExceptionInformation *context)
+{
+  pc program_counter = (pc)xpPC(context);
+
+  return (signum == SIGILL) &&
+    (program_counter[0] == XUUO_OPCODE_0) &&
+    (program_counter[1] == XUUO_OPCODE_1) &&
+    (program_counter[2] == XUUO_SAFEPOINT);
+}
+#endif
+
 void
 signal_handler(int signum, siginfo_t *info, ExceptionInformation  *context)
 {
@@ -1416,6 +1822,17 @@ signal_handler(int signum, siginfo_t *info, ExceptionInformation  *context)
 
   ResetAltStack();
 
+#ifdef GC_SAFEPOINTS
+  if (safepoint_poll_p(signum, context)) {
+    /* Stop in the same state that suspend_resume_handler() would,
+       and return the same way. */
+    stop_at_safepoint(tcr, context);
+    xpPC(context) += 3;
+    SIGRETURN(context);
+    return;
+  }
+#endif
+
   int old_valence = prepare_to_wait_for_exception_lock(tcr, context);
   if (tcr->flags & (1<<TCR_FLAG_BIT_PENDING_SUSPEND)) {
     CLR_TCR_FLAG(tcr, TCR_FLAG_BIT_PENDING_SUSPEND);
@@ -1742,6 +2159,12 @@ altstack_signal_handler(int signum, siginfo_t *info, ExceptionInformation  *cont
     }
   }
 #endif
+#ifdef X8664
+  if ((signum == SIGNUM_FOR_INTN_TRAP) &&
+      fast_handle_alloc_trap(context, tcr, info)) {
+    return;
+  }
+#endif
      
   /* Because of signal chaining - and the possibility that libraries
      that use it ignore sigaltstack-related issues - we have to check
@@ -2169,6 +2592,348 @@ install_pmcl_exception_handlers()
 }
 #endif
 
+#ifdef SAMPLING_PROFILER
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+profile_buffer *profile_buffers = NULL;
+static natural profile_interval_usecs = 0, profile_capacity = 0;
+
+static Boolean
+profile_code_address_p(LispObj p)
+{
+  return (((p >= (LispObj)pure_space_start) && 
+           (p < lisp_global(HEAP_END))) ||
+          ((p >= (LispObj)static_space_start) &&
+           (p < (LispObj)static_space_active)));
+}
+
+/*
+  Store the functions whose frames are on tcr's value stack, starting
+  at "frame", in out[n], out[n+1] ... out[limit-1].  Returns the new n.
+*/
+natural
+profile_record_frames(TCR *tcr, lisp_frame *frame, LispObj *out, natural n, natural limit)
+{
+  area *vs = tcr->vs_area;
+  lisp_frame *next;
+  LispObj f, tra;
+
+  while (frame && vs &&
+         ((BytePtr)frame >= vs->low) &&
+         ((BytePtr)(frame+1) <= vs->high) &&
+         (n < limit)) {
+    tra = frame->tra;
+    if (tra == lisp_global(RET1VALN)) {
+      tra = frame->xtra;
+    }
+    if ((tag_of(tra) == tag_tra) && profile_code_address_p(tra)) {
+      f = tra_function(tra);
+      if (functionp(f) && profile_code_address_p(f)) {
+        out[n++] = f;
+      }
+    }
+    next = frame->backlink;
+    if (next <= frame) {
+      break;
+    }
+    frame = next;
+  }
+  return n;
+}
+
+/*
+  Runs on the altstack of the thread that the timer belongs to, with
+  all signals blocked.  It doesn't lock anything or allocate anything,
+  and it only looks at memory that's known to belong to the thread or
+  to the lisp heap.
+*/
+void
+profile_signal_handler(int signum, siginfo_t *info, ExceptionInformation *xp)
+{
+  TCR *tcr = get_interrupt_tcr(false);
+  profile_buffer *pb = tcr ? TCR_AUX(tcr)->profile_buffer : NULL;
+  natural head, n = 0, kind;
+  LispObj *rec, pc, f;
+  lisp_frame *frame = NULL;
+
+  if (pb == NULL) {
+    return;
+  }
+  head = pb->head;
+  if ((head - pb->tail) >= pb->capacity) {
+    pb->dropped++;
+    return;
+  }
+  rec = pb->records + ((head % pb->capacity) * PROFILE_RECORD_WORDS);
+  pc = (LispObj)xpPC(xp);
+
+  if (lisp_global(IN_GC)) {
+    /* Functions may be moving */
+    kind = PROFILE_SAMPLE_GC;
+  } else if ((tcr->valence == TCR_STATE_LISP) &&
+             stack_pointer_on_vstack_p(xpGPR(xp,Isp), tcr)) {
+    kind = PROFILE_SAMPLE_LISP;
+    f = xpGPR(xp,Ifn);
+    if (functionp(f) && profile_code_address_p(f)) {
+      rec[2+n++] = f;
+    }
+    frame = (lisp_frame *)xpGPR(xp,Ifp);
+  } else {
+    kind = PROFILE_SAMPLE_FOREIGN;
+    rec[2+n++] = box_fixnum(pc);
+    frame = (lisp_frame *)(tcr->save_fp);
+  }
+
+  if (frame) {
+    n = profile_record_frames(tcr, frame, rec+2, n, PROFILE_RECORD_WORDS-2);
+  }
+  rec[0] = box_fixnum(n);
+  rec[1] = box_fixnum(kind);
+  __sync_synchronize();
+  pb->head = head+1;
+}
+
+static void
+profile_start_timer(TCR *tcr, profile_buffer *pb)
+{
+  struct sigevent sev;
+  struct itimerspec its;
+  clockid_t clock;
+
+  if (tcr == get_tcr(false)) {
+    clock = CLOCK_THREAD_CPUTIME_ID;
+  } else if (pthread_getcpuclockid((pthread_t)(TCR_AUX(tcr)->osid), &clock) != 0) {
+    return;
+  }
+  memset(&sev, 0, sizeof(sev));
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev.sigev_notify_thread_id = pb->tid;
+  if (timer_create(clock, &sev, &pb->timer) != 0) {
+    return;
+  }
+  its.it_value.tv_sec = its.it_interval.tv_sec = profile_interval_usecs / 1000000;
+  its.it_value.tv_nsec = its.it_interval.tv_nsec = (profile_interval_usecs % 1000000) * 1000;
+  timer_settime(pb->timer, 0, &its, NULL);
+  pb->live = true;
+}
+
+/* Must be called with the TCR_AREA_LOCK held. */
+void
+profile_thread_start(TCR *tcr)
+{
+  profile_buffer *pb;
+  natural nbytes;
+
+  if ((profile_interval_usecs == 0) ||
+      (TCR_AUX(tcr)->profile_buffer != NULL) ||
+      (TCR_AUX(tcr)->osid == 0) ||
+      (tcr->vs_area == NULL)) {
+    return;
+  }
+  nbytes = offsetof(profile_buffer, records) + 
+    (profile_capacity * PROFILE_RECORD_WORDS * sizeof(LispObj));
+  pb = calloc(1, nbytes);
+  if (pb == NULL) {
+    return;
+  }
+  pb->header_words = offsetof(profile_buffer, records) / sizeof(LispObj);
+  pb->record_words = PROFILE_RECORD_WORDS;
+  pb->capacity = profile_capacity;
+  pb->tid = (natural)(TCR_AUX(tcr)->native_thread_id);
+  profile_start_timer(tcr, pb);
+  if (!pb->live) {
+    free(pb);
+    return;
+  }
+  pb->next = profile_buffers;
+  __sync_synchronize();
+  profile_buffers = pb;
+  TCR_AUX(tcr)->profile_buffer = pb;
+}
+
+/* Must be called with the TCR_AREA_LOCK held. */
+void
+profile_thread_stop(TCR *tcr)
+{
+  profile_buffer *pb = TCR_AUX(tcr)->profile_buffer;
+
+  if (pb) {
+    timer_delete(pb->timer);
+    TCR_AUX(tcr)->profile_buffer = NULL;
+    pb->live = false;
+  }
+}
+
+/*
+  Start sampling every lisp thread (including ones created later)
+  every INTERVAL microseconds of its CPU time, keeping up to CAPACITY
+  unread samples per thread.  Returns 0 on success, else an errno
+  value.  Called from lisp via ff-call.
+*/
+int
+profiler_start(natural interval, natural capacity)
+{
+  static Boolean handler_installed = false;
+  TCR *current = get_tcr(false), *tcr;
+
+  if ((interval == 0) || (capacity == 0)) {
+    return EINVAL;
+  }
+  if (profile_interval_usecs) {
+    return EBUSY;
+  }
+  if (!handler_installed) {
+    install_signal_handler(SIGPROF, (void *)profile_signal_handler, ON_ALTSTACK|RESTART_SYSCALLS);
+    handler_installed = true;
+  }
+  LOCK(lisp_global(TCR_AREA_LOCK),current);
+  profile_interval_usecs = interval;
+  profile_capacity = capacity;
+  tcr = current;
+  do {
+    profile_thread_start(tcr);
+    tcr = TCR_AUX(tcr)->next;
+  } while (tcr != current);
+  UNLOCK(lisp_global(TCR_AREA_LOCK),current);
+  return 0;
+}
+
+void
+profiler_stop()
+{
+  TCR *current = get_tcr(false), *tcr;
+
+  LOCK(lisp_global(TCR_AREA_LOCK),current);
+  profile_interval_usecs = 0;
+  tcr = current;
+  do {
+    profile_thread_stop(tcr);
+    tcr = TCR_AUX(tcr)->next;
+  } while (tcr != current);
+  UNLOCK(lisp_global(TCR_AREA_LOCK),current);
+}
+
+static void
+free_profile_buffers(profile_buffer *pb)
+{
+  profile_buffer *next;
+
+  for (; pb; pb = next) {
+    next = pb->next;
+    free(pb);
+  }
+}
+
+/* Free all buffers.  The profiler must be stopped. */
+void
+profiler_discard()
+{
+  if (profile_interval_usecs == 0) {
+    free_profile_buffers(profile_buffers);
+    profile_buffers = NULL;
+  }
+}
+
+/* Must be called with the TCR_AREA_LOCK held. */
+void
+alloc_profile_thread_start(TCR *tcr)
+{
+  profile_buffer *pb;
+  natural nbytes;
+
+  if ((alloc_profile_interval == 0) ||
+      (tcr->alloc_profile_buffer != NULL) ||
+      (tcr->vs_area == NULL)) {
+    return;
+  }
+  nbytes = offsetof(profile_buffer, records) + 
+    (alloc_profile_capacity * PROFILE_RECORD_WORDS * sizeof(LispObj));
+  pb = calloc(1, nbytes);
+  if (pb == NULL) {
+    return;
+  }
+  pb->header_words = offsetof(profile_buffer, records) / sizeof(LispObj);
+  pb->record_words = PROFILE_RECORD_WORDS;
+  pb->capacity = alloc_profile_capacity;
+  pb->tid = (natural)(TCR_AUX(tcr)->native_thread_id);
+  pb->live = true;
+  pb->random_state = ((natural)pb ^ (natural)tcr) | 1;
+  pb->countdown = next_allocation_sample_interval(pb);
+  pb->next = alloc_profile_buffers;
+  __sync_synchronize();
+  alloc_profile_buffers = pb;
+  /* The thread's current segment is used up before the first sample. */
+  tcr->alloc_profile_buffer = pb;
+}
+
+/* Must be called with the TCR_AREA_LOCK held. */
+void
+alloc_profile_thread_stop(TCR *tcr)
+{
+  profile_buffer *pb = tcr->alloc_profile_buffer;
+
+  if (pb) {
+    tcr->alloc_profile_buffer = NULL;
+    pb->live = false;
+  }
+}
+
+/*
+  Start sampling about one allocation per INTERVAL bytes that each
+  lisp thread conses, keeping up to CAPACITY unread samples per
+  thread.  Returns 0 on success, else an errno value.
+*/
+int
+allocation_profiler_start(natural interval, natural capacity)
+{
+  TCR *current = get_tcr(false), *tcr;
+
+  if ((interval < dnode_size) || (capacity == 0)) {
+    return EINVAL;
+  }
+  if (alloc_profile_interval) {
+    return EBUSY;
+  }
+  LOCK(lisp_global(TCR_AREA_LOCK),current);
+  alloc_profile_interval = interval;
+  alloc_profile_capacity = capacity;
+  tcr = current;
+  do {
+    alloc_profile_thread_start(tcr);
+    tcr = TCR_AUX(tcr)->next;
+  } while (tcr != current);
+  UNLOCK(lisp_global(TCR_AREA_LOCK),current);
+  return 0;
+}
+
+void
+allocation_profiler_stop()
+{
+  TCR *current = get_tcr(false), *tcr;
+
+  LOCK(lisp_global(TCR_AREA_LOCK),current);
+  alloc_profile_interval = 0;
+  tcr = current;
+  do {
+    alloc_profile_thread_stop(tcr);
+    tcr = TCR_AUX(tcr)->next;
+  } while (tcr != current);
+  UNLOCK(lisp_global(TCR_AREA_LOCK),current);
+}
+
+void
+allocation_profiler_discard()
+{
+  if (alloc_profile_interval == 0) {
+    free_profile_buffers(alloc_profile_buffers);
+    alloc_profile_buffers = NULL;
+  }
+}
+#endif
+
 
 
 /* This should only be called when the tcr_area_lock is held */
@@ -2725,18 +3490,18 @@ pc_luser_xp(ExceptionInformation *xp, TCR *tcr, signed_natural *interrupt_displa
           rootbitnumber = area_dnode(root, lisp_global(REF_BASE));
         if ((bitnumber < lisp_global(OLDSPACE_DNODE_COUNT))) {
           atomic_set_bit(refbits, bitnumber);
-          atomic_set_bit(global_refidx,bitnumber>>8);
+          atomic_set_refidx(global_refidx,bitnumber>>8);
           if (need_memoize_root) {
             atomic_set_bit(refbits, rootbitnumber);
-            atomic_set_bit(global_refidx,rootbitnumber>>8);
+            atomic_set_refidx(global_refidx,rootbitnumber>>8);
           }
         }
         if (bitnumber < lisp_global(MANAGED_STATIC_DNODES)) {
           atomic_set_bit(managed_static_refbits,bitnumber);
-          atomic_set_bit(managed_static_refidx,bitnumber>>8);
+          atomic_set_refidx(managed_static_refidx,bitnumber>>8);
           if (need_memoize_root) {
             atomic_set_bit(managed_static_refbits, rootbitnumber);
-            atomic_set_bit(managed_static_refidx,rootbitnumber>>8);
+            atomic_set_refidx(managed_static_refidx,rootbitnumber>>8);
           }
         }
       }
@@ -2796,6 +3561,7 @@ normalize_tcr(ExceptionInformation *xp, TCR *tcr, Boolean is_other_tcr)
 
 TCR *gc_tcr = NULL;
 
+signed_natural gc_from_tcr(TCR *, signed_natural);
 
 signed_natural
 gc_like_from_xp(ExceptionInformation *xp, 
@@ -2805,8 +3571,11 @@ gc_like_from_xp(ExceptionInformation *xp,
   TCR *tcr = get_tcr(false), *other_tcr;
   int result;
   signed_natural inhibit;
+  u64_t t0;
 
+  t0 = gc_timestamp_ns();
   suspend_other_threads(true);
+  gc_event_note_suspend(gc_timestamp_ns()-t0);
   inhibit = (signed_natural)(lisp_global(GC_INHIBIT_COUNT));
   if (inhibit != 0) {
     if (inhibit > 0) {
@@ -2848,6 +3617,16 @@ gc_like_from_xp(ExceptionInformation *xp,
     
 
 
+#ifdef CONCURRENT_GC
+  /* Anything other than a GC might move tenured objects */
+  if (fun != gc_from_tcr) {
+    concurrent_mark_abandon();
+  }
+#endif
+#ifdef BACKGROUND_ZEROING
+  heap_zeroer_pause();
+#endif
+
   result = fun(tcr, param);
 
   other_tcr = tcr;
@@ -2858,7 +3637,12 @@ gc_like_from_xp(ExceptionInformation *xp,
 
   gc_tcr = NULL;
 
+  t0 = gc_timestamp_ns();
   resume_other_threads(true);
+  gc_event_note_resume(gc_timestamp_ns()-t0);
+#ifdef BACKGROUND_ZEROING
+  heap_zeroer_resume();
+#endif
 
   return result;
 
@@ -2876,6 +3660,61 @@ impurify_from_xp(ExceptionInformation *xp, signed_natural param)
   return gc_like_from_xp(xp, impurify, param);
 }
 
+#ifdef LINUX
+/*
+  Write a heap image to FD from a child process while this one keeps
+  running.  This is called (via gc_like_from_xp()) with the other
+  threads suspended and normalized, so the child gets a consistent
+  copy of the heap; the child then GCs that copy and writes it out
+  the way save_application() would.  The child only has this thread,
+  so it can't use GC helper threads, and it can't use malloc() or
+  anything else that some other (now nonexistent) thread might have
+  held a lock on when we forked.  For the same reason, the fork has to
+  be done with a raw system call: libc's fork() runs atfork handlers
+  that want malloc's locks, and a thread suspended in foreign code
+  might own one of them.  Other OSes don't offer a way around that,
+  so this is Linux-only.  The function that the saved image
+  starts up by calling is in arg_z of the trap's context; that's a
+  GC root in the child, so it's updated if the GC moves it.
+*/
+signed_natural
+fork_heap_snapshot(TCR *tcr, signed_natural fd)
+{
+  extern OSErr save_application_internal(unsigned, Boolean);
+  extern Boolean save_image_compressed;
+  area *a = active_dynamic_area;
+  Boolean egc_was_enabled = (a->older != NULL);
+  pid_t pid;
+  OSErr err;
+
+  pid = syscall(SYS_fork);
+  if (pid != 0) {
+    return (pid < 0) ? -errno : pid;
+  }
+
+#ifdef PARALLEL_GC
+  GCthreads = 1;
+#endif
+  if (egc_was_enabled) {
+    egc_control(false, a->active);
+  }
+#ifdef LARGE_OBJECT_SPACE
+  GCevacuating_large_objects = true;
+#endif
+  gc_from_tcr(tcr, 0L);
+  if (snapshot_flags & GC_TRAP_FUNCTION_PURIFY) {
+    purify(tcr, 1);
+    lisp_global(OLDSPACE_DNODE_COUNT) = 0;
+    gc_from_tcr(tcr, 0L);
+  }
+  nrs_TOPLFUNC.vcell = xpGPR(snapshot_xp, Iarg_z);
+  save_image_compressed = ((snapshot_flags & GC_TRAP_FUNCTION_SAVE_COMPRESSED) != 0);
+  err = save_application_internal((unsigned)fd, egc_was_enabled);
+  _exit((err == noErr) ? 0 : 1);
+  return 0;
+}
+#endif
+
 /* Returns #bytes freed by invoking GC */
 
 signed_natural
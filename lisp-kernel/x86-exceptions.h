@@ -44,6 +44,7 @@ void switch_to_foreign_stack(void*, ...);
 #define XUUO_RESUME_ALL 8
 #define XUUO_KILL 9
 #define XUUO_ALLOCATE_LIST 10
+#define XUUO_SAFEPOINT 11
 
 int callback_to_lisp (TCR *tcr, LispObj callback_macptr, ExceptionInformation *xp,
 		      natural arg1, natural arg2, natural arg3, natural arg4,
@@ -476,9 +476,17 @@ mark_root(LispObj n)
 
   dnode = gc_area_dnode(n);
   if (dnode >= GCndnodes_in_area) {
+    note_large_object_ref(n);
     return;
   }
 
+#ifdef PARALLEL_GC
+  if (GCdefer_marking) {
+    defer_mark(n);
+    return;
+  }
+#endif
+
 #ifdef X8632
   if (tag_n == fulltag_tra) {
     if (*(unsigned char *)n == RECOVER_FN_OPCODE) {
@@ -683,9 +691,17 @@ rmark(LispObj n)
 
   dnode = gc_area_dnode(n);
   if (dnode >= GCndnodes_in_area) {
+    note_large_object_ref(n);
     return;
   }
 
+#ifdef PARALLEL_GC
+  if (GCdefer_marking) {
+    defer_mark(n);
+    return;
+  }
+#endif
+
 #ifdef X8632
   if (tag_n == fulltag_tra) {
     if (*(unsigned char *)n == RECOVER_FN_OPCODE) {
@@ -953,7 +969,10 @@ rmark(LispObj n)
     tag_n = fulltag_of(next);
     if (!is_node_fulltag(tag_n)) goto MarkCdr;
     dnode = gc_area_dnode(next);
-    if (dnode >= GCndnodes_in_area) goto MarkCdr;
+    if (dnode >= GCndnodes_in_area) {
+      note_large_object_ref(next);
+      goto MarkCdr;
+    }
     set_bits_vars(markbits,dnode,bitsp,bits,mask);
     if (bits & mask) goto MarkCdr;
     *bitsp = (bits | mask);
@@ -975,7 +994,10 @@ rmark(LispObj n)
     tag_n = fulltag_of(next);
     if (!is_node_fulltag(tag_n)) goto Climb;
     dnode = gc_area_dnode(next);
-    if (dnode >= GCndnodes_in_area) goto Climb;
+    if (dnode >= GCndnodes_in_area) {
+      note_large_object_ref(next);
+      goto Climb;
+    }
     set_bits_vars(markbits,dnode,bitsp,bits,mask);
     if (bits & mask) goto Climb;
     *bitsp = (bits | mask);
@@ -1136,7 +1158,10 @@ rmark(LispObj n)
     if (nodeheader_tag_p(tag_n)) goto MarkVectorDone;
     if (!is_node_fulltag(tag_n)) goto MarkVectorLoop;
     dnode = gc_area_dnode(next);
-    if (dnode >= GCndnodes_in_area) goto MarkVectorLoop;
+    if (dnode >= GCndnodes_in_area) {
+      note_large_object_ref(next);
+      goto MarkVectorLoop;
+    }
     set_bits_vars(markbits,dnode,bitsp,bits,mask);
     if (bits & mask) goto MarkVectorLoop;
     *bitsp = (bits | mask);
@@ -1212,6 +1237,98 @@ skip_over_ivector(natural start, LispObj header)
 #endif
 }
 
+#ifdef BYTE_REFIDX
+/* Most of the cards in a big tenured generation are clean, so look
+   for dirty ones 16 (or, if the CPU and OS support AVX2, 32) at a
+   time.  Every x86-64 CPU has SSE2. */
+#include <emmintrin.h>
+
+static natural
+next_dirty_card_sse2(unsigned char *cards, natural i, natural n)
+{
+  __m128i zero = _mm_setzero_si128();
+  unsigned mask;
+
+  while ((i + 16) <= n) {
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(cards+i)), zero)) ^ 0xffff;
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+    i += 16;
+  }
+  while (i < n) {
+    if (cards[i]) {
+      return i;
+    }
+    i++;
+  }
+  return n;
+}
+
+#if defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_AVX2_CARD_SCAN 1
+
+static natural __attribute__((target("avx2")))
+next_dirty_card_avx2(unsigned char *cards, natural i, natural n)
+{
+  __m256i zero = _mm256_setzero_si256();
+  unsigned mask;
+
+  while ((i + 32) <= n) {
+    mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(cards+i)), zero));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+    i += 32;
+  }
+  return next_dirty_card_sse2(cards, i, n);
+}
+
+static Boolean
+cpu_has_avx2()
+{
+  extern int cpuid(natural, natural*, natural*, natural*);
+  natural eax, ebx, ecx, edx;
+  unsigned xcr0_lo, xcr0_hi;
+
+  eax = cpuid(0, &ebx, &ecx, &edx);
+  if (eax < 7) {
+    return false;
+  }
+  cpuid(1, &ebx, &ecx, &edx);
+  /* OSXSAVE and AVX */
+  if ((ecx & ((1<<27)|(1<<28))) != ((1<<27)|(1<<28))) {
+    return false;
+  }
+  /* Does the OS save and restore the YMM registers ? */
+  __asm__ volatile ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+  if ((xcr0_lo & 6) != 6) {
+    return false;
+  }
+  cpuid(7, &ebx, &ecx, &edx);
+  return ((ebx & (1<<5)) != 0);
+}
+#endif
+
+/* Return the index of the first nonzero byte in cards[i,n), or n
+   if there isn't one. */
+natural
+next_dirty_card(unsigned char *cards, natural i, natural n)
+{
+#ifdef HAVE_AVX2_CARD_SCAN
+  static int use_avx2 = -1;
+
+  if (use_avx2 < 0) {
+    use_avx2 = cpu_has_avx2();
+  }
+  if (use_avx2) {
+    return next_dirty_card_avx2(cards, i, n);
+  }
+#endif
+  return next_dirty_card_sse2(cards, i, n);
+}
+#endif
 
 void
 check_refmap_consistency(LispObj *start, LispObj *end, bitvector refbits, bitvector refidx)
@@ -1272,13 +1389,13 @@ check_refmap_consistency(LispObj *start, LispObj *end, bitvector refbits, bitvec
           Bug(NULL, "Missing memoization in doublenode at 0x" LISP "\n", start);
           set_bit(refbits, ref_dnode);
           if (refidx) {
-            set_bit(refidx, ref_dnode>>8);
+            set_refidx(refidx, ref_dnode>>8);
           }
         } else {
           if (refidx) {
-            if (!ref_bit(refidx, ref_dnode>>8)) {
+            if (!ref_refidx(refidx, ref_dnode>>8)) {
               Bug(NULL, "Memoization for doublenode at 0x" LISP " not indexed\n", start);
-              set_bit(refidx,ref_dnode>>8);
+              set_refidx(refidx,ref_dnode>>8);
             }
           }
         }
@@ -1290,219 +1407,1814 @@ check_refmap_consistency(LispObj *start, LispObj *end, bitvector refbits, bitvec
       lenient_next_dnode = false;
     }
   }
-  if (start > end) {
-    Bug(NULL, "Overran end of range!");
+  if (start > end) {
+    Bug(NULL, "Overran end of range!");
+  }
+}
+
+
+
+
+
+void
+mark_headerless_area_range(LispObj *start, LispObj *end)
+{
+  while (start < end) {
+    mark_root(*start++);
+  }
+}
+
+void
+mark_simple_area_range(LispObj *start, LispObj *end)
+{
+  LispObj x1, *base;
+  int tag;
+
+  while (start < end) {
+    x1 = *start;
+    tag = fulltag_of(x1);
+    if (immheader_tag_p(tag)) {
+      start = (LispObj *)ptr_from_lispobj(skip_over_ivector(ptr_to_lispobj(start), x1));
+    } else if (!nodeheader_tag_p(tag)) {
+      ++start;
+      mark_root(x1);
+      mark_root(*start++);
+    } else {
+      int subtag = header_subtag(x1);
+      natural element_count = header_element_count(x1);
+      natural size = (element_count+1 + 1) & ~1;
+
+      if (subtag == subtag_hash_vector) {
+        LispObj flags = ((hash_table_vector_header *) start)->flags;
+
+        if (flags & nhash_weak_mask) {
+          ((hash_table_vector_header *) start)->cache_key = undefined;
+          ((hash_table_vector_header *) start)->cache_value = lisp_nil;
+          mark_weak_htabv((LispObj)start);
+	  element_count = 0;
+	}
+      } 
+      if (subtag == subtag_pool) {
+	start[1] = lisp_nil;
+      }
+
+      if (subtag == subtag_weak) {
+	natural weak_type = (natural) start[2];
+	if (weak_type >> population_termination_bit)
+	  element_count -= 2;
+	else
+	  element_count -= 1; 
+	start[1] = GCweakvll;
+	GCweakvll = ptr_to_lispobj(start);
+      }
+
+      base = start + element_count + 1;
+      if (subtag == subtag_function) {
+#ifdef X8632
+	natural skip = (unsigned short)start[1];
+
+	/* XXX bootstrapping */
+	if (skip & 0x8000)
+	  skip = element_count - (skip & 0x7fff);
+
+	element_count -= skip;
+
+#else
+	element_count -= (int)start[1];
+#endif
+      }
+      while(element_count--) {
+	mark_root(*--base);
+      }
+      start += size;
+    }
+  }
+}
+
+
+/* Mark a tstack area */
+void
+mark_tstack_area(area *a)
+{
+  LispObj
+    *current,
+    *next,
+    *start = (LispObj *) (a->active),
+    *end = start,
+    *limit = (LispObj *) (a->high);
+
+  for (current = start;
+       end != limit;
+       current = next) {
+    next = (LispObj *) ptr_from_lispobj(*current);
+    end = ((next >= start) && (next < limit)) ? next : limit;
+    mark_simple_area_range(current+2, end);
+  }
+}
+
+/*
+  It's really important that headers never wind up in tagged registers.
+  Those registers would (possibly) get pushed on the vstack and confuse
+  the hell out of this routine.
+
+  vstacks are just treated as a "simple area range", possibly with
+  an extra word at the top (where the area's active pointer points.)
+  */
+
+void
+mark_vstack_area(area *a)
+{
+  LispObj
+    *start = (LispObj *) a->active,
+    *end = (LispObj *) a->high;
+
+#if 0
+  fprintf(dbgout, "mark VSP range: 0x" LISP ":0x" LISP "\n", start, end);
+#endif
+  mark_headerless_area_range(start, end);
+}
+
+/* No lisp objects on cstack on x86, at least x86-64 */
+void
+mark_cstack_area(area *a)
+{
+}
+
+
+/* Mark the lisp objects in an exception frame */
+#ifdef X8664
+void
+mark_xp(ExceptionInformation *xp)
+{
+  natural *regs = (natural *) xpGPRvector(xp), dnode;
+  LispObj rip;
+    
+  
+
+  mark_root(regs[Iarg_z]);
+  mark_root(regs[Iarg_y]);
+  mark_root(regs[Iarg_x]);
+  mark_root(regs[Isave3]);
+  mark_root(regs[Isave2]);
+  mark_root(regs[Isave1]);
+  mark_root(regs[Isave0]);
+  mark_root(regs[Ifn]);
+  mark_root(regs[Itemp0]);
+  mark_root(regs[Itemp1]);
+  mark_root(regs[Itemp2]);
+  /* If the RIP isn't pointing into a marked function,
+     we can -maybe- recover from that if it's tagged as
+     a TRA. */
+  rip = regs[Iip];
+  dnode = gc_area_dnode(rip);
+  if ((dnode < GCndnodes_in_area) &&
+      (! ref_bit(GCmarkbits,dnode))) {
+    if (tag_of(rip) == tag_tra) {
+      mark_root(rip);
+    } else if ((fulltag_of(rip) == fulltag_function) &&
+               (*((unsigned short *)rip) == RECOVER_FN_FROM_RIP_WORD0) &&
+               (*((unsigned char *)(rip+2)) == RECOVER_FN_FROM_RIP_BYTE2) &&
+               ((*(int *) (rip+3))) == -RECOVER_FN_FROM_RIP_LENGTH) {
+      mark_root(rip);
+    } else {
+#ifdef PARALLEL_GC
+      if (GCdefer_marking) {
+        /* The function might not have been marked yet; check later */
+        defer_rip_check(rip);
+        return;
+      }
+#endif
+      Bug(NULL, "Can't find function for rip 0x%16lx",rip);
+    }
+  }
+}
+#else
+void
+mark_xp(ExceptionInformation *xp, natural node_regs_mask)
+{
+  natural *regs = (natural *) xpGPRvector(xp), dnode;
+  LispObj eip;
+
+  if (node_regs_mask & (1<<0)) mark_root(regs[REG_EAX]);
+  if (node_regs_mask & (1<<1)) mark_root(regs[REG_ECX]);
+  if (regs[REG_EFL] & EFL_DF) {
+    /* DF set means EDX should be treated as an imm reg */
+    ;
+  } else
+    if (node_regs_mask & (1<<2)) mark_root(regs[REG_EDX]);
+
+  if (node_regs_mask & (1<<3)) mark_root(regs[REG_EBX]);
+  if (node_regs_mask & (1<<4)) mark_root(regs[REG_ESP]);
+  if (node_regs_mask & (1<<5)) mark_root(regs[REG_EBP]);
+  if (node_regs_mask & (1<<6)) mark_root(regs[REG_ESI]);
+  if (node_regs_mask & (1<<7)) mark_root(regs[REG_EDI]);
+
+  /* If the EIP isn't pointing into a marked function, we're probably
+     in trouble.  We can -maybe- recover from that if it's tagged as a
+     TRA. */
+  eip = regs[Ieip];
+  dnode = gc_area_dnode(eip);
+  if ((dnode < GCndnodes_in_area) &&
+      (! ref_bit(GCmarkbits,dnode))) {
+    if (fulltag_of(eip) == fulltag_tra) {
+      mark_root(eip);
+    } else if ((fulltag_of(eip) == fulltag_misc) &&
+               (header_subtag(header_of(eip)) == subtag_function) &&
+               (*(unsigned char *)eip == RECOVER_FN_OPCODE) &&
+	       (*(LispObj *)(eip + 1)) == eip) {
+      mark_root(eip);
+    } else {
+      Bug(NULL, "Can't find function for eip 0x%4x", eip);
+    }
+  }
+}
+#endif
+
+#ifdef PARALLEL_GC
+/*
+  Parallel marking, used for full GCs when GCthreads > 1.
+
+  While GCdefer_marking is true, mark_root() and rmark() don't mark
+  anything: they just add their argument to a vector of roots.  Once
+  all roots have been found, parallel_mark_end() divides that vector
+  among the GC threads, which mark the heap using explicit stacks and
+  atomic updates to the markbits and steal work from each other when
+  they run out.
+
+  Weak hash vectors and weak populations are marked in parallel, but
+  their contents are handled afterwards, one vector at a time, exactly
+  as the serial marker would have handled them; anything that that
+  reaches gets marked by another parallel pass.
+*/
+
+Boolean GCdefer_marking = false;
+
+typedef struct {
+  LispObj obj;                  /* a node, or the address of N nodes */
+  natural n;                    /* 0 if OBJ is a node */
+} mark_item;
+
+typedef struct {
+  void *data;
+  natural count, capacity;
+} gc_vector;
+
+typedef struct {
+  gc_vector local;              /* mark_items; only touched by owner */
+  gc_vector shared;             /* mark_items others can steal */
+  signed_natural lock;          /* protects shared */
+  gc_vector deferred;           /* weak vectors, as mark_items */
+  gc_vector roots;              /* per-thread roots found by this marker */
+  gc_vector rips;
+  char pad[64];                 /* keep markers on separate cache lines */
+} gc_marker;
+
+static gc_marker gc_markers[MAX_GC_THREADS];
+static gc_vector GCdeferred_roots; /* LispObjs */
+static gc_vector GCdeferred_rips;  /* LispObjs */
+static signed_natural GCmark_idle;
+
+#define MARK_RANGE_CHUNK 256
+
+extern natural
+store_conditional(natural*, natural, natural);
+
+extern signed_natural
+atomic_incf(signed_natural *);
+
+extern signed_natural
+atomic_decf(signed_natural *);
+
+static void
+grow_gc_vector(gc_vector *v, natural eltsize)
+{
+  natural 
+    newcapacity = v->capacity ? (v->capacity << 1) : (1<<16),
+    oldbytes = v->capacity * eltsize,
+    newbytes = newcapacity * eltsize;
+  void *newdata = MapMemory(NULL, newbytes, MEMPROTECT_RW);
+
+  /* No malloc() here: other threads are stopped and might own its lock */
+  if (newdata == MAP_FAILED) {
+    Fatal(":   Kernel memory allocation failure.  ", "can't grow GC mark stack");
+  }
+  if (v->data) {
+    memcpy(newdata, v->data, v->count * eltsize);
+    UnMapMemory(v->data, oldbytes);
+  }
+  v->data = newdata;
+  v->capacity = newcapacity;
+}
+
+static inline void
+push_mark_item(gc_vector *v, LispObj obj, natural n)
+{
+  mark_item *item;
+
+  if (v->count == v->capacity) {
+    grow_gc_vector(v, sizeof(mark_item));
+  }
+  item = ((mark_item *)(v->data)) + v->count++;
+  item->obj = obj;
+  item->n = n;
+}
+
+static inline void
+push_gc_vector_node(gc_vector *v, LispObj n)
+{
+  if (v->count == v->capacity) {
+    grow_gc_vector(v, sizeof(LispObj));
+  }
+  ((LispObj *)(v->data))[v->count++] = n;
+}
+
+/* While GC threads are scanning per-thread roots in parallel, each
+   collects what it finds in its own marker's vectors. */
+static __thread gc_vector *GCroot_sink = NULL, *GCrip_sink = NULL;
+
+/* Called by mark_root() and rmark() instead of marking N */
+void
+defer_mark(LispObj n)
+{
+  if (is_node_fulltag(fulltag_of(n))) {
+    natural dnode = gc_area_dnode(n);
+
+    if ((dnode < GCndnodes_in_area) &&
+        !ref_bit(GCmarkbits, dnode)) {
+      push_gc_vector_node(GCroot_sink ? GCroot_sink : &GCdeferred_roots, n);
+    }
+  }
+}
+
+/* mark_xp() can't check RIP until marking's done */
+void
+defer_rip_check(LispObj rip)
+{
+  push_gc_vector_node(GCrip_sink ? GCrip_sink : &GCdeferred_rips, rip);
+}
+
+/* Push N on the worker's stack if it might need to be marked. */
+static inline void
+pmark_push_node(gc_marker *m, LispObj n)
+{
+  if (is_node_fulltag(fulltag_of(n))) {
+    natural dnode = gc_area_dnode(n);
+
+    /* If N is a tra, its dnode's bit is set only if the containing
+       function has been marked. */
+    if (dnode < GCndnodes_in_area) {
+      if (!ref_bit(GCmarkbits, dnode)) {
+        push_mark_item(&m->local, n, 0);
+      }
+    } else {
+      note_large_object_ref(n);
+    }
+  }
+}
+
+/* The parallel equivalent of mark_root(). */
+static void
+pmark_node(gc_marker *m, LispObj n)
+{
+  int tag_n = fulltag_of(n);
+  natural dnode;
+
+  if (tag_of(n) == tag_tra) {
+    if ((*((unsigned short *)n) == RECOVER_FN_FROM_RIP_WORD0) &&
+        (*((unsigned char *)(n+2)) == RECOVER_FN_FROM_RIP_BYTE2)) {
+      int sdisp = (*(int *) (n+3));
+      n = RECOVER_FN_FROM_RIP_LENGTH+n+sdisp;
+      tag_n = fulltag_function;
+    }
+    else {
+      return;
+    }
+  }
+  dnode = gc_area_dnode(n);
+
+  if (atomic_set_bit(GCmarkbits, dnode)) {
+    return;                     /* someone else got there first */
+  }
+
+  if (tag_n == fulltag_cons) {
+    cons *c = (cons *) ptr_from_lispobj(untag(n));
+
+    /* Do the car first, so that long lists don't deepen the stack */
+    pmark_push_node(m, c->cdr);
+    pmark_push_node(m, c->car);
+    return;
+  }
+  {
+    LispObj *base = (LispObj *) ptr_from_lispobj(untag(n));
+    natural
+      header = *((natural *) base),
+      subtag = header_subtag(header),
+      element_count = header_element_count(header),
+      total_size_in_bytes,      /* including 8-byte header */
+      suffix_dnodes;
+    natural prefix_nodes = 0;
+
+    tag_n = fulltag_of(header);
+
+    if ((nodeheader_tag_p(tag_n)) ||
+        (tag_n == ivector_class_64_bit)) {
+      total_size_in_bytes = 8 + (element_count<<3);
+    } else if (tag_n == ivector_class_32_bit) {
+      total_size_in_bytes = 8 + (element_count<<2);
+    } else {
+      /* ivector_class_other_bit contains 8, 16-bit arrays & bitvector */
+      if (subtag == subtag_bit_vector) {
+        total_size_in_bytes = 8 + ((element_count+7)>>3);
+      } else if (subtag >= min_8_bit_ivector_subtag) {
+	total_size_in_bytes = 8 + element_count;
+      } else {
+        total_size_in_bytes = 8 + (element_count<<1);
+      }
+    }
+
+    suffix_dnodes = ((total_size_in_bytes+(dnode_size-1))>>dnode_shift) -1;
+
+    if (suffix_dnodes) {
+      atomic_set_n_bits(GCmarkbits, dnode+1, suffix_dnodes);
+    }
+
+    if (nodeheader_tag_p(tag_n)) {
+      if (subtag == subtag_hash_vector) {
+        LispObj flags = ((hash_table_vector_header *) base)->flags;
+
+        if (flags & nhash_weak_mask) {
+          ((hash_table_vector_header *) base)->cache_key = undefined;
+          ((hash_table_vector_header *) base)->cache_value = lisp_nil;
+          push_mark_item(&m->deferred, n, 0);
+          return;
+        }
+      }
+
+      if (subtag == subtag_pool) {
+        deref(n, 1) = lisp_nil;
+      }
+      
+      if (subtag == subtag_weak) {
+        push_mark_item(&m->deferred, n, 0);
+        return;
+      }
+
+      if (subtag == subtag_function) {
+	prefix_nodes = (natural) ((int) deref(base,1));
+        if (prefix_nodes > element_count) {
+          Bug(NULL, "Function 0x" LISP " trashed",n);
+        }
+      }
+      if (element_count > prefix_nodes) {
+        push_mark_item(&m->local,
+                       (LispObj)(base+1+prefix_nodes),
+                       element_count-prefix_nodes);
+      }
+    }
+  }
+}
+
+static void
+pmark_range(gc_marker *m, LispObj *start, natural n)
+{
+  if (n > MARK_RANGE_CHUNK) {
+    /* Leave the rest where someone else can steal it */
+    push_mark_item(&m->local, (LispObj)(start+MARK_RANGE_CHUNK), n-MARK_RANGE_CHUNK);
+    n = MARK_RANGE_CHUNK;
+  }
+  while (n--) {
+    pmark_push_node(m, *start++);
+  }
+}
+
+static void
+lock_marker(gc_marker *m)
+{
+  while (store_conditional((natural *)&(m->lock), 0, 1) != 0) {
+    sched_yield();
+  }
+}
+
+static void
+unlock_marker(gc_marker *m)
+{
+  m->lock = 0;
+}
+
+/* Move up to N items from the bottom of FROM to the top of TO */
+static void
+transfer_mark_items(gc_vector *from, gc_vector *to, natural n)
+{
+  mark_item *items;
+
+  if (n > from->count) {
+    n = from->count;
+  }
+  while ((to->capacity - to->count) < n) {
+    grow_gc_vector(to, sizeof(mark_item));
+  }
+  items = (mark_item *)(from->data);
+  memcpy(((mark_item *)(to->data))+to->count, items, n*sizeof(mark_item));
+  to->count += n;
+  from->count -= n;
+  memmove(items, items+n, from->count*sizeof(mark_item));
+}
+
+static Boolean
+pop_mark_item(gc_marker *m, mark_item *item)
+{
+  if (m->local.count == 0) {
+    if (*(volatile natural *)&(m->shared.count) == 0) {
+      return false;
+    }
+    lock_marker(m);
+    transfer_mark_items(&m->shared, &m->local, m->shared.count);
+    unlock_marker(m);
+    if (m->local.count == 0) {
+      return false;
+    }
+  }
+  *item = ((mark_item *)(m->local.data))[--m->local.count];
+  return true;
+}
+
+/* If someone's idle and we have work to spare, make half of it stealable */
+static void
+share_mark_items(gc_marker *m)
+{
+  if ((*(volatile signed_natural *)&GCmark_idle != 0) &&
+      (m->local.count > 1) &&
+      (*(volatile natural *)&(m->shared.count) == 0)) {
+    lock_marker(m);
+    transfer_mark_items(&m->local, &m->shared, m->local.count >> 1);
+    unlock_marker(m);
+  }
+}
+
+static Boolean
+steal_mark_items(natural me, natural nthreads)
+{
+  natural i, victim;
+  gc_marker *m = gc_markers+me, *v;
+
+  for (i = 1; i < nthreads; i++) {
+    victim = (me+i) % nthreads;
+    v = gc_markers+victim;
+    if (*(volatile natural *)&(v->shared.count)) {
+      lock_marker(v);
+      transfer_mark_items(&v->shared, &m->local, v->shared.count);
+      unlock_marker(v);
+      if (m->local.count) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/* 
+   Return true when every marker is out of work.  Work is only ever
+   made stealable by a marker that isn't idle, so once all markers
+   are idle there's nothing left to do.
+*/
+static Boolean
+mark_work_finished(natural nthreads)
+{
+  natural i;
+
+  atomic_incf(&GCmark_idle);
+  while (1) {
+    if (*(volatile signed_natural *)&GCmark_idle == nthreads) {
+      return true;
+    }
+    for (i = 0; i < nthreads; i++) {
+      if (*(volatile natural *)&(gc_markers[i].shared.count)) {
+        atomic_decf(&GCmark_idle);
+        return false;
+      }
+    }
+    sched_yield();
+  }
+}
+
+static void
+parallel_mark_worker(natural me, natural nthreads, void *arg)
+{
+  gc_marker *m = gc_markers+me;
+  natural
+    nroots = GCdeferred_roots.count,
+    start = (nroots*me)/nthreads,
+    end = (nroots*(me+1))/nthreads;
+  mark_item item;
+
+  if (end > start) {
+    push_mark_item(&m->local, (LispObj)(((LispObj *)GCdeferred_roots.data)+start), end-start);
+  }
+  do {
+    while (pop_mark_item(m, &item)) {
+      if (item.n) {
+        pmark_range(m, (LispObj *)item.obj, item.n);
+      } else {
+        pmark_node(m, item.obj);
+      }
+      share_mark_items(m);
+    }
+  } while (steal_mark_items(me, nthreads) || !mark_work_finished(nthreads));
+}
+
+void
+parallel_mark_begin()
+{
+  GCdeferred_roots.count = 0;
+  GCdeferred_rips.count = 0;
+  GCdefer_marking = true;
+}
+
+/*
+  Mark everything that was deferred while GCdefer_marking was true.
+  Weak vectors found along the way are processed serially (with
+  marking still deferred), and whatever that finds is marked in
+  parallel, until nothing's left.
+*/
+void
+parallel_mark_end()
+{
+  natural i, j, nthreads;
+
+  if (!GCdefer_marking) {
+    return;
+  }
+
+  nthreads = GCthreads;
+  while (GCdeferred_roots.count) {
+    GCmark_idle = 0;
+    gc_run_parallel(parallel_mark_worker, NULL);
+    GCdeferred_roots.count = 0;
+
+    for (i = 0; i < nthreads; i++) {
+      gc_marker *m = gc_markers+i;
+      mark_item *items = (mark_item *)(m->deferred.data);
+
+      for (j = 0; j < m->deferred.count; j++) {
+        LispObj n = items[j].obj;
+
+        if (header_subtag(header_of(n)) == subtag_hash_vector) {
+          mark_weak_htabv(n);
+        } else {
+          natural
+            element_count = header_element_count(header_of(n)),
+            weak_type = deref(n,2);
+
+          if (weak_type >> population_termination_bit) {
+            element_count -= 2;
+          } else {
+            element_count -= 1;
+          }
+          while (element_count) {
+            rmark(deref(n,element_count));
+            element_count--;
+          }
+          deref(n, 1) = GCweakvll;
+          GCweakvll = untag(n);
+        }
+      }
+      m->deferred.count = 0;
+    }
+  }
+  GCdefer_marking = false;
+
+  for (i = 0; i < GCdeferred_rips.count; i++) {
+    LispObj rip = ((LispObj *)(GCdeferred_rips.data))[i];
+
+    if (!ref_bit(GCmarkbits,gc_area_dnode(rip))) {
+      Bug(NULL, "Can't find function for rip 0x%16lx",rip);
+    }
+  }
+}
+#endif
+
+#ifdef PARALLEL_GC
+/*
+  Scanning per-thread roots in parallel: every value stack, and every
+  TCR's exception frames and thread-local bindings.  There can be
+  hundreds of these and their sizes vary a lot, so GC threads claim
+  them one at a time.  When marking, this is only done while marking's
+  deferred (each thread's roots are collected in its marker and added
+  to the shared vectors afterwards); forwarding just updates the stacks
+  and frames in place.  Temp stacks can contain weak vectors, whose
+  marking isn't thread-safe, so they're still scanned serially.
+*/
+
+#define PARALLEL_THREAD_ROOTS_MIN 16
+
+static gc_vector GCthread_roots;        /* areas, then TCRs */
+static natural GCthread_root_nstacks;
+static signed_natural GCthread_root_next;
+
+static void
+thread_roots_worker(natural me, natural nthreads, void *arg)
+{
+  Boolean forward = (arg != NULL);
+  gc_marker *m = gc_markers+me;
+  LispObj *items = (LispObj *)(GCthread_roots.data);
+  natural i, n = GCthread_roots.count;
+
+  if (!forward) {
+    GCroot_sink = &m->roots;
+    GCrip_sink = &m->rips;
+  }
+  while ((i = (natural)(atomic_incf(&GCthread_root_next)-1)) < n) {
+    if (i < GCthread_root_nstacks) {
+      area *stack = (area *)(items[i]);
+
+      if (forward) {
+        forward_vstack_area(stack);
+      } else {
+        mark_vstack_area(stack);
+      }
+    } else {
+      TCR *other = (TCR *)(items[i]);
+
+      if (forward) {
+        forward_tcr_xframes(other);
+        forward_tcr_tlb(other);
+      } else {
+        mark_tcr_xframes(other);
+        mark_tcr_tlb(other);
+      }
+    }
+  }
+  GCroot_sink = GCrip_sink = NULL;
+}
+
+static void
+append_gc_vector_nodes(gc_vector *to, gc_vector *from)
+{
+  natural i;
+
+  for (i = 0; i < from->count; i++) {
+    push_gc_vector_node(to, ((LispObj *)(from->data))[i]);
+  }
+  from->count = 0;
+}
+
+/*
+  Mark (or forward) the value stacks in the area list that starts after
+  A, and the exception frames and TLBs of every TCR, in parallel.
+  Returns false, having done nothing, if there aren't enough GC threads
+  or thread roots to make that worthwhile; the caller should then do
+  it serially, as usual.
+*/
+Boolean
+scan_thread_roots_in_parallel(area *a, TCR *tcr, Boolean forward)
+{
+  area *next_area;
+  TCR *other_tcr;
+  natural i;
+
+  if ((GCthreads < 2) || !(forward || GCdefer_marking)) {
+    return false;
+  }
+  GCthread_roots.count = 0;
+  for (next_area = a->succ; next_area->code != AREA_VOID; next_area = next_area->succ) {
+    if (next_area->code == AREA_VSTACK) {
+      push_gc_vector_node(&GCthread_roots, (LispObj)next_area);
+    }
+  }
+  GCthread_root_nstacks = GCthread_roots.count;
+  other_tcr = tcr;
+  do {
+    push_gc_vector_node(&GCthread_roots, (LispObj)other_tcr);
+    other_tcr = TCR_AUX(other_tcr)->next;
+  } while (other_tcr != tcr);
+  if (GCthread_roots.count < PARALLEL_THREAD_ROOTS_MIN) {
+    return false;
+  }
+  GCthread_root_next = 0;
+  gc_run_parallel(thread_roots_worker, forward ? (void *)&GCthread_roots : NULL);
+  if (!forward) {
+    for (i = 0; i < MAX_GC_THREADS; i++) {
+      append_gc_vector_nodes(&GCdeferred_roots, &gc_markers[i].roots);
+      append_gc_vector_nodes(&GCdeferred_rips, &gc_markers[i].rips);
+    }
+  }
+  return true;
+}
+#endif
+
+#ifdef PARALLEL_GC
+/*
+  Parallel relocation and compaction.
+
+  The dynamic area is divided into regions of COMPACT_REGION_DNODES
+  dnodes.  Relocation is a parallel prefix sum: each thread counts the
+  marked dnodes in some regions, the region totals are summed serially,
+  and then each thread fills in the relocation table entries for its
+  regions.
+
+  Compaction is done in two parallel passes.  The first forwards the
+  pointers in every marked object in place; the second slides runs of
+  marked dnodes down to their new addresses.  An object can't span an
+  unmarked dnode, so a region's objects are taken to be those that
+  start between the first unmarked dnode at or after the start of the
+  region and the corresponding dnode for the next region.  Regions are
+  slid in address order, and a region's data isn't moved until every
+  lower region whose (old) contents it would overwrite has been moved.
+*/
+
+#define COMPACT_REGION_DNODES (1<<16)
+#define COMPACT_REGION_PAGELETS (COMPACT_REGION_DNODES>>bitmap_shift)
+#define PARALLEL_COMPACT_MIN_DNODES (4*COMPACT_REGION_DNODES)
+
+typedef struct {
+  natural nregions;
+  natural *live;                /* bytes of marked dnodes in each region */
+  natural *first_unmarked;      /* per region, or COMPACT_NONE */
+  natural *bounds;              /* see above; nregions+1 entries */
+  natural *done;                /* set when a region's been slid */
+  signed_natural next_region;   /* next region to slide */
+} compact_state;
+
+#define COMPACT_NONE ((natural)-1)
+
+static compact_state GCcompact;
+static gc_vector GCcompact_data;
+
+static Boolean
+use_parallel_compaction()
+{
+  return ((GCthreads > 1) &&
+          (GCndynamic_dnodes_in_area >= PARALLEL_COMPACT_MIN_DNODES));
+}
+
+static void
+init_compact_state()
+{
+  natural 
+    nregions = (GCndynamic_dnodes_in_area+(COMPACT_REGION_DNODES-1))/COMPACT_REGION_DNODES,
+    nwords = (4*nregions)+1;
+  natural *data;
+
+  while (GCcompact_data.capacity < nwords) {
+    grow_gc_vector(&GCcompact_data, sizeof(natural));
+  }
+  data = (natural *)GCcompact_data.data;
+  GCcompact.nregions = nregions;
+  GCcompact.live = data;
+  GCcompact.first_unmarked = data+nregions;
+  GCcompact.done = data+(2*nregions);
+  GCcompact.bounds = data+(3*nregions);
+}
+
+/* The first dnode in [dnode,limit) whose markbit is set (or unset, if
+   MARKED is false); LIMIT if there isn't one. */
+static natural
+next_dnode_with_markbit(natural dnode, natural limit, Boolean marked)
+{
+  bitvector markbits = GCdynamic_markbits;
+  natural w, idx;
+
+  while (dnode < limit) {
+    w = markbits[dnode>>bitmap_shift];
+    if (!marked) {
+      w = ~w;
+    }
+    idx = dnode & bitmap_shift_count_mask;
+    w <<= idx;
+    if (w) {
+      dnode += count_leading_zeros(w);
+      return (dnode < limit) ? dnode : limit;
+    }
+    dnode += (nbits_in_word-idx);
+  }
+  return limit;
+}
+
+static void
+count_region_marks(natural me, natural nthreads, void *arg)
+{
+  natural
+    r,
+    npagelets = ((GCndynamic_dnodes_in_area+(nbits_in_word-1))>>bitmap_shift);
+
+  for (r = me; r < GCcompact.nregions; r += nthreads) {
+    natural 
+      i = r*COMPACT_REGION_PAGELETS,
+      end = i+COMPACT_REGION_PAGELETS,
+      live = 0,
+      first = COMPACT_NONE,
+      thesebits;
+    qnode *q;
+
+    if (end > npagelets) {
+      end = npagelets;
+    }
+    for (; i < end; i++) {
+      thesebits = GCdynamic_markbits[i];
+      if (thesebits == ALL_ONES) {
+        live += nbits_in_word*dnode_size;
+      } else {
+        if (first == COMPACT_NONE) {
+          first = (i<<bitmap_shift)+count_leading_zeros(~thesebits);
+        }
+        q = (qnode *)(GCdynamic_markbits+i);
+        live += one_bits(q[0]);
+        live += one_bits(q[1]);
+        live += one_bits(q[2]);
+        live += one_bits(q[3]);
+      }
+    }
+    GCcompact.live[r] = live;
+    GCcompact.first_unmarked[r] = first;
+  }
+}
+
+static void
+fill_region_relocation(natural me, natural nthreads, void *arg)
+{
+  natural
+    r,
+    npagelets = ((GCndynamic_dnodes_in_area+(nbits_in_word-1))>>bitmap_shift);
+
+  for (r = me; r < GCcompact.nregions; r += nthreads) {
+    natural 
+      i = r*COMPACT_REGION_PAGELETS,
+      end = i+COMPACT_REGION_PAGELETS,
+      thesebits;
+    LispObj current = GCcompact.bounds[r];
+    qnode *q;
+
+    if (end > npagelets) {
+      end = npagelets;
+    }
+    for (; i < end; i++) {
+      GCrelocptr[i] = current;
+      thesebits = GCdynamic_markbits[i];
+      if (thesebits == ALL_ONES) {
+        current += nbits_in_word*dnode_size;
+      } else {
+        q = (qnode *)(GCdynamic_markbits+i);
+        current += one_bits(q[0]);
+        current += one_bits(q[1]);
+        current += one_bits(q[2]);
+        current += one_bits(q[3]);
+      }
+    }
+  }
+}
+
+/* Equivalent to calculate_relocation() */
+static LispObj
+parallel_calculate_relocation()
+{
+  natural r, npagelets = ((GCndynamic_dnodes_in_area+(nbits_in_word-1))>>bitmap_shift);
+  LispObj current = GCareadynamiclow, first = 0;
+
+  init_compact_state();
+  gc_run_parallel(count_region_marks, NULL);
+  /* Use "bounds" to hold each region's relocation base for now */
+  for (r = 0; r < GCcompact.nregions; r++) {
+    GCcompact.bounds[r] = current;
+    if ((first == 0) && (GCcompact.first_unmarked[r] != COMPACT_NONE)) {
+      first = GCareadynamiclow+(GCcompact.first_unmarked[r]<<dnode_shift);
+    }
+    current += GCcompact.live[r];
+  }
+  gc_run_parallel(fill_region_relocation, NULL);
+  GCrelocptr[npagelets] = current;
+  return first ? first : current;
+}
+
+/* Forward the pointers in the marked objects that start in [dnode,limit) */
+static void
+forward_marked_objects_in_place(natural dnode, natural limit)
+{
+  LispObj *p, node, new;
+  natural elements, node_dnodes, n;
+  int tag;
+
+  while ((dnode = next_dnode_with_markbit(dnode, limit, true)) < limit) {
+    p = (LispObj *)ptr_from_lispobj(GCareadynamiclow+(dnode<<dnode_shift));
+    node = *p;
+    tag = fulltag_of(node);
+    if (nodeheader_tag_p(tag)) {
+      elements = header_element_count(node);
+      node_dnodes = (elements+2)>>1;
+      if (header_subtag(node) == subtag_function) {
+        int skip = (int)(p[1]);
+        LispObj *q = p+1+skip;
+
+        for (n = elements-skip; n; n--, q++) {
+          *q = node_forwarding_address(*q);
+        }
+        if ((elements & 1) == 0) {
+          *q = 0;
+        }
+      } else if ((header_subtag(node) == subtag_hash_vector) &&
+                 (((hash_table_vector_header *)p)->flags & nhash_track_keys_mask)) {
+        int skip = hash_table_vector_header_count-1;
+        LispObj *q = p+1;
+        Boolean key_moved = false;
+
+        for (n = skip; n; n--, q++) {
+          *q = node_forwarding_address(*q);
+        }
+        for (n = (elements-skip)>>1; n; n--, q += 2) {
+          new = node_forwarding_address(q[0]);
+          if (new != q[0]) {
+            q[0] = new;
+            key_moved = true;
+          }
+          q[1] = node_forwarding_address(q[1]);
+        }
+        *q = 0;
+        if (key_moved) {
+          ((hash_table_vector_header *)p)->flags |= nhash_key_moved_mask;
+        }
+      } else {
+        LispObj *q = p+1;
+
+        for (n = (node_dnodes<<1)-1; n; n--, q++) {
+          *q = node_forwarding_address(*q);
+        }
+      }
+      dnode += node_dnodes;
+    } else if (immheader_tag_p(tag)) {
+      dnode += (((LispObj *)skip_over_ivector((natural)p, node))-p)>>1;
+    } else {
+      p[0] = node_forwarding_address(p[0]);
+      p[1] = node_forwarding_address(p[1]);
+      dnode++;
+    }
+  }
+}
+
+static void
+find_region_bounds(natural me, natural nthreads, void *arg)
+{
+  natural r, start = gc_dynamic_area_dnode(GCfirstunmarked);
+
+  for (r = me; r < GCcompact.nregions; r += nthreads) {
+    natural dnode = r*COMPACT_REGION_DNODES;
+
+    if (dnode < start) {
+      dnode = start;
+    }
+    GCcompact.bounds[r] = next_dnode_with_markbit(dnode, GCndynamic_dnodes_in_area, false);
+    GCcompact.done[r] = 0;
+  }
+}
+
+static void
+forward_regions_in_place(natural me, natural nthreads, void *arg)
+{
+  natural r;
+
+  for (r = me; r < GCcompact.nregions; r += nthreads) {
+    forward_marked_objects_in_place(GCcompact.bounds[r], GCcompact.bounds[r+1]);
+  }
+}
+
+static void
+slide_regions(natural me, natural nthreads, void *arg)
+{
+  natural r, j, dnode, limit, end;
+  LispObj dest, src;
+
+  while ((r = atomic_incf(&GCcompact.next_region)-1) < GCcompact.nregions) {
+    dnode = next_dnode_with_markbit(GCcompact.bounds[r], GCcompact.bounds[r+1], true);
+    limit = GCcompact.bounds[r+1];
+    if (dnode < limit) {
+      /* Wait for lower regions whose contents we'd clobber */
+      dest = dnode_forwarding_address(dnode, 0);
+      for (j = r; j > 0; j--) {
+        if ((GCareadynamiclow+(GCcompact.bounds[j]<<dnode_shift)) <= dest) {
+          break;
+        }
+        while (*(volatile natural *)&(GCcompact.done[j-1]) == 0) {
+          sched_yield();
+        }
+      }
+      while (dnode < limit) {
+        end = next_dnode_with_markbit(dnode, limit, false);
+        src = GCareadynamiclow+(dnode<<dnode_shift);
+        dest = dnode_forwarding_address(dnode, 0);
+        if (dest != src) {
+          memmove((void *)dest, (void *)src, (end-dnode)<<dnode_shift);
+        }
+        dnode = next_dnode_with_markbit(end, limit, true);
+      }
+    }
+    *(volatile natural *)&(GCcompact.done[r]) = 1;
+  }
+}
+
+/* Equivalent to compact_dynamic_heap() */
+static LispObj
+parallel_compact_dynamic_heap()
+{
+  natural
+    npagelets = ((GCndynamic_dnodes_in_area+(nbits_in_word-1))>>bitmap_shift);
+
+  if (gc_area_dnode(GCfirstunmarked) < GCndnodes_in_area) {
+    lisp_global(FWDNUM) += (1<<fixnum_shift);
+
+    init_compact_state();
+    gc_run_parallel(find_region_bounds, NULL);
+    GCcompact.bounds[GCcompact.nregions] = GCndynamic_dnodes_in_area;
+    gc_run_parallel(forward_regions_in_place, NULL);
+    GCcompact.next_region = 0;
+    gc_run_parallel(slide_regions, NULL);
+    return GCrelocptr[npagelets];
+  }
+  return GCfirstunmarked;
+}
+#endif
+
+#ifdef CONCURRENT_GC
+/*
+  Concurrent marking of the tenured generation.
+
+  When the EGC is enabled and the heap's getting full enough that a
+  full GC will be needed soon, the end of an ephemeral GC starts a
+  background thread marking the objects that are tenured at that
+  point, while lisp threads continue to run.  The marker never writes
+  to the heap: it keeps its marks (and notes the dnode where each
+  marked object starts) in bitmaps of its own.  Ephemeral GCs don't
+  move tenured objects, so they don't have to stop it.
+
+  The next full GC that's caused by allocation stops the marker,
+  merges its marks into GCmarkbits and then marks from:
+
+  - whatever the marker hadn't gotten to yet;
+  - weak vectors, weak hash vectors and pools, which are left for the
+    full GC since marking them has side effects;
+  - the words in marked objects that referenced younger objects when
+    the marker saw them;
+  - the words in marked objects on every page that's been written to
+    since marking started.  The kernel's "soft-dirty" page table bits
+    tell us which pages those are.  (The EGC's write barrier can't:
+    it only notes stores of younger objects into older ones, and not
+    every store into the heap goes through it.)
+
+  before it marks from the usual roots.  The rest of the full GC is
+  unchanged.  Objects that became garbage while marking was going on
+  survive until the following full GC, so an explicit full GC discards
+  the concurrent marks (see GCconcurrent_discard.)
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CM_IDLE 0
+#define CM_MARKING 1
+
+#define CM_MAX_STATIC_AREAS 8
+#define PAGEMAP_SOFT_DIRTY (((natural)1)<<55)
+#define PAGEMAP_CHUNK 1024
+
+typedef struct {
+  Boolean enabled;
+  signed_natural state;         /* CM_IDLE or CM_MARKING */
+  Boolean stop;                 /* the marker should stop ASAP */
+  Boolean failed;               /* couldn't clear soft-dirty bits */
+  void *wakeup, *parked;        /* semaphores */
+  int pagemap_fd;
+  LispObj low;                  /* we mark objects in [low,low+ndnodes) */
+  natural ndnodes;
+  bitvector markbits, startbits;
+  natural bitmap_dnodes;        /* capacity of each bitmap */
+  LispObj itabvec;              /* marked, but contents not traced */
+  natural nstatic;              /* static areas to take roots from */
+  LispObj *static_start[CM_MAX_STATIC_AREAS], *static_end[CM_MAX_STATIC_AREAS];
+  gc_vector stack;              /* mark_items */
+  gc_vector young_refs;         /* mark_items: always ranges */
+  gc_vector deferred;           /* LispObjs: weak vectors, pools */
+  gc_vector dirty;              /* naturals: indices of dirty pages */
+} concurrent_marker;
+
+static concurrent_marker CM;
+
+/* Set when the next full GC shouldn't use the concurrent marks */
+Boolean GCconcurrent_discard = false;
+
+static Boolean
+clear_soft_dirty_bits()
+{
+  int fd = open("/proc/self/clear_refs", O_WRONLY);
+  Boolean ok = false;
+
+  if (fd >= 0) {
+    ok = (write(fd, "4", 1) == 1);
+    close(fd);
+  }
+  return ok;
+}
+
+static Boolean
+read_pagemap(natural page, natural *entries, natural n)
+{
+  ssize_t nbytes = n*sizeof(natural);
+
+  return (pread(CM.pagemap_fd, entries, nbytes, page*sizeof(natural)) == nbytes);
+}
+
+/* Some kernels aren't configured to maintain soft-dirty bits; they
+   just never set them. */
+static Boolean
+soft_dirty_works()
+{
+  volatile char *p = MapMemory(NULL, page_size, MEMPROTECT_RW);
+  natural page = ((natural)p) >> log2_page_size, entry;
+  Boolean works = false;
+
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  p[0] = 1;
+  if (clear_soft_dirty_bits() &&
+      read_pagemap(page, &entry, 1) &&
+      ((entry & PAGEMAP_SOFT_DIRTY) == 0)) {
+    p[0] = 2;
+    works = (read_pagemap(page, &entry, 1) &&
+             ((entry & PAGEMAP_SOFT_DIRTY) != 0));
+  }
+  UnMapMemory((void *)p, page_size);
+  return works;
+}
+
+/* The number of dnodes in the (uvector) object whose header is HEADER */
+static natural
+object_dnodes(natural header)
+{
+  natural
+    subtag = header_subtag(header),
+    element_count = header_element_count(header),
+    total_size_in_bytes;
+  int tag = fulltag_of(header);
+
+  if ((nodeheader_tag_p(tag)) ||
+      (tag == ivector_class_64_bit)) {
+    total_size_in_bytes = 8 + (element_count<<3);
+  } else if (tag == ivector_class_32_bit) {
+    total_size_in_bytes = 8 + (element_count<<2);
+  } else {
+    if (subtag == subtag_bit_vector) {
+      total_size_in_bytes = 8 + ((element_count+7)>>3);
+    } else if (subtag >= min_8_bit_ivector_subtag) {
+      total_size_in_bytes = 8 + element_count;
+    } else {
+      total_size_in_bytes = 8 + (element_count<<1);
+    }
+  }
+  return (total_size_in_bytes+(dnode_size-1))>>dnode_shift;
+}
+
+/*
+  Push the unmarked objects in the marker's range that the N words at
+  START reference.  If NOTE_YOUNG is true and any of those words
+  reference something else in the dynamic area, the full GC will have
+  to look at those words again.
+*/
+static void
+cm_scan_range(LispObj *start, natural n, Boolean note_young)
+{
+  natural i, dnode;
+  Boolean young = false;
+  LispObj x;
+
+  for (i = 0; i < n; i++) {
+    x = start[i];
+    if (is_node_fulltag(fulltag_of(x))) {
+      dnode = area_dnode(x, CM.low);
+      if (dnode < CM.ndnodes) {
+        if (!ref_bit(CM.markbits, dnode)) {
+          push_mark_item(&CM.stack, x, 0);
+        }
+      } else if ((x >= lisp_global(HEAP_START)) &&
+                 (x < lisp_global(HEAP_END))) {
+        young = true;
+      }
+#ifdef LARGE_OBJECT_SPACE
+      else if (large_object_address_p(x)) {
+        young = true;           /* so that the full GC marks it */
+      }
+#endif
+    }
+  }
+  if (young && note_young) {
+    push_mark_item(&CM.young_refs, (LispObj)start, n);
+  }
+}
+
+/* Like mark_simple_area_range(), but the marker's version */
+static void
+cm_scan_static_range(LispObj *start, LispObj *end)
+{
+  LispObj x1;
+  int tag;
+
+  while (start < end) {
+    x1 = *start;
+    tag = fulltag_of(x1);
+    if (immheader_tag_p(tag)) {
+      start = (LispObj *)ptr_from_lispobj(skip_over_ivector(ptr_to_lispobj(start), x1));
+    } else if (!nodeheader_tag_p(tag)) {
+      cm_scan_range(start, 2, false);
+      start += 2;
+    } else {
+      int subtag = header_subtag(x1);
+      natural
+        element_count = header_element_count(x1),
+        skip = 0;
+
+      /* The full GC will handle weak things and pools here */
+      if (!(((subtag == subtag_hash_vector) &&
+             (((hash_table_vector_header *) start)->flags & nhash_weak_mask)) ||
+            (subtag == subtag_weak) ||
+            (subtag == subtag_pool))) {
+        if (subtag == subtag_function) {
+          skip = (int)start[1];
+        }
+        cm_scan_range(start+1+skip, element_count-skip, false);
+      }
+      start += ((element_count+1 + 1) & ~1);
+    }
+  }
+}
+
+static void
+cm_mark_node(LispObj n)
+{
+  int tag_n = fulltag_of(n);
+  natural dnode = area_dnode(n, CM.low);
+
+  if (tag_of(n) == tag_tra) {
+    if ((*((unsigned short *)n) == RECOVER_FN_FROM_RIP_WORD0) &&
+        (*((unsigned char *)(n+2)) == RECOVER_FN_FROM_RIP_BYTE2)) {
+      int sdisp = (*(int *) (n+3));
+      n = RECOVER_FN_FROM_RIP_LENGTH+n+sdisp;
+      tag_n = fulltag_function;
+      dnode = area_dnode(n, CM.low);
+      if (dnode >= CM.ndnodes) {
+        return;
+      }
+    } else {
+      return;
+    }
+  }
+
+  /* Everything we've marked or deferred has its start bit set */
+  if (ref_bit(CM.startbits, dnode)) {
+    return;
+  }
+  set_bit(CM.startbits, dnode);
+
+  if (tag_n == fulltag_cons) {
+    set_bit(CM.markbits, dnode);
+    cm_scan_range((LispObj *) ptr_from_lispobj(untag(n)), 2, true);
+    return;
+  }
+  {
+    LispObj *base = (LispObj *) ptr_from_lispobj(untag(n));
+    natural
+      header = *((natural *) base),
+      subtag = header_subtag(header),
+      element_count = header_element_count(header),
+      prefix_nodes = 0;
+
+    if (nodeheader_tag_p(fulltag_of(header))) {
+      if (((subtag == subtag_hash_vector) &&
+           (((hash_table_vector_header *) base)->flags & nhash_weak_mask)) ||
+          (subtag == subtag_weak) ||
+          (subtag == subtag_pool)) {
+        push_gc_vector_node(&CM.deferred, n);
+        return;
+      }
+      if (subtag == subtag_function) {
+        prefix_nodes = (natural) ((int) deref(base,1));
+      }
+      if (element_count > prefix_nodes) {
+        push_mark_item(&CM.stack,
+                       (LispObj)(base+1+prefix_nodes),
+                       element_count-prefix_nodes);
+      }
+    }
+    set_n_bits(CM.markbits, dnode, object_dnodes(header));
+  }
+}
+
+static void
+concurrent_mark_run()
+{
+  mark_item item;
+  natural i, n;
+
+  zero_bits(CM.markbits, CM.ndnodes);
+  zero_bits(CM.startbits, CM.ndnodes);
+
+  /* Anything that's written to after this will be looked at again */
+  if (!clear_soft_dirty_bits()) {
+    CM.failed = true;
+    return;
+  }
+
+  if (CM.itabvec) {
+    natural dnode = area_dnode(CM.itabvec, CM.low);
+
+    set_n_bits(CM.markbits, dnode, (header_element_count(header_of(CM.itabvec))+1) >> 1);
+    set_bit(CM.startbits, dnode);
+  }
+
+  for (i = 0; i < CM.nstatic; i++) {
+    cm_scan_static_range(CM.static_start[i], CM.static_end[i]);
+  }
+
+  while (!*(volatile Boolean *)&CM.stop) {
+    if (CM.stack.count == 0) {
+      break;
+    }
+    item = ((mark_item *)(CM.stack.data))[--CM.stack.count];
+    if (item.n == 0) {
+      cm_mark_node(item.obj);
+    } else {
+      n = item.n;
+      if (n > MARK_RANGE_CHUNK) {
+        push_mark_item(&CM.stack, (LispObj)(((LispObj *)item.obj)+MARK_RANGE_CHUNK), n-MARK_RANGE_CHUNK);
+        n = MARK_RANGE_CHUNK;
+      }
+      cm_scan_range((LispObj *)item.obj, n, true);
+    }
+  }
+}
+
+static void *
+concurrent_mark_loop(void *param)
+{
+  sigset_t mask;
+
+  sigfillset(&mask);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  while (1) {
+    SEM_WAIT_FOREVER(CM.wakeup);
+    concurrent_mark_run();
+    SEM_RAISE(CM.parked);
+  }
+  return NULL;
+}
+
+static Boolean
+init_concurrent_marker()
+{
+  int fd = open("/proc/self/pagemap", O_RDONLY);
+
+  if (fd < 0) {
+    return false;
+  }
+  CM.pagemap_fd = fd;
+  if (soft_dirty_works()) {
+    CM.wakeup = new_semaphore(0);
+    CM.parked = new_semaphore(0);
+    if (create_system_thread(MIN_CSTACK_SIZE, NULL, concurrent_mark_loop, NULL)) {
+      return true;
+    }
+    destroy_semaphore(&CM.wakeup);
+    destroy_semaphore(&CM.parked);
+  }
+  close(fd);
+  return false;
+}
+
+/*
+  Enable concurrent marking if ENABLE is positive, disable it if it's
+  0.  Return true if it's enabled.  This creates a thread, so it
+  mustn't be called during a GC.
+*/
+Boolean
+concurrent_mark_control(int enable)
+{
+  if ((enable > 0) && !CM.enabled) {
+    if ((CM.wakeup == NULL) && !init_concurrent_marker()) {
+      return false;
+    }
+    CM.enabled = true;
+  } else if (enable == 0) {
+    CM.enabled = false;
+  }
+  return CM.enabled;
+}
+
+static Boolean
+cm_ensure_bitmaps(natural ndnodes)
+{
+  natural nbytes;
+  bitvector markbits, startbits;
+
+  if (ndnodes <= CM.bitmap_dnodes) {
+    return true;
   }
+  /* Leave some room for the tenured generation to grow */
+  nbytes = align_to_power_of_2(((ndnodes+(ndnodes>>2))+7)>>3, log2_page_size);
+  markbits = MapMemory(NULL, nbytes, MEMPROTECT_RW);
+  if (markbits == MAP_FAILED) {
+    return false;
+  }
+  startbits = MapMemory(NULL, nbytes, MEMPROTECT_RW);
+  if (startbits == MAP_FAILED) {
+    UnMapMemory(markbits, nbytes);
+    return false;
+  }
+  if (CM.bitmap_dnodes) {
+    UnMapMemory(CM.markbits, CM.bitmap_dnodes>>3);
+    UnMapMemory(CM.startbits, CM.bitmap_dnodes>>3);
+  }
+  CM.markbits = markbits;
+  CM.startbits = startbits;
+  CM.bitmap_dnodes = nbytes<<3;
+  return true;
 }
 
+/*
+  Called at the end of an ephemeral GC.  If the next full GC isn't far
+  off, start marking the tenured generation.
+*/
+void
+concurrent_mark_start(TCR *tcr)
+{
+  area *a = active_dynamic_area, *next_area;
+  TCR *other_tcr;
+  LispObj pkg;
+  natural ndnodes;
 
+  if ((!CM.enabled) ||
+      (CM.state != CM_IDLE) ||
+      (lisp_global(OLDEST_EPHEMERAL) == 0) ||
+      ((natural)(a->high - a->active) >= (lisp_heap_gc_threshold >> 1))) {
+    return;
+  }
+  ndnodes = area_dnode(tenured_area->high, tenured_area->low);
+  if ((ndnodes == 0) || !cm_ensure_bitmaps(ndnodes)) {
+    return;
+  }
+  CM.low = ptr_to_lispobj(tenured_area->low);
+  CM.ndnodes = ndnodes;
+  CM.stop = false;
+  CM.failed = false;
+  CM.stack.count = 0;
+  CM.young_refs.count = 0;
+  CM.deferred.count = 0;
+
+  CM.itabvec = 0;
+  pkg = current_package(tcr);
+  if (pkg) {
+    LispObj itabvec = car(((package *)ptr_from_lispobj(untag(pkg)))->itab);
+
+    if (area_dnode(itabvec, CM.low) < ndnodes) {
+      CM.itabvec = itabvec;
+    }
+  }
 
+  /* The roots needn't be complete, since the full GC will mark from
+     all of them.  Find the ones on value stacks and in thread-local
+     bindings now; the marker can scan the static areas itself. */
+  cm_scan_range(&lisp_global(STATIC_CONSES), 1, false);
+  CM.nstatic = 0;
+  if (managed_static_area) {
+    CM.static_start[CM.nstatic] = (LispObj *)managed_static_area->low;
+    CM.static_end[CM.nstatic++] = (LispObj *)managed_static_area->active;
+  }
+  for (next_area = a->succ; next_area->code != AREA_VOID; next_area = next_area->succ) {
+    if (next_area->code == AREA_VSTACK) {
+      cm_scan_range((LispObj *)next_area->active,
+                    ((LispObj *)next_area->high)-((LispObj *)next_area->active),
+                    false);
+    } else if ((next_area->code == AREA_STATIC) &&
+               (next_area->younger == NULL) &&
+               (CM.nstatic < CM_MAX_STATIC_AREAS)) {
+      CM.static_start[CM.nstatic] = (LispObj *)next_area->low;
+      CM.static_end[CM.nstatic++] = (LispObj *)next_area->active;
+    }
+  }
+  other_tcr = tcr;
+  do {
+    cm_scan_range(other_tcr->tlb_pointer, other_tcr->tlb_limit/sizeof(LispObj), false);
+    other_tcr = TCR_AUX(other_tcr)->next;
+  } while (other_tcr != tcr);
 
+  if (GCverbose) {
+    fprintf(dbgout, ";;; Starting concurrent marking of the tenured generation\n");
+  }
+  CM.state = CM_MARKING;
+  SEM_RAISE(CM.wakeup);
+}
 
+/* Stop the marker and forget about its marks */
 void
-mark_headerless_area_range(LispObj *start, LispObj *end)
+concurrent_mark_abandon()
 {
-  while (start < end) {
-    mark_root(*start++);
+  if (CM.state == CM_MARKING) {
+    CM.stop = true;
+    SEM_WAIT_FOREVER(CM.parked);
+    CM.state = CM_IDLE;
   }
 }
 
-void
-mark_simple_area_range(LispObj *start, LispObj *end)
+static Boolean
+cm_find_dirty_pages()
 {
-  LispObj x1, *base;
-  int tag;
-
-  while (start < end) {
-    x1 = *start;
-    tag = fulltag_of(x1);
-    if (immheader_tag_p(tag)) {
-      start = (LispObj *)ptr_from_lispobj(skip_over_ivector(ptr_to_lispobj(start), x1));
-    } else if (!nodeheader_tag_p(tag)) {
-      ++start;
-      mark_root(x1);
-      mark_root(*start++);
-    } else {
-      int subtag = header_subtag(x1);
-      natural element_count = header_element_count(x1);
-      natural size = (element_count+1 + 1) & ~1;
-
-      if (subtag == subtag_hash_vector) {
-        LispObj flags = ((hash_table_vector_header *) start)->flags;
-
-        if (flags & nhash_weak_mask) {
-          ((hash_table_vector_header *) start)->cache_key = undefined;
-          ((hash_table_vector_header *) start)->cache_value = lisp_nil;
-          mark_weak_htabv((LispObj)start);
-	  element_count = 0;
-	}
-      } 
-      if (subtag == subtag_pool) {
-	start[1] = lisp_nil;
-      }
-
-      if (subtag == subtag_weak) {
-	natural weak_type = (natural) start[2];
-	if (weak_type >> population_termination_bit)
-	  element_count -= 2;
-	else
-	  element_count -= 1; 
-	start[1] = GCweakvll;
-	GCweakvll = ptr_to_lispobj(start);
+  natural
+    page = CM.low >> log2_page_size,
+    limit = ((CM.low+(CM.ndnodes<<dnode_shift))+(page_size-1)) >> log2_page_size,
+    entries[PAGEMAP_CHUNK],
+    i, n;
+
+  CM.dirty.count = 0;
+  for (; page < limit; page += n) {
+    n = limit-page;
+    if (n > PAGEMAP_CHUNK) {
+      n = PAGEMAP_CHUNK;
+    }
+    if (!read_pagemap(page, entries, n)) {
+      return false;
+    }
+    for (i = 0; i < n; i++) {
+      if (entries[i] & PAGEMAP_SOFT_DIRTY) {
+        push_gc_vector_node(&CM.dirty, page+i);
       }
+    }
+  }
+  return true;
+}
 
-      base = start + element_count + 1;
-      if (subtag == subtag_function) {
-#ifdef X8632
-	natural skip = (unsigned short)start[1];
-
-	/* XXX bootstrapping */
-	if (skip & 0x8000)
-	  skip = element_count - (skip & 0x7fff);
-
-	element_count -= skip;
+static void
+cm_mark_items(gc_vector *v)
+{
+  mark_item *items = (mark_item *)(v->data);
+  LispObj *p;
+  natural i, j;
 
-#else
-	element_count -= (int)start[1];
-#endif
-      }
-      while(element_count--) {
-	mark_root(*--base);
+  for (i = 0; i < v->count; i++) {
+    if (items[i].n == 0) {
+      mark_root(items[i].obj);
+    } else {
+      p = (LispObj *)(items[i].obj);
+      for (j = 0; j < items[i].n; j++) {
+        mark_root(p[j]);
       }
-      start += size;
     }
   }
+  v->count = 0;
 }
 
-
-/* Mark a tstack area */
-void
-mark_tstack_area(area *a)
+/* The last dnode at or before DNODE whose start bit is set.  There
+   has to be one. */
+static natural
+cm_prev_start(natural dnode)
 {
-  LispObj
-    *current,
-    *next,
-    *start = (LispObj *) (a->active),
-    *end = start,
-    *limit = (LispObj *) (a->high);
+  natural
+    idx = dnode >> bitmap_shift,
+    w = CM.startbits[idx] & (ALL_ONES << (bitmap_shift_count_mask-(dnode & bitmap_shift_count_mask)));
 
-  for (current = start;
-       end != limit;
-       current = next) {
-    next = (LispObj *) ptr_from_lispobj(*current);
-    end = ((next >= start) && (next < limit)) ? next : limit;
-    mark_simple_area_range(current+2, end);
+  while (w == 0) {
+    w = CM.startbits[--idx];
   }
+  return (idx << bitmap_shift) + (bitmap_shift_count_mask - __builtin_ctzll(w));
 }
 
-/*
-  It's really important that headers never wind up in tagged registers.
-  Those registers would (possibly) get pushed on the vstack and confuse
-  the hell out of this routine.
-
-  vstacks are just treated as a "simple area range", possibly with
-  an extra word at the top (where the area's active pointer points.)
-  */
-
-void
-mark_vstack_area(area *a)
+/* The first dnode in [dnode,limit) whose start bit is set, or LIMIT */
+static natural
+cm_next_start(natural dnode, natural limit)
 {
-  LispObj
-    *start = (LispObj *) a->active,
-    *end = (LispObj *) a->high;
-
-#if 0
-  fprintf(dbgout, "mark VSP range: 0x" LISP ":0x" LISP "\n", start, end);
-#endif
-  mark_headerless_area_range(start, end);
+  natural w, idx;
+
+  while (dnode < limit) {
+    idx = dnode & bitmap_shift_count_mask;
+    w = CM.startbits[dnode >> bitmap_shift] << idx;
+    if (w) {
+      dnode += count_leading_zeros(w);
+      return (dnode < limit) ? dnode : limit;
+    }
+    dnode += (nbits_in_word-idx);
+  }
+  return limit;
 }
 
-/* No lisp objects on cstack on x86, at least x86-64 */
-void
-mark_cstack_area(area *a)
+/* Mark from the words of the object that starts at dnode START that
+   are in dnodes [d0,d1) */
+static void
+cm_mark_object_words(natural start, natural d0, natural d1)
 {
-}
+  LispObj *base = (LispObj *)(CM.low + (start << dnode_shift));
+  natural header = *base, first, limit, i;
+  int tag = fulltag_of(header);
 
+  if (!ref_bit(CM.markbits, start)) {
+    return;                     /* deferred */
+  }
+  if (immheader_tag_p(tag)) {
+    return;
+  }
+  if (nodeheader_tag_p(tag)) {
+    if (ptr_to_lispobj(base) == untag(CM.itabvec)) {
+      return;                   /* gc() takes care of it */
+    }
+    first = 1;
+    if (header_subtag(header) == subtag_function) {
+      first += (int)base[1];
+    }
+    limit = 1+header_element_count(header);
+  } else {
+    first = 0;
+    limit = 2;
+  }
+  if ((d0 > start) && (first < ((d0-start) << 1))) {
+    first = (d0-start) << 1;
+  }
+  if (limit > ((d1-start) << 1)) {
+    limit = (d1-start) << 1;
+  }
+  for (i = first; i < limit; i++) {
+    mark_root(base[i]);
+  }
+}
 
-/* Mark the lisp objects in an exception frame */
-#ifdef X8664
-void
-mark_xp(ExceptionInformation *xp)
+static void
+cm_mark_dirty_page(natural page)
 {
-  natural *regs = (natural *) xpGPRvector(xp), dnode;
-  LispObj rip;
-    
-  
+  LispObj
+    low = page << log2_page_size,
+    high = low + page_size;
+  natural d0, d1, start, next;
 
-  mark_root(regs[Iarg_z]);
-  mark_root(regs[Iarg_y]);
-  mark_root(regs[Iarg_x]);
-  mark_root(regs[Isave3]);
-  mark_root(regs[Isave2]);
-  mark_root(regs[Isave1]);
-  mark_root(regs[Isave0]);
-  mark_root(regs[Ifn]);
-  mark_root(regs[Itemp0]);
-  mark_root(regs[Itemp1]);
-  mark_root(regs[Itemp2]);
-  /* If the RIP isn't pointing into a marked function,
-     we can -maybe- recover from that if it's tagged as
-     a TRA. */
-  rip = regs[Iip];
-  dnode = gc_area_dnode(rip);
-  if ((dnode < GCndnodes_in_area) &&
-      (! ref_bit(GCmarkbits,dnode))) {
-    if (tag_of(rip) == tag_tra) {
-      mark_root(rip);
-    } else if ((fulltag_of(rip) == fulltag_function) &&
-               (*((unsigned short *)rip) == RECOVER_FN_FROM_RIP_WORD0) &&
-               (*((unsigned char *)(rip+2)) == RECOVER_FN_FROM_RIP_BYTE2) &&
-               ((*(int *) (rip+3))) == -RECOVER_FN_FROM_RIP_LENGTH) {
-      mark_root(rip);
-    } else {
-      Bug(NULL, "Can't find function for rip 0x%16lx",rip);
-    }
+  if (low < CM.low) {
+    low = CM.low;
+  }
+  d0 = area_dnode(low, CM.low);
+  d1 = area_dnode(high, CM.low);
+  if (d1 > CM.ndnodes) {
+    d1 = CM.ndnodes;
+  }
+  next = d0;
+  if (ref_bit(CM.markbits, d0)) {
+    start = cm_prev_start(d0);
+    cm_mark_object_words(start, d0, d1);
+    next = d0+1;
+  }
+  while ((start = cm_next_start(next, d1)) < d1) {
+    cm_mark_object_words(start, d0, d1);
+    next = start+1;
   }
 }
-#else
+
+/*
+  Called by a full GC, after GCmarkbits has been cleared and the
+  (current) itabvec's been marked but before anything else has.  Use
+  the concurrent marks, if there are any and if we can.
+*/
 void
-mark_xp(ExceptionInformation *xp, natural node_regs_mask)
+concurrent_mark_finish(LispObj itabvec)
 {
-  natural *regs = (natural *) xpGPRvector(xp), dnode;
-  LispObj eip;
+  Boolean discard = GCconcurrent_discard;
+  natural offset, i;
 
-  if (node_regs_mask & (1<<0)) mark_root(regs[REG_EAX]);
-  if (node_regs_mask & (1<<1)) mark_root(regs[REG_ECX]);
-  if (regs[REG_EFL] & EFL_DF) {
-    /* DF set means EDX should be treated as an imm reg */
-    ;
-  } else
-    if (node_regs_mask & (1<<2)) mark_root(regs[REG_EDX]);
+  GCconcurrent_discard = false;
+  if (CM.state == CM_IDLE) {
+    return;
+  }
+  concurrent_mark_abandon();
+  if (discard || CM.failed || (CM.low < GCarealow)) {
+    return;
+  }
+  offset = area_dnode(CM.low, GCarealow);
+  if ((offset & bitmap_shift_count_mask) ||
+      ((offset+CM.ndnodes) > GCndnodes_in_area) ||
+      !cm_find_dirty_pages()) {
+    return;
+  }
+  ior_bits(GCmarkbits+(offset>>bitmap_shift), CM.markbits,
+           align_to_power_of_2(CM.ndnodes, bitmap_shift));
 
-  if (node_regs_mask & (1<<3)) mark_root(regs[REG_EBX]);
-  if (node_regs_mask & (1<<4)) mark_root(regs[REG_ESP]);
-  if (node_regs_mask & (1<<5)) mark_root(regs[REG_EBP]);
-  if (node_regs_mask & (1<<6)) mark_root(regs[REG_ESI]);
-  if (node_regs_mask & (1<<7)) mark_root(regs[REG_EDI]);
+  cm_mark_items(&CM.stack);
+  cm_mark_items(&CM.young_refs);
+  for (i = 0; i < CM.deferred.count; i++) {
+    mark_root(((LispObj *)(CM.deferred.data))[i]);
+  }
+  if (CM.itabvec && (CM.itabvec != itabvec)) {
+    /* *PACKAGE* changed; trace the old itabvec's contents */
+    natural n = header_element_count(header_of(CM.itabvec));
+    LispObj *raw = 1+((LispObj *)ptr_from_lispobj(untag(CM.itabvec)));
 
-  /* If the EIP isn't pointing into a marked function, we're probably
-     in trouble.  We can -maybe- recover from that if it's tagged as a
-     TRA. */
-  eip = regs[Ieip];
-  dnode = gc_area_dnode(eip);
-  if ((dnode < GCndnodes_in_area) &&
-      (! ref_bit(GCmarkbits,dnode))) {
-    if (fulltag_of(eip) == fulltag_tra) {
-      mark_root(eip);
-    } else if ((fulltag_of(eip) == fulltag_misc) &&
-               (header_subtag(header_of(eip)) == subtag_function) &&
-               (*(unsigned char *)eip == RECOVER_FN_OPCODE) &&
-	       (*(LispObj *)(eip + 1)) == eip) {
-      mark_root(eip);
-    } else {
-      Bug(NULL, "Can't find function for eip 0x%4x", eip);
+    for (i = 0; i < n; i++) {
+      mark_root(raw[i]);
     }
   }
+  for (i = 0; i < CM.dirty.count; i++) {
+    cm_mark_dirty_page(((natural *)(CM.dirty.data))[i]);
+  }
+  if (GCverbose) {
+    fprintf(dbgout, ";;; Using concurrent marks, %ld dirty pages\n", (long)CM.dirty.count);
+  }
 }
 #endif
 
@@ -1527,6 +3239,12 @@ calculate_relocation()
   natural thesebits;
   LispObj first = 0;
 
+#ifdef PARALLEL_GC
+  if (use_parallel_compaction()) {
+    return parallel_calculate_relocation();
+  }
+#endif
+
   if (npagelets) {
     do {
       *relocptr++ = current;
@@ -1688,6 +3406,15 @@ locative_forwarding_address(LispObj obj)
 
   if ((dnode >= GCndynamic_dnodes_in_area) ||
       (obj < GCfirstunmarked)) {
+#ifdef LARGE_OBJECT_SPACE
+    if (GCevacuating_large_objects && large_object_address_p(obj)) {
+      LispObj copy = large_object_copy_address(obj);
+
+      if (copy) {
+        return locative_forwarding_address(copy);
+      }
+    }
+#endif
     return obj;
   }
 
@@ -1965,6 +3692,12 @@ compact_dynamic_heap()
   int tag;
   bitvector markbits = GCmarkbits;
 
+#ifdef PARALLEL_GC
+  if (use_parallel_compaction()) {
+    return parallel_compact_dynamic_heap();
+  }
+#endif
+
   if (dnode < GCndnodes_in_area) {
     lisp_global(FWDNUM) += (1<<fixnum_shift);
   
@@ -2731,7 +4464,7 @@ update_managed_refs(area *a, BytePtr low_dynamic_address, natural ndynamic_dnode
       if (intergen_ref) {
         ref_dnode = area_dnode(start, base);
         set_bit(refbits, ref_dnode);
-        set_bit(refidx, ref_dnode>>8);
+        set_refidx(refidx, ref_dnode>>8);
       }
       start += 2;
     }
@@ -2770,6 +4503,9 @@ purify(TCR *tcr, signed_natural param)
   if (pure_area) {
     new_pure_start = pure_area->active;
     lisp_global(IN_GC) = (1<<fixnumshift);
+#ifdef SAMPLING_PROFILER
+    discard_profile_samples();
+#endif
 
     /* 
       Caller will typically GC again (and that should recover quite a bit of
@@ -2838,11 +4574,14 @@ purify(TCR *tcr, signed_natural param)
         lisp_global(MANAGED_STATIC_DNODES) = managed_dnodes;
         CommitMemory(managed_static_area->refbits, refbytes); /* zeros them */
         CommitMemory(managed_static_refbits,refbytes); /* zeroes them, too */
-        CommitMemory(managed_static_refidx,((managed_dnodes+255)>>8)>>3);
+        CommitMemory(managed_static_refidx,refidx_bytes(managed_dnodes));
         update_managed_refs(managed_static_area, low_markable_address, area_dnode(a->active,low_markable_address));
       }
       managed_static_area->high = managed_static_area->active;
     }
+#ifdef PERF_JITDUMP
+    purify_jitdump_functions(low, high);
+#endif
     ProtectMemory(pure_area->low,
 		  align_to_power_of_2(pure_area->active-pure_area->low,
 				      log2_page_size));
@@ -3177,12 +4916,18 @@ impurify_from_area(TCR *tcr, area *src)
   } while (other_tcr != tcr);
   
   impurify_gcable_ptrs(ptr_to_lispobj(base), ptr_to_lispobj(limit), delta);
+#ifdef PERF_JITDUMP
+  impurify_jitdump_functions(ptr_to_lispobj(base), ptr_to_lispobj(limit), delta);
+#endif
 }
 
 signed_natural
 impurify(TCR *tcr, signed_natural param)
 {
   lisp_global(IN_GC)=1;
+#ifdef SAMPLING_PROFILER
+  discard_profile_samples();
+#endif
   impurify_from_area(tcr, readonly_area);
   impurify_from_area(tcr, managed_static_area);
   lisp_global(MANAGED_STATIC_DNODES)=0;
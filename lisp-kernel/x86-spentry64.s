@@ -1757,6 +1757,8 @@ C(egc_write_barrier_start):
 /* setting the bit needs to be done atomically, unless we're sure that other  */
 /* threads are suspended.)  */
 /* We can unconditionally set the suspended thread's RIP to the return address.  */
+/* The refidx vectors have a byte per 256 dnodes, so marking the card  */
+/* that contains the refbit is just a (non-interlocked) byte store.  */
 
 	
 _spentry(rplaca)
@@ -1779,9 +1781,7 @@ C(egc_rplaca):
         __(btsq %imm0,(%temp0))
         __(ref_global(ephemeral_refidx,%temp0))
         __(shrq $8,%imm0)
-        __(xorq $63,%imm0)
-        __(lock)
-        __(btsq %imm0,(%temp0))
+        __(movb $1,(%temp0,%imm0))
 2:      __(cmpq lisp_global(managed_static_dnodes),%imm1)
         __(jae 0b)
         __(ref_global(managed_static_refbits,%temp0))
@@ -1790,8 +1790,7 @@ C(egc_rplaca):
         __(btsq %imm1,(%temp0))
         __(shrq $8,%imm1)
         __(ref_global(managed_static_refidx,%temp0))
-        __(xor $63,%imm1)
-        __(btsq %imm1,(%temp0))
+        __(movb $1,(%temp0,%imm1))
         __(ret)
 _endsubp(rplaca)
 
@@ -1815,9 +1814,7 @@ C(egc_rplacd):
         __(btsq %imm0,(%temp0))
         __(ref_global(ephemeral_refidx,%temp0))
         __(shrq $8,%imm0)
-        __(xorq $63,%imm0)
-        __(lock)
-        __(btsq %imm0,(%temp0))
+        __(movb $1,(%temp0,%imm0))
 2:      __(cmpq lisp_global(managed_static_dnodes),%imm1)
         __(jae 0b)
         __(ref_global(managed_static_refbits,%temp0))
@@ -1826,9 +1823,7 @@ C(egc_rplacd):
         __(btsq %imm1,(%temp0))
         __(shrq $8,%imm1)
         __(ref_global(managed_static_refidx,%temp0))
-        __(xorq $63,%imm1)
-        __(lock)
-        __(btsq %imm1,(%temp0))
+        __(movb $1,(%temp0,%imm1))
         __(ret)        
 _endsubp(rplacd)
 
@@ -1855,9 +1850,7 @@ C(egc_gvset):
         __(btsq %imm0,(%temp0))
         __(ref_global(ephemeral_refidx,%temp0))
         __(shrq $8,%imm0)
-        __(xorq $63,%imm0)
-        __(lock)
-        __(btsq %imm0,(%temp0))
+        __(movb $1,(%temp0,%imm0))
 2:      __(cmpq lisp_global(managed_static_dnodes),%imm1)
         __(jae 0b)
         __(ref_global(managed_static_refbits,%temp0))
@@ -1866,9 +1859,7 @@ C(egc_gvset):
         __(btsq %imm1,(%temp0))        
         __(shrq $8,%imm1)
         __(ref_global(managed_static_refidx,%temp0))
-        __(xor $63,%imm1)
-        __(lock)
-        __(btsq %imm1,(%temp0))
+        __(movb $1,(%temp0,%imm1))
         __(ret)                
 _endsubp(gvset)
 
@@ -1897,9 +1888,7 @@ C(egc_set_hash_key):
         __(btsq %imm0,(%temp0))
         __(ref_global(ephemeral_refidx,%temp0))
         __(shrq $8,%imm0)
-        __(xorq $63,%imm0)
-        __(lock)
-        __(btsq %imm0,(%temp0))
+        __(movb $1,(%temp0,%imm0))
         /* Now memoize the address of the hash vector   */
         __(ref_global(refbits,%temp0))
         __(movq %arg_x,%imm0)
@@ -1910,9 +1899,7 @@ C(egc_set_hash_key):
         __(btsq %imm0,(%temp0))
         __(ref_global(ephemeral_refidx,%temp0))
         __(shrq $8,%imm0)
-        __(xorq $63,%imm0)
-        __(lock)
-        __(btsq %imm0,(%temp0))
+        __(movb $1,(%temp0,%imm0))
 2:      __(cmpq lisp_global(managed_static_dnodes),%imm1)
         __(jae 0b)
         __(ref_global(managed_static_refbits,%temp0))
@@ -1921,9 +1908,7 @@ C(egc_set_hash_key):
         __(btsq %imm1,(%temp0))
         __(ref_global(managed_static_refidx,%temp0))
         __(shrq $8,%imm1)
-        __(xor $63,%imm1)
-        __(lock)
-        __(btsq %imm1,(%temp0))        
+        __(movb $1,(%temp0,%imm1))
         /* Now memoize the address of the hash vector   */
         __(movq %arg_x,%imm0)
         __(subq lisp_global(ref_base),%imm0)
@@ -1934,9 +1919,7 @@ C(egc_set_hash_key):
         __(btsq %imm0,(%temp0))
         __(ref_global(managed_static_refidx,%temp0))
         __(shrq $8,%imm0)
-        __(xorq $63,%imm0)
-        __(lock)
-        __(btsq %imm0,(%temp0))
+        __(movb $1,(%temp0,%imm0))
         __(ret)
 _endsubp(set_hash_key)
 
@@ -1970,9 +1953,7 @@ C(egc_store_node_conditional_success_test):
         __(btsq %imm0,(%temp1))
         __(shrq $8,%imm0)
         __(ref_global(ephemeral_refidx,%temp1))
-        __(xorq $63,%imm0)
-        __(lock)
-        __(btsq %imm0,(%temp1))
+        __(movb $1,(%temp1,%imm0))
 2:      __(cmpq lisp_global(managed_static_dnodes),%imm1)
         __(jae 8f)
         __(ref_global(managed_static_refbits,%temp1))
@@ -1981,9 +1962,7 @@ C(egc_store_node_conditional_success_test):
         __(btsq %imm1,(%temp1))    
         __(ref_global(managed_static_refidx,%temp1))
         __(shrq $8,%imm1)
-        __(xor $63,%imm1)
-        __(lock)
-        __(btsq %imm1,(%temp1))    
+        __(movb $1,(%temp1,%imm1))
 	.globl C(egc_store_node_conditional_success_end)
 C(egc_store_node_conditional_success_end):
 8:      __(movl $t_value,%arg_z_l)
@@ -2015,10 +1994,8 @@ C(egc_set_hash_key_conditional_success_test):
         __(lock)
         __(btsq %imm0,(%temp1))
         __(shrq $8,%imm0)
-        __(xorq $63,%imm0)
         __(ref_global(ephemeral_refidx,%temp1))
-        __(lock)
-        __(btsq %imm0,(%temp1))
+        __(movb $1,(%temp1,%imm0))
         /* Now memoize the address of the hash vector   */
         __(movq %arg_x,%imm0)
         __(subq lisp_global(ref_base),%imm0)
@@ -2028,10 +2005,8 @@ C(egc_set_hash_key_conditional_success_test):
         __(lock)
         __(btsq %imm0,(%temp1))
         __(shrq $8,%imm0)
-        __(xorq $63,%imm0)
         __(ref_global(ephemeral_refidx,%temp1))
-        __(lock)
-        __(btsq %imm0,(%temp1))
+        __(movb $1,(%temp1,%imm0))
 2:      __(cmpq lisp_global(managed_static_dnodes),%imm1)
         __(jae 8f)
         __(ref_global(managed_static_refbits,%temp1))
@@ -2040,8 +2015,7 @@ C(egc_set_hash_key_conditional_success_test):
         __(btsq %imm1,(%temp1))
         __(ref_global(managed_static_refidx,%temp1))
         __(shrq $8,%imm1)
-        __(xor $63,%imm1)
-        __(btsq %imm1,(%temp1))
+        __(movb $1,(%temp1,%imm1))
         /* Now memoize the address of the hash vector   */
         __(movq %arg_x,%imm0)
         __(subq lisp_global(ref_base),%imm0)
@@ -2052,9 +2026,7 @@ C(egc_set_hash_key_conditional_success_test):
         __(btsq %imm0,(%temp1))
         __(ref_global(managed_static_refidx,%temp1))
         __(shrq $8,%imm0)
-        __(xor $63,%imm0)
-        __(lock)
-        __(btsq %imm0,(%temp1))
+        __(movb $1,(%temp1,%imm0))
         .globl C(egc_write_barrier_end)
 C(egc_write_barrier_end):
 8:      __(movl $t_value,%arg_z_l)